@@ -18,4 +18,19 @@ void FramGetDeviceID(uint8_t *manufacturerID, uint16_t *productID);
 uint8_t FramGetStatusRegister(void);
 void FramSetStatusRegister(uint8_t value);
 
+#ifdef __linux__
+typedef struct							// what the SPI bus has done
+{
+	uint32_t transactions;				// SPI transactions
+	uint64_t bytes;						// bytes sent and received
+	uint64_t busyNs;					// time the bus would be busy [ns]
+} framStats_t;
+
+// On Linux, the FRAM's contents are kept in a file (see MB85RS64_Linux.c).
+bool FramImageOpen(const char *path, uint32_t size);
+void FramImageClose(void);
+void FramImageGetStats(framStats_t *stats);
+void FramImageResetStats(void);
+#endif
+
 #endif
@@ -0,0 +1,242 @@
+/**************************************************************************//**
+ * @brief	Stand-in for the MB85RS64 FRAM driver on Linux.
+ * @remarks	The FRAM's contents are kept in a file that's mapped into
+ *			memory, so code that uses FRAM (like PersistentLog) can be run
+ *			and tested on a PC, and what's stored survives the program
+ *			exiting the same way it survives a reset on the real chip.
+ *			It also adds up how long the SPI bus would have been busy (see
+ *			FramImageGetStats), so code that uses FRAM can be measured.
+ *			Call FramImageOpen before anything else in this library.
+ *****************************************************************************/
+
+#include <stdint.h>						// standard-size types
+#include <stdbool.h>					// defines "bool" type
+#include <stddef.h>						// defines "size_t", "NULL"
+#include <string.h>						// memcpy, memset
+#include <fcntl.h>						// open
+#include <unistd.h>						// close, ftruncate
+#include <sys/mman.h>					// mmap, msync, munmap
+#include <sys/stat.h>					// fstat
+#include "MB85RS64.h"					// header for this module
+
+// SPI clock [Hz].  The MB85RS64 runs at up to 20 MHz; 8 MHz is typical
+// from an MSP430.
+#ifndef FRAM_SPI_HZ
+#define FRAM_SPI_HZ				8000000
+#endif
+
+// time to start each SPI transaction (chip select, and the driver's own
+// overhead) [ns]
+#ifndef FRAM_TRANSACTION_NS
+#define FRAM_TRANSACTION_NS		2000
+#endif
+
+static uint8_t *mImage = NULL;			// FRAM contents, mapped from the file
+static uint32_t mImageSize;				// size of FRAM [bytes]
+static uint8_t mStatusReg;				// FRAM status register
+static uint8_t mAddressSize = 2;		// bytes sent for each address
+static framStats_t mStats;				// what the SPI bus has done
+
+/**************************************************************************//**
+ * @brief	Count an SPI transaction toward the statistics.
+ * @param	bytes - bytes sent and received, including the command
+ *****************************************************************************/
+static void CountTransaction(size_t bytes)
+{
+	mStats.transactions++;
+	mStats.bytes += bytes;
+	mStats.busyNs += FRAM_TRANSACTION_NS + ((uint64_t)bytes * 8 * 1000000000u) / FRAM_SPI_HZ;
+}
+
+/**************************************************************************//**
+ * @brief	Open (or create) a file to hold the FRAM's contents.
+ * @remarks	A new file is filled with zeros, like a new FRAM chip.  If a
+ *			file is already open, it's written and closed first.
+ * @param	path - name of the file
+ * @param	size - size of the FRAM [bytes] (8192 for an MB85RS64)
+ * @returns	true for success; false otherwise
+ *****************************************************************************/
+bool FramImageOpen(const char *path, uint32_t size)
+{
+	int fd;								// file descriptor
+	struct stat info;					// file information
+	bool result = false;				// a pessimistic return value :(
+
+	FramImageClose();
+
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd >= 0)
+	{
+		// Grow the file if it's too small (new space reads as zero).
+		if ((fstat(fd, &info) == 0) &&
+			((info.st_size >= (off_t)size) || (ftruncate(fd, size) == 0)))
+		{
+			mImage = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (mImage != MAP_FAILED)
+			{
+				mImageSize = size;
+				result = true;
+			}
+			else
+			{
+				mImage = NULL;
+			}
+		}
+
+		// The mapping stays valid after the file is closed.
+		close(fd);
+	}
+
+	return result;
+}
+
+/**************************************************************************//**
+ * @brief	Write the FRAM's contents to the file and close it.
+ *****************************************************************************/
+void FramImageClose(void)
+{
+	if (mImage != NULL)
+	{
+		msync(mImage, mImageSize, MS_SYNC);
+		munmap(mImage, mImageSize);
+		mImage = NULL;
+	}
+}
+
+/**************************************************************************//**
+ * @brief	Get what the SPI bus has done since the stats were reset.
+ * @param	stats - returns the statistics
+ *****************************************************************************/
+void FramImageGetStats(framStats_t *stats)
+{
+	*stats = mStats;
+}
+
+/**************************************************************************//**
+ * @brief	Reset the statistics.
+ *****************************************************************************/
+void FramImageResetStats(void)
+{
+	mStats.transactions = 0;
+	mStats.bytes = 0;
+	mStats.busyNs = 0;
+}
+
+/**************************************************************************//**
+ * @brief	Test whether the FRAM image is open.
+ * @returns	true for success; false otherwise
+ *****************************************************************************/
+bool FramCheck(void)
+{
+	return (mImage != NULL);
+}
+
+/**************************************************************************//**
+ * @brief	Remember how many bytes to send for the FRAM's address.
+ * @remarks	Addresses aren't sent anywhere on Linux; this only changes the
+ *			bus time in the statistics.
+ * @param	bytes - width of FRAM chip's address [bytes]
+ *****************************************************************************/
+void FramSetAddressSize(uint8_t bytes)
+{
+	mAddressSize = bytes;
+}
+
+/**************************************************************************//**
+ * @brief	Enable writing to FRAM
+ * @remarks	The image is always writable, so this does nothing.
+ * @param	enable - true to enable; false to disable
+ *****************************************************************************/
+void FramWriteEnable(bool enable)
+{
+	(void)enable;
+	CountTransaction(1);
+}
+
+/**************************************************************************//**
+ * @brief	Write a byte at the specific FRAM address
+ * @param	addr - address to write to in FRAM memory
+ * @param	value - 8-bit value to write to memory
+ *****************************************************************************/
+void FramWriteByte(uint32_t addr, uint8_t value)
+{
+	FramWrite(addr, &value, 1);
+}
+
+/**************************************************************************//**
+ * @brief	Write array of data to FRAM.
+ * @remarks	Like the real chip, the address wraps around at the end.
+ * @param	addr - address to act upon
+ * @param	values - array of data to write
+ * @param	count - number of bytes to write
+ *****************************************************************************/
+void FramWrite(uint32_t addr, const uint8_t *values, size_t count)
+{
+	size_t i;							// counter
+
+	CountTransaction(1 + mAddressSize + count);
+	for (i = 0; (mImage != NULL) && (i < count); i++)
+	{
+		mImage[(addr + i) % mImageSize] = values[i];
+	}
+}
+
+/**************************************************************************//**
+ * @brief	Read a byte from FRAM
+ * @param	addr - address to act upon
+ * @returns	value read from FRAM
+ *****************************************************************************/
+uint8_t FramReadByte(uint32_t addr)
+{
+	uint8_t value = 0;					// return value
+
+	FramRead(addr, &value, 1);
+
+	return value;
+}
+
+/**************************************************************************//**
+ * @brief	Read array of bytes from FRAM
+ * @param	addr - address to act upon
+ * @param	values - pointer to array of data read from FRAM
+ * @param	count - number of bytes to read
+ *****************************************************************************/
+void FramRead(uint32_t addr, uint8_t *values, size_t count)
+{
+	size_t i;							// counter
+
+	CountTransaction(1 + mAddressSize + count);
+	for (i = 0; (mImage != NULL) && (i < count); i++)
+	{
+		values[i] = mImage[(addr + i) % mImageSize];
+	}
+}
+
+/**************************************************************************//**
+ * @brief	Read manufacturer ID and Product ID from FRAM
+ * @remarks	Reports the IDs of an MB85RS64, so FramCheck-style code passes.
+ * @param	manufacturerID - 8-bit manufacturer ID (Fujitsu = 0x04)
+ * @param	productID - memory density and proprietary product ID
+ *****************************************************************************/
+void FramGetDeviceID(uint8_t *manufacturerID, uint16_t *productID)
+{
+	*manufacturerID = 0x04;
+	*productID = 0x0302;
+}
+
+/**************************************************************************//**
+ * @brief	Reads the status register
+ * @returns	value of status register
+ *****************************************************************************/
+uint8_t FramGetStatusRegister(void)
+{
+	return mStatusReg;
+}
+
+/**************************************************************************//**
+ * @brief	Sets the status register
+ *****************************************************************************/
+void FramSetStatusRegister(uint8_t value)
+{
+	mStatusReg = value;
+}
@@ -14,6 +14,7 @@
 #define ADCDRIVER_H
 
 #include <stdint.h>						// universal data types
+#include "PingPong.h"					// double buffers for streaming
 
 #ifndef ADC_COUNT_IS_DEFINED			// ensure ADC's sample size is defined
 #error "adcCount_t should be typedefed in your project."
@@ -62,5 +63,7 @@ adcResult_t AdcInit(uint8_t channel, adcConfig_t *configPtr);
 adcResult_t AdcSetCallback(uint8_t channel, adcCbType_t type, adcCallback_t Callback);
 adcResult_t AdcReadCounts(uint8_t channel, adcCount_t *sample);
 adcResult_t AdcReadVoltage(uint8_t channel, float *sample);
+adcResult_t AdcReadStream(uint8_t channel, pingPong_t *pp);
+adcResult_t AdcStopStream(uint8_t channel);
 
 #endif /* ADCDRIVER_H */
@@ -13,6 +13,8 @@
 #ifndef UARTDRIVER_H
 #define UARTDRIVER_H
 
+#include "PingPong.h"					// double buffers for received data
+
 typedef enum							// result of requested UART action
 {
 	UART_RESULT_OK = 0,					// All is well!
@@ -64,6 +66,7 @@ uartResult_t UARTDisable(uint8_t channel);
 uartResult_t UARTRegisterCallback(uint8_t channel, uartCallback_t callback);
 uartResult_t UARTWrite(uint8_t channel, uint8_t *data, uint32_t count);
 uartResult_t UARTIsBusy(uint8_t channel);
+uartResult_t UARTSetRxBuffer(uint8_t channel, pingPong_t *pp);
 
 #ifdef INCLUDE_TESTS
 bool UARTTest(uint8_t channel);
@@ -0,0 +1,347 @@
+/******************************************************************************
+ * @file	Flash.c
+ * @author	Adam Johnson
+ * @remarks	Simulated NOR flash for Linux, so code that uses flash (like
+ *			FlashManager) can be run, measured and stress-tested on a PC.
+ *			Flash's contents are kept in RAM, or in a file that's mapped
+ *			into memory so they survive the program exiting the same way
+ *			they survive a reset on the real chip.
+ *****************************************************************************/
+
+#include <stdint.h>						// standard-size types
+#include <stdbool.h>					// defines "bool" type
+#include <stddef.h>						// defines "NULL"
+#include <stdlib.h>						// malloc, calloc, free
+#include <string.h>						// memset
+#include <fcntl.h>						// open
+#include <unistd.h>						// close, ftruncate
+#include <sys/mman.h>					// mmap, msync, munmap
+#include <sys/stat.h>					// fstat
+#include "Flash.h"						// header for this module
+
+/******************************************************************************
+ *	Local variables
+ *****************************************************************************/
+
+static uint8_t *mFlash = NULL;			// flash's contents
+static uint32_t mFlashSize;				// size of flash [bytes]
+static bool mMapped;					// is mFlash mapped from a file?
+static uint32_t *mEraseCounts = NULL;	// times each segment has been erased
+static flashStats_t mStats;				// what flash has done
+static uint32_t mStepsToPowerFail = 0;	// steps left before power is cut
+static bool mPowerFailed = false;		// has power been cut?
+
+/******************************************************************************
+ *	Local Functions
+ *****************************************************************************/
+
+/**
+ * @brief	Check that there's power for a step (programming one byte, or
+ *			erasing one segment), and count it toward a power failure.
+ * @returns	true if the step can happen; false if power has been cut
+ */
+static bool TakeStep(void)
+{
+	bool result = !mPowerFailed;		// return value
+
+	if ((result == true) && (mStepsToPowerFail != 0))
+	{
+		mStepsToPowerFail--;
+		if (mStepsToPowerFail == 0)
+		{
+			mPowerFailed = true;
+		}
+	}
+
+	return result;
+}
+
+/**
+ * @brief	Program bytes into flash, like NOR flash does.
+ * @remarks	Programming can only change bits from 1 to 0 (the flash ends
+ *			up holding the AND of the old and new values).  Asking for a 1
+ *			where flash holds a 0, writing outside flash, or writing to a
+ *			misaligned address counts as a violation.
+ * @param	dataPtr - data to write
+ * @param	flashPtr - where to write it
+ * @param	bytes - number of bytes to write
+ * @param	align - required alignment of flashPtr [bytes]
+ */
+static void ProgramBytes(const uint8_t *dataPtr, uint8_t *flashPtr, uint32_t bytes, uint32_t align)
+{
+	uint32_t offset;					// offset of flashPtr into flash
+	uint32_t i;							// counter
+
+	mStats.writes++;
+
+	if ((mFlash == NULL) || (flashPtr < mFlash) ||
+		((uint32_t)(flashPtr - mFlash) + bytes > mFlashSize))
+	{
+		mStats.violations++;
+	}
+	else
+	{
+		offset = (uint32_t)(flashPtr - mFlash);
+		if ((offset % align) != 0)
+		{
+			mStats.violations++;
+		}
+
+		for (i = 0; (i < bytes) && (TakeStep() == true); i++)
+		{
+			if ((dataPtr[i] & ~flashPtr[i]) != 0)
+			{
+				mStats.violations++;
+			}
+			flashPtr[i] &= dataPtr[i];
+			mStats.bytesWritten++;
+		}
+	}
+}
+
+/******************************************************************************
+ *	Public functions
+ *****************************************************************************/
+
+/**
+ * @brief	Open (or create) a file to hold flash's contents.
+ * @remarks	A new file is erased (filled with 0xFF), like new flash.  If
+ *			path is NULL, flash is kept in RAM instead, and starts erased.
+ *			Erase counts start at zero either way.
+ * @param	path - name of the file (or NULL)
+ * @param	size - size of flash [bytes] (a multiple of FLASH_SEGMENT_SIZE)
+ * @returns	true for success; false otherwise
+ */
+bool FlashMemImageOpen(const char *path, uint32_t size)
+{
+	int fd;								// file descriptor
+	struct stat info;					// file information
+	bool result = false;				// a pessimistic return value :(
+
+	FlashMemImageClose();
+
+	if (path == NULL)
+	{
+		mFlash = malloc(size);
+		if (mFlash != NULL)
+		{
+			memset(mFlash, 0xFF, size);
+			mMapped = false;
+			result = true;
+		}
+	}
+	else
+	{
+		fd = open(path, O_RDWR | O_CREAT, 0644);
+		if ((fd >= 0) && (fstat(fd, &info) == 0))
+		{
+			// Grow the file if it's too small.
+			if ((info.st_size >= (off_t)size) || (ftruncate(fd, size) == 0))
+			{
+				mFlash = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+				if (mFlash != MAP_FAILED)
+				{
+					// New space reads as zero.  Erase it.
+					if (info.st_size < (off_t)size)
+					{
+						memset(mFlash + info.st_size, 0xFF, size - info.st_size);
+					}
+					mMapped = true;
+					result = true;
+				}
+				else
+				{
+					mFlash = NULL;
+				}
+			}
+		}
+
+		// The mapping stays valid after the file is closed.
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+	}
+
+	if (result == true)
+	{
+		mFlashSize = size;
+		mEraseCounts = calloc(size / FLASH_SEGMENT_SIZE, sizeof(uint32_t));
+		FlashMemResetStats();
+	}
+
+	return result;
+}
+
+/**
+ * @brief	Write flash's contents to the file (if there is one) and close it.
+ */
+void FlashMemImageClose(void)
+{
+	if (mFlash != NULL)
+	{
+		if (mMapped == true)
+		{
+			msync(mFlash, mFlashSize, MS_SYNC);
+			munmap(mFlash, mFlashSize);
+		}
+		else
+		{
+			free(mFlash);
+		}
+		mFlash = NULL;
+	}
+
+	free(mEraseCounts);
+	mEraseCounts = NULL;
+}
+
+/**
+ * @brief	Get the address of the start of flash.
+ * @returns	start of flash; NULL if it isn't open
+ */
+uint8_t *FlashMemGetBase(void)
+{
+	return mFlash;
+}
+
+/**
+ * @brief	Erase the segment that holds an address.
+ * @param	flashPtr - address in the segment
+ */
+void FlashMemSegmentErase(uint8_t *flashPtr)
+{
+	uint32_t segment;					// segment to erase
+
+	if ((mFlash == NULL) || (flashPtr < mFlash) || ((uint32_t)(flashPtr - mFlash) >= mFlashSize))
+	{
+		mStats.violations++;
+	}
+	else if (TakeStep() == true)
+	{
+		segment = (uint32_t)(flashPtr - mFlash) / FLASH_SEGMENT_SIZE;
+		memset(mFlash + (segment * FLASH_SEGMENT_SIZE), 0xFF, FLASH_SEGMENT_SIZE);
+
+		mEraseCounts[segment]++;
+		mStats.erases++;
+		mStats.busyNs += FLASH_ERASE_NS;
+	}
+}
+
+/**
+ * @brief	Check that bytes in flash are erased (0xFF).
+ * @param	flashPtr - first byte to check
+ * @param	count - number of bytes to check
+ * @returns	true if all bytes are erased; false otherwise
+ */
+bool FlashMemEraseCheck(uint8_t *flashPtr, uint16_t count)
+{
+	bool result = true;					// an optimistic return value :)
+	uint16_t i;							// counter
+
+	for (i = 0; i < count; i++)
+	{
+		if (flashPtr[i] != 0xFF)
+		{
+			result = false;
+		}
+	}
+
+	return result;
+}
+
+/**
+ * @brief	Write bytes to flash.
+ * @param	dataPtr - data to write
+ * @param	flashPtr - where to write it
+ * @param	count - number of bytes to write
+ */
+void FlashMemWrite8(uint8_t *dataPtr, uint8_t *flashPtr, uint16_t count)
+{
+	ProgramBytes(dataPtr, flashPtr, count, 1);
+
+	mStats.busyNs += (uint64_t)count * FLASH_WRITE8_NS;
+}
+
+/**
+ * @brief	Write 16-bit words to flash.
+ * @param	dataPtr - data to write
+ * @param	flashPtr - where to write it (must be 2-byte aligned)
+ * @param	count - number of words to write
+ */
+void FlashMemWrite16(uint16_t *dataPtr, uint16_t *flashPtr, uint16_t count)
+{
+	ProgramBytes((uint8_t *)dataPtr, (uint8_t *)flashPtr, (uint32_t)count * 2, 2);
+
+	mStats.busyNs += (uint64_t)count * FLASH_WRITE16_NS;
+}
+
+/**
+ * @brief	Write 32-bit words to flash, in block-write mode.
+ * @param	dataPtr - data to write
+ * @param	flashPtr - where to write it (must be 4-byte aligned)
+ * @param	count - number of words to write
+ */
+void FlashMemWrite32(uint32_t *dataPtr, uint32_t *flashPtr, uint16_t count)
+{
+	ProgramBytes((uint8_t *)dataPtr, (uint8_t *)flashPtr, (uint32_t)count * 4, 4);
+
+	mStats.busyNs += FLASH_BLOCK_NS + ((uint64_t)count * FLASH_WRITE32_NS);
+}
+
+/**
+ * @brief	Get the number of times a segment has been erased.
+ * @param	segment - segment number (its offset / FLASH_SEGMENT_SIZE)
+ * @returns	number of erases since flash was opened
+ */
+uint32_t FlashMemGetEraseCount(uint32_t segment)
+{
+	uint32_t count = 0;					// return value
+
+	if ((mEraseCounts != NULL) && (segment < (mFlashSize / FLASH_SEGMENT_SIZE)))
+	{
+		count = mEraseCounts[segment];
+	}
+
+	return count;
+}
+
+/**
+ * @brief	Get what the simulated flash has done.
+ * @param	stats - returns the statistics
+ */
+void FlashMemGetStats(flashStats_t *stats)
+{
+	*stats = mStats;
+}
+
+/**
+ * @brief	Reset the statistics (but not the erase counts).
+ */
+void FlashMemResetStats(void)
+{
+	memset(&mStats, 0, sizeof(mStats));
+}
+
+/**
+ * @brief	Cut the power after a number of steps.
+ * @remarks	A step is programming one byte, or erasing one segment.  After
+ *			the last step, writes and erases are ignored, like they would be
+ *			on a chip that's lost power, until this is called with zero.
+ * @param	steps - steps to allow before cutting the power (0 to turn the
+ *			power back on)
+ */
+void FlashMemSetPowerFail(uint32_t steps)
+{
+	mStepsToPowerFail = steps;
+	mPowerFailed = false;
+}
+
+/**
+ * @brief	Check whether the power has been cut.
+ * @returns	true if the power has been cut; false otherwise
+ */
+bool FlashMemIsPowerFailed(void)
+{
+	return mPowerFailed;
+}
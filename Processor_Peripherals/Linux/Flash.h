@@ -0,0 +1,96 @@
+/******************************************************************************
+ * @file	Flash.h
+ * @author	Adam Johnson
+ * @remarks	Simulated NOR flash for Linux, so code that uses flash (like
+ *			FlashManager) can be run, measured and stress-tested on a PC.
+ *			It has the same functions as the MSP430 flash driver, and acts
+ *			like real flash:  writes can only clear bits, erases work on
+ *			whole segments, and erases are counted for each segment.  It
+ *			also adds up how long the real flash would have been busy, and
+ *			can cut the power partway through a write to test recovery.
+ *			Call FlashMemImageOpen before anything else in this library.
+ *****************************************************************************/
+
+#ifndef FLASH_H
+#define FLASH_H
+
+/******************************************************************************
+ *	Configuration Settings
+ *	(Settings with #ifndef can be changed from the compiler's command line.)
+ *****************************************************************************/
+
+// size of the smallest piece of flash that can be erased [bytes]
+#ifndef FLASH_SEGMENT_SIZE
+#define FLASH_SEGMENT_SIZE		128
+#endif
+
+// Programming and erase times [ns].  The defaults are typical values from
+// the MSP430F5xx datasheet.  32-bit writes use block-write mode, which has
+// some extra time at the start and end of each block.
+#ifndef FLASH_WRITE8_NS
+#define FLASH_WRITE8_NS			64000	// time to write a byte
+#endif
+#ifndef FLASH_WRITE16_NS
+#define FLASH_WRITE16_NS		64000	// time to write a 16-bit word
+#endif
+#ifndef FLASH_WRITE32_NS
+#define FLASH_WRITE32_NS		37000	// time to write a 32-bit word in a block
+#endif
+#ifndef FLASH_BLOCK_NS
+#define FLASH_BLOCK_NS			67000	// extra time for each block
+#endif
+#ifndef FLASH_ERASE_NS
+#define FLASH_ERASE_NS			23000000	// time to erase a segment
+#endif
+
+/******************************************************************************
+ *	Typedefs
+ *****************************************************************************/
+
+typedef struct							// what the simulated flash has done
+{
+	uint64_t bytesWritten;				// bytes programmed
+	uint32_t writes;					// calls to FlashMemWriteXX
+	uint32_t erases;					// segments erased
+	uint32_t violations;				// bad writes (see FlashMemWrite8)
+	uint64_t busyNs;					// time real flash would be busy [ns]
+} flashStats_t;
+
+/******************************************************************************
+ *	Public functions
+ *****************************************************************************/
+
+// Open (or create) a file to hold flash's contents, or use RAM (path = NULL).
+bool FlashMemImageOpen(const char *path, uint32_t size);
+
+// Write flash's contents to the file and close it.
+void FlashMemImageClose(void);
+
+// Get the address of the start of flash.
+uint8_t *FlashMemGetBase(void);
+
+// Erase the segment that holds flashPtr.
+void FlashMemSegmentErase(uint8_t *flashPtr);
+
+// Check that bytes are erased.
+bool FlashMemEraseCheck(uint8_t *flashPtr, uint16_t count);
+
+// Write bytes, 16-bit words or 32-bit words to flash.
+void FlashMemWrite8(uint8_t *dataPtr, uint8_t *flashPtr, uint16_t count);
+void FlashMemWrite16(uint16_t *dataPtr, uint16_t *flashPtr, uint16_t count);
+void FlashMemWrite32(uint32_t *dataPtr, uint32_t *flashPtr, uint16_t count);
+
+// Get the number of times a segment has been erased.
+uint32_t FlashMemGetEraseCount(uint32_t segment);
+
+// Get, or reset, what the simulated flash has done.
+void FlashMemGetStats(flashStats_t *stats);
+void FlashMemResetStats(void);
+
+// Cut the power after a number of steps (0 turns the power back on).
+void FlashMemSetPowerFail(uint32_t steps);
+
+// Check whether the power has been cut.
+bool FlashMemIsPowerFailed(void);
+
+#endif
@@ -20,6 +20,7 @@
 #include "prcm.h"						// DriverLib - power reset clock manager
 #include "adc.h"						// DriverLib - ADC
 #include "project.h"					// global project settings
+#include "PingPong.h"					// double buffers for streaming
 #include "ADC.h"						// header for this module
 
 #define ADC_NUM_CHANNELS	4			// number of channels in the processor
@@ -36,6 +37,9 @@ static volatile uint32_t adcNumSamplesDesired;
 static volatile uint32_t adcNumSamplesAcquired;
 static volatile adcSample_t *adcSamplesArray;
 
+// double buffer to stream samples into (NULL when not streaming)
+static pingPong_t * volatile adcStreamPtr;
+
 /******************************************************************************
  *
  *	Function:		AdcISR
@@ -49,6 +53,7 @@ void AdcISR (void)
 {
 	uint32_t isrSourceMask;		// bit-flags for interrupt source
 	uint32_t rawData;
+	adcSample_t sample;			// sample extracted from the ADC data
 //	uint32_t timestamp;
 //	uint32_t voltage;
 
@@ -61,8 +66,20 @@ void AdcISR (void)
 	if ((isrSourceMask & ADC_FIFO_OVERFLOW) ||
 		(isrSourceMask & ADC_FIFO_FULL))
 	{
+		// If we're streaming, move everything in the FIFO to the double
+		// buffer.  Conversions keep going until AdcStopStream is called.
+		if (adcStreamPtr != NULL)
+		{
+			while (MAP_ADCFIFOLvlGet(ADC_BASE, adcActiveChannelCode))
+			{
+				rawData = MAP_ADCFIFORead(ADC_BASE, adcActiveChannelCode);
+				sample = (rawData >> 2) & 0xFFF;
+				PingPongWrite(adcStreamPtr, &sample, sizeof(sample));
+			}
+		}
+
 		// Call callback when conversions are complete.
-		if (adcNumSamplesAcquired >= adcNumSamplesDesired)
+		else if (adcNumSamplesAcquired >= adcNumSamplesDesired)
 		{
 			// Disable all ADC channels.
 			MAP_ADCChannelDisable(ADC_BASE, adcActiveChannelCode);
@@ -277,6 +294,81 @@ adcResult_t AdcReadSamples(adcChannel_t channel, adcSample_t *sampleArray, uint3
 	return result;
 }
 
+/******************************************************************************
+ *
+ *	Description:	Start reading from the ADC continuously, into a double
+ *					buffer.  While the application processes one half of the
+ *					buffer, the ADC fills the other, so there are no gaps in
+ *					the samples.  The buffer's callback runs when a half is
+ *					full.
+ *
+ *	Parameters:		channel - ADC channel to act upon
+ *					pp - double buffer, set up with PingPongInit; each half
+ *						should be a multiple of sizeof(adcSample_t)
+ *
+ *	Return value:	ADC_RESULT_OK on success; other on failure
+ *
+ *****************************************************************************/
+
+adcResult_t AdcReadStream(adcChannel_t channel, pingPong_t *pp)
+{
+	adcResult_t result;					// return value
+
+	// Stream into the double buffer instead of an array.
+	adcStreamPtr = pp;
+
+	// Start conversions.  The sample count doesn't matter when streaming.
+	result = AdcReadSamples(channel, NULL, 0);
+
+	if (result != ADC_RESULT_OK)
+	{
+		adcStreamPtr = NULL;
+	}
+
+	return result;
+}
+
+/******************************************************************************
+ *
+ *	Description:	Stop reading from the ADC into a double buffer.  Samples
+ *					in a partly filled half are handed to the application.
+ *
+ *	Parameters:		channel - ADC channel to act upon
+ *
+ *	Return value:	ADC_RESULT_OK on success; other on failure
+ *
+ *****************************************************************************/
+
+adcResult_t AdcStopStream(adcChannel_t channel)
+{
+	adcResult_t result = ADC_RESULT_OK;	// an optimistic return value :)
+	pingPong_t *pp = adcStreamPtr;		// buffer we were streaming into
+
+	if ((channel != adcActiveChannel) || (pp == NULL))
+	{
+		result = ADC_RESULT_INVALID_SELECTION;
+	}
+
+	else
+	{
+		// Stop the interrupt first, so it doesn't touch the buffer.
+		MAP_ADCIntDisable(ADC_BASE, adcActiveChannelCode, ADC_FIFO_UNDERFLOW | ADC_FIFO_FULL);
+		MAP_ADCIntUnregister(ADC_BASE, adcActiveChannelCode);
+
+		// Stop conversions.
+		MAP_ADCChannelDisable(ADC_BASE, adcActiveChannelCode);
+		MAP_ADCTimerDisable(ADC_BASE);
+		MAP_ADCDisable(ADC_BASE);
+
+		adcStreamPtr = NULL;
+
+		// Hand over whatever's left.
+		PingPongFlush(pp);
+	}
+
+	return result;
+}
+
 /******************************************************************************
  *
  *	Description:	Retrieves the last conversion value from the ADC
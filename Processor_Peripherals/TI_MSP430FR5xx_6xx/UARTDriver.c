@@ -13,6 +13,8 @@
 #include <stdint.h>						// compiler-specific data types
 #include <driverlib.h>					// TI peripheral drivers
 #include <assert.h>						// assert is used in this module
+#include <stddef.h>						// defines "NULL"
+#include "PingPong.h"					// double buffers for received data
 #include "hal_UART.h"					// header for this module
 
 /******************************************************************************
@@ -59,7 +61,58 @@ static const uint16_t baseAddr[] = {
 };
 
 // Figure out how many channels we have available.
-#define UART_NUM_CHANNELS	(sizeof(baseAddr)/sizeof(baseAddr[0])
+#define UART_NUM_CHANNELS	(sizeof(baseAddr)/sizeof(baseAddr[0]))
+
+// double buffer for each channel's received data (NULL if not buffering)
+static pingPong_t *rxBufferArray[UART_NUM_CHANNELS];
+
+/******************************************************************************
+ * @brief	Handle an interrupt from a UART.
+ * @param	base - base address of the UART's registers
+ *****************************************************************************/
+static void UARTHandleISR(uint16_t base)
+{
+	uint8_t channel;					// channel with this base address
+	uint8_t data;						// received byte
+
+	if (EUSCI_A_UART_getInterruptStatus(base, EUSCI_A_UART_RECEIVE_INTERRUPT_FLAG))
+	{
+		// Reading the byte clears the interrupt flag.
+		data = EUSCI_A_UART_receiveData(base);
+
+		// Find which channel this is.
+		for (channel = 0; channel < UART_NUM_CHANNELS; channel++)
+		{
+			if (baseAddr[channel] == base)
+			{
+				break;
+			}
+		}
+
+		// Store the byte.  When a half of the buffer fills, the buffer's
+		// callback runs and reception carries on into the other half.
+		if ((channel < UART_NUM_CHANNELS) && (rxBufferArray[channel] != NULL))
+		{
+			PingPongWrite(rxBufferArray[channel], &data, 1);
+		}
+	}
+}
+
+#ifdef __MSP430_HAS_EUSCI_A0__
+#pragma vector=EUSCI_A0_VECTOR
+__interrupt void UARTA0ISR(void)
+{
+	UARTHandleISR(__MSP430_BASEADDRESS_EUSCI_A0__);
+}
+#endif
+
+#ifdef __MSP430_HAS_EUSCI_A1__
+#pragma vector=EUSCI_A1_VECTOR
+__interrupt void UARTA1ISR(void)
+{
+	UARTHandleISR(__MSP430_BASEADDRESS_EUSCI_A1__);
+}
+#endif
 
 uartResult_t UARTInit(uartChannel_t channel, uartConfig_t *configPtr)
 {
@@ -137,6 +190,39 @@ uartResult_t UARTIsBusy(uartChannel_t channel)
 	return UART_RESULT_NOT_IMPLEMENTED;
 }
 
+/******************************************************************************
+ * @brief	Receive data into a double buffer.
+ * @remarks	The interrupt fills one half of the buffer while the application
+ *			processes the other, so no bytes are lost while it's busy.  The
+ *			buffer's callback runs when a half is full; to get a partial half
+ *			(e.g. when the line goes idle), call PingPongFlush with this
+ *			channel's interrupt disabled.
+ * @param	channel - UART channel to act upon
+ * @param	pp - double buffer set up with PingPongInit; NULL to stop
+ * @returns	UART_RESULT_OK on success; other on failure
+ *****************************************************************************/
+uartResult_t UARTSetRxBuffer(uartChannel_t channel, pingPong_t *pp)
+{
+	uint16_t base = baseAddr[channel];		// Convert channel to base address.
+
+	// Ensure the index is valid.
+	assert(channel < UART_NUM_CHANNELS);
+
+	// Stop the interrupt while we change buffers.
+	EUSCI_A_UART_disableInterrupt(base, EUSCI_A_UART_RECEIVE_INTERRUPT);
+
+	rxBufferArray[channel] = pp;
+
+	// Start receiving into the new buffer.
+	if (pp != NULL)
+	{
+		EUSCI_A_UART_clearInterrupt(base, EUSCI_A_UART_RECEIVE_INTERRUPT_FLAG);
+		EUSCI_A_UART_enableInterrupt(base, EUSCI_A_UART_RECEIVE_INTERRUPT);
+	}
+
+	return UART_RESULT_OK;
+}
+
 /******************************************************************************
  * Test Functions
  *****************************************************************************/
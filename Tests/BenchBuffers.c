@@ -0,0 +1,556 @@
+/******************************************************************************
+ *
+ *	Filename:		BenchBuffers.c
+ *
+ *	Author:			Adam Johnson
+ *
+ *	Description:	Measures the buffering primitives in Utilities on a PC, so
+ *					picking a buffer for a driver can be based on numbers.
+ *					Each run prints one CSV line with throughput [MB/s] and
+ *					cost per operation [ns], for a range of element sizes,
+ *					block sizes, and producer/consumer thread counts:
+ *
+ *					circbuf_byte	circBuff_t, one CBAdd/CBRemove per byte
+ *					circbuf_block	circBuff_t, CBAddBlock/CBRemoveBlock
+ *					pingpong		PingPongWrite of one element at a time
+ *					spsc			lock-free single-producer/single-consumer
+ *									ring (one producer and one consumer thread)
+ *					mpmc			lock-free bounded multi-producer/multi-
+ *									consumer queue (Vyukov's design)
+ *					mpmc_mutex		the same queue protected by one mutex
+ *
+ *					The SPSC and MPMC queues don't exist in Utilities yet;
+ *					they're here as reference points for what a threaded
+ *					(or ISR-to-task) buffer would cost.
+ *
+ *					Build and run on Linux (from this folder):
+ *					gcc -O2 -pthread -I../Utilities BenchBuffers.c
+ *						../Utilities/CircularBuffer.c ../Utilities/PingPong.c
+ *						-o BenchBuffers
+ *					./BenchBuffers [megabytes per run] > buffers.csv
+ *
+ *	Terms of Use:	MIT License
+ *
+ *****************************************************************************/
+
+#include <stdint.h>						// universal data types
+#include <stdbool.h>					// defines "bool"
+#include <stddef.h>						// defines "size_t", "NULL"
+#include <stdio.h>						// printf
+#include <stdlib.h>						// atoi, malloc
+#include <string.h>						// memcpy
+#include <stdatomic.h>					// lock-free queues
+#include <pthread.h>					// producer/consumer threads
+#include <sched.h>						// sched_yield
+#include <time.h>						// clock_gettime
+#include "CircularBuffer.h"				// byte ring under test
+#include "PingPong.h"					// double buffer under test
+
+/******************************************************************************
+ *	Settings
+ *****************************************************************************/
+
+#define DEFAULT_MEGABYTES	64			// data moved per run, unless specified
+#define QUEUE_SLOTS			1024		// capacity of the queues [elements]
+#define MAX_ELEM_SIZE		64			// largest element size tested [bytes]
+#define MAX_THREADS			8			// most producers (or consumers)
+#define CACHE_LINE			64			// keeps counters on separate lines
+
+static const size_t elemSizes[] = { 1, 4, 16, 64 };
+static const uint8_t blockSizes[] = { 1, 8, 32, 64 };
+static const int threadPairs[][2] = { {1, 1}, {2, 2}, {4, 4}, {1, 4}, {4, 1} };
+
+#define COUNT_OF(array)		(sizeof(array) / sizeof((array)[0]))
+
+/******************************************************************************
+ *	Timing and output
+ *****************************************************************************/
+
+static double Now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + ((double)ts.tv_nsec * 1e-9);
+}
+
+static void Report(const char *name, size_t elemSize, size_t blockSize,
+	int producers, int consumers, uint64_t bytes, uint64_t ops, double seconds)
+{
+	printf("%s,%zu,%zu,%d,%d,%llu,%.6f,%.1f,%.2f\n", name, elemSize, blockSize,
+		producers, consumers, (unsigned long long)bytes, seconds,
+		((double)bytes / seconds) / 1e6, (seconds * 1e9) / (double)ops);
+}
+
+/******************************************************************************
+ *	circBuff_t
+ *****************************************************************************/
+
+static volatile uint8_t sink;			// keeps the compiler from cheating
+
+static void BenchCircBuffByte(uint64_t bytes, uint8_t blockSize)
+{
+	circBuff_t buffer;
+	uint64_t moved = 0;
+	uint8_t i;
+	uint8_t datum = 0;
+	double start;
+
+	CBInit(&buffer);
+	start = Now();
+
+	// Fill blockSize bytes, then drain them, one byte at a time.
+	while (moved < bytes)
+	{
+		for (i = 0; i < blockSize; i++)
+		{
+			CBAdd(&buffer, datum++);
+		}
+		for (i = 0; i < blockSize; i++)
+		{
+			sink = CBRemove(&buffer);
+		}
+		moved += blockSize;
+	}
+
+	Report("circbuf_byte", 1, blockSize, 1, 1, moved, moved * 2, Now() - start);
+}
+
+static void BenchCircBuffBlock(uint64_t bytes, uint8_t blockSize)
+{
+	circBuff_t buffer;
+	uint8_t block[BUFFER_SIZE];
+	uint64_t moved = 0;
+	uint64_t ops = 0;
+	double start;
+
+	memset(block, 0x5A, sizeof(block));
+	CBInit(&buffer);
+
+	// Start part-way through the array, so blocks straddle the wrap too.
+	CBAddBlock(&buffer, block, BUFFER_SIZE / 3);
+	start = Now();
+
+	while (moved < bytes)
+	{
+		CBAddBlock(&buffer, block, blockSize);
+		CBRemoveBlock(&buffer, block, blockSize);
+		moved += blockSize;
+		ops += 2;
+	}
+
+	Report("circbuf_block", 1, blockSize, 1, 1, moved, ops, Now() - start);
+}
+
+/******************************************************************************
+ *	PingPong
+ *****************************************************************************/
+
+static void BenchPingPong(uint64_t bytes, size_t elemSize)
+{
+	static uint8_t memory[2 * 256 * MAX_ELEM_SIZE];
+	uint8_t element[MAX_ELEM_SIZE];
+	pingPong_t pp;
+	uint64_t moved = 0;
+	uint64_t ops = 0;
+	uint16_t count;
+	double start;
+
+	memset(element, 0xA5, sizeof(element));
+	PingPongInit(&pp, memory, (uint16_t)(256 * elemSize), NULL);
+	start = Now();
+
+	// Write elements as an ISR would; release halves as the app would.
+	while (moved < bytes)
+	{
+		PingPongWrite(&pp, element, (uint16_t)elemSize);
+		if (PingPongGetReady(&pp, &count) != NULL)
+		{
+			PingPongRelease(&pp);
+		}
+		moved += elemSize;
+		ops++;
+	}
+
+	Report("pingpong", elemSize, elemSize, 1, 1, moved, ops, Now() - start);
+}
+
+/******************************************************************************
+ *	Single-producer/single-consumer lock-free ring
+ *****************************************************************************/
+
+typedef struct
+{
+	_Alignas(CACHE_LINE) atomic_size_t head;	// next slot to write (producer)
+	_Alignas(CACHE_LINE) atomic_size_t tail;	// next slot to read (consumer)
+	_Alignas(CACHE_LINE) size_t elemSize;		// size of each element
+	uint8_t *slots;								// QUEUE_SLOTS elements
+} spscQueue_t;
+
+static bool SpscPush(spscQueue_t *q, const uint8_t *element)
+{
+	size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+	bool result = false;
+
+	if ((head - tail) < QUEUE_SLOTS)
+	{
+		memcpy(&q->slots[(head % QUEUE_SLOTS) * q->elemSize], element, q->elemSize);
+		atomic_store_explicit(&q->head, head + 1, memory_order_release);
+		result = true;
+	}
+
+	return result;
+}
+
+static bool SpscPop(spscQueue_t *q, uint8_t *element)
+{
+	size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+	bool result = false;
+
+	if (head != tail)
+	{
+		memcpy(element, &q->slots[(tail % QUEUE_SLOTS) * q->elemSize], q->elemSize);
+		atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+		result = true;
+	}
+
+	return result;
+}
+
+typedef struct
+{
+	spscQueue_t *queue;
+	uint64_t count;
+} spscJob_t;
+
+static void *SpscProducer(void *arg)
+{
+	spscJob_t *job = arg;
+	uint8_t element[MAX_ELEM_SIZE] = { 0 };
+	uint64_t i;
+
+	for (i = 0; i < job->count; i++)
+	{
+		element[0] = (uint8_t)i;
+		while (!SpscPush(job->queue, element))
+		{
+			sched_yield();
+		}
+	}
+
+	return NULL;
+}
+
+static void *SpscConsumer(void *arg)
+{
+	spscJob_t *job = arg;
+	uint8_t element[MAX_ELEM_SIZE];
+	uint64_t i;
+
+	for (i = 0; i < job->count; i++)
+	{
+		while (!SpscPop(job->queue, element))
+		{
+			sched_yield();
+		}
+		sink = element[0];
+	}
+
+	return NULL;
+}
+
+static void BenchSpsc(uint64_t bytes, size_t elemSize)
+{
+	spscQueue_t queue;
+	spscJob_t job;
+	pthread_t producer;
+	pthread_t consumer;
+	double start;
+
+	atomic_init(&queue.head, 0);
+	atomic_init(&queue.tail, 0);
+	queue.elemSize = elemSize;
+	queue.slots = malloc(QUEUE_SLOTS * elemSize);
+	job.queue = &queue;
+	job.count = bytes / elemSize;
+
+	start = Now();
+	pthread_create(&producer, NULL, SpscProducer, &job);
+	pthread_create(&consumer, NULL, SpscConsumer, &job);
+	pthread_join(producer, NULL);
+	pthread_join(consumer, NULL);
+
+	Report("spsc", elemSize, elemSize, 1, 1, job.count * elemSize, job.count * 2,
+		Now() - start);
+
+	free(queue.slots);
+}
+
+/******************************************************************************
+ *	Multi-producer/multi-consumer bounded queue
+ *****************************************************************************/
+
+typedef struct
+{
+	atomic_size_t sequence;				// which lap of the queue this cell is on
+	uint8_t data[MAX_ELEM_SIZE];		// the element
+} mpmcCell_t;
+
+typedef struct
+{
+	_Alignas(CACHE_LINE) atomic_size_t enqueuePos;
+	_Alignas(CACHE_LINE) atomic_size_t dequeuePos;
+	_Alignas(CACHE_LINE) size_t elemSize;
+	mpmcCell_t *cells;					// QUEUE_SLOTS cells
+	pthread_mutex_t lock;				// used only by the mutex variant
+	bool useMutex;						// true = mutex variant
+} mpmcQueue_t;
+
+static bool MpmcPush(mpmcQueue_t *q, const uint8_t *element)
+{
+	mpmcCell_t *cell;
+	size_t pos = atomic_load_explicit(&q->enqueuePos, memory_order_relaxed);
+	size_t seq;
+	intptr_t diff;
+
+	for (;;)
+	{
+		cell = &q->cells[pos % QUEUE_SLOTS];
+		seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		diff = (intptr_t)seq - (intptr_t)pos;
+
+		if (diff == 0)
+		{
+			if (atomic_compare_exchange_weak_explicit(&q->enqueuePos, &pos, pos + 1,
+					memory_order_relaxed, memory_order_relaxed))
+			{
+				break;
+			}
+		}
+		else if (diff < 0)
+		{
+			return false;				// full
+		}
+		else
+		{
+			pos = atomic_load_explicit(&q->enqueuePos, memory_order_relaxed);
+		}
+	}
+
+	memcpy(cell->data, element, q->elemSize);
+	atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+
+	return true;
+}
+
+static bool MpmcPop(mpmcQueue_t *q, uint8_t *element)
+{
+	mpmcCell_t *cell;
+	size_t pos = atomic_load_explicit(&q->dequeuePos, memory_order_relaxed);
+	size_t seq;
+	intptr_t diff;
+
+	for (;;)
+	{
+		cell = &q->cells[pos % QUEUE_SLOTS];
+		seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+		if (diff == 0)
+		{
+			if (atomic_compare_exchange_weak_explicit(&q->dequeuePos, &pos, pos + 1,
+					memory_order_relaxed, memory_order_relaxed))
+			{
+				break;
+			}
+		}
+		else if (diff < 0)
+		{
+			return false;				// empty
+		}
+		else
+		{
+			pos = atomic_load_explicit(&q->dequeuePos, memory_order_relaxed);
+		}
+	}
+
+	memcpy(element, cell->data, q->elemSize);
+	atomic_store_explicit(&cell->sequence, pos + QUEUE_SLOTS, memory_order_release);
+
+	return true;
+}
+
+static bool MpmcPushAny(mpmcQueue_t *q, const uint8_t *element)
+{
+	bool result;
+
+	if (q->useMutex)
+	{
+		pthread_mutex_lock(&q->lock);
+		result = MpmcPush(q, element);
+		pthread_mutex_unlock(&q->lock);
+	}
+	else
+	{
+		result = MpmcPush(q, element);
+	}
+
+	return result;
+}
+
+static bool MpmcPopAny(mpmcQueue_t *q, uint8_t *element)
+{
+	bool result;
+
+	if (q->useMutex)
+	{
+		pthread_mutex_lock(&q->lock);
+		result = MpmcPop(q, element);
+		pthread_mutex_unlock(&q->lock);
+	}
+	else
+	{
+		result = MpmcPop(q, element);
+	}
+
+	return result;
+}
+
+typedef struct
+{
+	mpmcQueue_t *queue;
+	uint64_t count;						// elements this thread moves
+} mpmcJob_t;
+
+static void *MpmcProducer(void *arg)
+{
+	mpmcJob_t *job = arg;
+	uint8_t element[MAX_ELEM_SIZE] = { 0 };
+	uint64_t i;
+
+	for (i = 0; i < job->count; i++)
+	{
+		element[0] = (uint8_t)i;
+		while (!MpmcPushAny(job->queue, element))
+		{
+			sched_yield();
+		}
+	}
+
+	return NULL;
+}
+
+static void *MpmcConsumer(void *arg)
+{
+	mpmcJob_t *job = arg;
+	uint8_t element[MAX_ELEM_SIZE];
+	uint64_t i;
+
+	for (i = 0; i < job->count; i++)
+	{
+		while (!MpmcPopAny(job->queue, element))
+		{
+			sched_yield();
+		}
+		sink = element[0];
+	}
+
+	return NULL;
+}
+
+static void BenchMpmc(uint64_t bytes, size_t elemSize, int producers,
+	int consumers, bool useMutex)
+{
+	mpmcQueue_t queue;
+	mpmcJob_t producerJob[MAX_THREADS];
+	mpmcJob_t consumerJob[MAX_THREADS];
+	pthread_t producerThread[MAX_THREADS];
+	pthread_t consumerThread[MAX_THREADS];
+	uint64_t total;
+	size_t i;
+	int t;
+	double start;
+
+	atomic_init(&queue.enqueuePos, 0);
+	atomic_init(&queue.dequeuePos, 0);
+	queue.elemSize = elemSize;
+	queue.cells = malloc(QUEUE_SLOTS * sizeof(mpmcCell_t));
+	for (i = 0; i < QUEUE_SLOTS; i++)
+	{
+		atomic_init(&queue.cells[i].sequence, i);
+	}
+	pthread_mutex_init(&queue.lock, NULL);
+	queue.useMutex = useMutex;
+
+	// Split the work evenly, so every element pushed is popped.
+	total = (bytes / elemSize / (uint64_t)(producers * consumers)) *
+		(uint64_t)(producers * consumers);
+
+	start = Now();
+	for (t = 0; t < producers; t++)
+	{
+		producerJob[t].queue = &queue;
+		producerJob[t].count = total / (uint64_t)producers;
+		pthread_create(&producerThread[t], NULL, MpmcProducer, &producerJob[t]);
+	}
+	for (t = 0; t < consumers; t++)
+	{
+		consumerJob[t].queue = &queue;
+		consumerJob[t].count = total / (uint64_t)consumers;
+		pthread_create(&consumerThread[t], NULL, MpmcConsumer, &consumerJob[t]);
+	}
+	for (t = 0; t < producers; t++)
+	{
+		pthread_join(producerThread[t], NULL);
+	}
+	for (t = 0; t < consumers; t++)
+	{
+		pthread_join(consumerThread[t], NULL);
+	}
+
+	Report(useMutex ? "mpmc_mutex" : "mpmc", elemSize, elemSize, producers,
+		consumers, total * elemSize, total * 2, Now() - start);
+
+	pthread_mutex_destroy(&queue.lock);
+	free(queue.cells);
+}
+
+/******************************************************************************
+ *	Main
+ *****************************************************************************/
+
+int main(int argc, char *argv[])
+{
+	uint64_t bytes;
+	size_t e;
+	size_t b;
+	size_t p;
+
+	bytes = (uint64_t)((argc > 1) ? atoi(argv[1]) : DEFAULT_MEGABYTES) << 20;
+
+	printf("buffer,elem_size,block_size,producers,consumers,bytes,seconds,"
+		"mbytes_per_s,ns_per_op\n");
+
+	for (b = 0; b < COUNT_OF(blockSizes); b++)
+	{
+		BenchCircBuffByte(bytes, blockSizes[b]);
+		BenchCircBuffBlock(bytes, blockSizes[b]);
+	}
+
+	for (e = 0; e < COUNT_OF(elemSizes); e++)
+	{
+		BenchPingPong(bytes, elemSizes[e]);
+		BenchSpsc(bytes, elemSizes[e]);
+
+		for (p = 0; p < COUNT_OF(threadPairs); p++)
+		{
+			BenchMpmc(bytes, elemSizes[e], threadPairs[p][0], threadPairs[p][1], false);
+			BenchMpmc(bytes, elemSizes[e], threadPairs[p][0], threadPairs[p][1], true);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,203 @@
+/******************************************************************************
+ *
+ *	Filename:		BenchCrc.c
+ *
+ *	Author:			Adam Johnson
+ *
+ *	Description:	Measures what it costs to check one FlashManager record,
+ *					on a PC:  the 8-bit sum FlashManager used to use, CRC-16
+ *					and CRC-32 calculated with Crc.c, and a bit-at-a-time CRC
+ *					for reference.  For each size of data, it prints one CSV
+ *					line with the time per record [ns].  Records are checked
+ *					the way FlashManager does it:  the size and ID, then the
+ *					data.
+ *
+ *					It first checks each CRC against the standard check value
+ *					(the CRC of "123456789"), and against the bit-at-a-time
+ *					CRC for every length, split into pieces.
+ *
+ *					Build it once for each way of calculating CRCs (from this
+ *					folder):
+ *					gcc -O2 -DCRC_METHOD=CRC_METHOD_SLICE8 -I../Utilities
+ *						BenchCrc.c ../Utilities/Crc.c -o BenchCrc
+ *					./BenchCrc > crc_slice8.csv
+ *					gcc -O2 -DCRC_METHOD=CRC_METHOD_NIBBLE -I../Utilities
+ *						BenchCrc.c ../Utilities/Crc.c -o BenchCrc
+ *					./BenchCrc > crc_nibble.csv
+ *
+ *	Terms of Use:	MIT License
+ *
+ *****************************************************************************/
+
+#include <stdint.h>						// universal data types
+#include <stdbool.h>					// defines "bool"
+#include <stdio.h>						// printf
+#include <stdlib.h>						// rand
+#include <time.h>						// clock_gettime
+#include "Crc.h"						// module under test
+
+#define RECORDS				4096		// records checked for each size
+#define REPEATS				50			// times each record is checked
+#define MAX_DATA			254			// largest record data [bytes]
+
+static uint8_t mRecords[RECORDS][3 + MAX_DATA];	// size, ID and data
+static volatile uint32_t mSink;			// keeps results from being optimized away
+
+static uint64_t NowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t)ts.tv_sec * 1000000000u) + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief	FlashManager's old checksum:  2's complement of the sum.
+ */
+static uint32_t Sum8(const uint8_t *data, uint16_t count)
+{
+	uint8_t checksum = 0;
+	uint16_t i;
+
+	for (i = 0; i < count; i++)
+	{
+		checksum += data[i];
+	}
+
+	return (uint8_t)(0x100 - checksum);
+}
+
+/**
+ * @brief	CRC-16 (CCITT-FALSE), a bit at a time.
+ */
+static uint32_t BitwiseCrc16(const uint8_t *data, uint16_t count)
+{
+	uint16_t crc = CRC16_START;
+	uint16_t i;
+	uint16_t k;
+
+	for (i = 0; i < count; i++)
+	{
+		crc ^= (uint16_t)(data[i] << 8);
+		for (k = 0; k < 8; k++)
+		{
+			crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+		}
+	}
+
+	return crc;
+}
+
+/**
+ * @brief	CRC-32, a bit at a time.
+ */
+static uint32_t BitwiseCrc32(const uint8_t *data, uint16_t count)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	uint16_t i;
+	uint16_t k;
+
+	for (i = 0; i < count; i++)
+	{
+		crc ^= data[i];
+		for (k = 0; k < 8; k++)
+		{
+			crc = (crc & 1) ? ((crc >> 1) ^ 0xEDB88320) : (crc >> 1);
+		}
+	}
+
+	return ~crc;
+}
+
+/**
+ * @brief	CRC-16 of a record, in two pieces like FlashManager does it.
+ */
+static uint32_t RecordCrc16(const uint8_t *data, uint16_t count)
+{
+	return Crc16Update(Crc16Update(CRC16_START, data, 3), data + 3, count - 3);
+}
+
+/**
+ * @brief	CRC-32 of a record, in two pieces like FlashManager does it.
+ */
+static uint32_t RecordCrc32(const uint8_t *data, uint16_t count)
+{
+	return Crc32Update(Crc32Update(CRC32_START, data, 3), data + 3, count - 3);
+}
+
+/**
+ * @brief	Time a check over every record [ns per record].
+ */
+static double TimeCheck(uint32_t (*check)(const uint8_t *, uint16_t), uint16_t count)
+{
+	uint32_t result = 0;
+	uint64_t start;
+	uint32_t i;
+	uint32_t r;
+
+	start = NowNs();
+	for (r = 0; r < REPEATS; r++)
+	{
+		for (i = 0; i < RECORDS; i++)
+		{
+			result ^= check(mRecords[i], count);
+		}
+	}
+	mSink = result;
+
+	return (double)(NowNs() - start) / ((double)RECORDS * REPEATS);
+}
+
+int main(void)
+{
+	static const uint16_t sizes[] = { 1, 4, 8, 22, 64, 128, 254 };
+	static const uint8_t checkString[] = "123456789";
+	uint16_t length;
+	uint16_t split;
+	uint16_t i;
+	uint32_t j;
+
+	for (j = 0; j < RECORDS; j++)
+	{
+		for (i = 0; i < sizeof(mRecords[0]); i++)
+		{
+			mRecords[j][i] = rand();
+		}
+	}
+
+	// Check the CRCs.
+	if ((Crc16Update(CRC16_START, checkString, 9) != 0x29B1) ||
+		(Crc32Update(CRC32_START, checkString, 9) != 0xCBF43926))
+	{
+		printf("wrong check value\n");
+		return 1;
+	}
+	for (length = 0; length <= sizeof(mRecords[0]); length++)
+	{
+		for (split = 0; split <= length; split++)
+		{
+			if ((Crc16Update(Crc16Update(CRC16_START, mRecords[0], split),
+					mRecords[0] + split, length - split) != BitwiseCrc16(mRecords[0], length)) ||
+				(Crc32Update(Crc32Update(CRC32_START, mRecords[0], split),
+					mRecords[0] + split, length - split) != BitwiseCrc32(mRecords[0], length)))
+			{
+				printf("wrong CRC for %u bytes split after %u\n", length, split);
+				return 1;
+			}
+		}
+	}
+
+	printf("data_bytes,sum8_ns,crc16_ns,crc32_ns,bitwise_crc16_ns,bitwise_crc32_ns\n");
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+	{
+		length = 3 + sizes[i];
+		printf("%u,%.1f,%.1f,%.1f,%.1f,%.1f\n", sizes[i],
+			TimeCheck(Sum8, length), TimeCheck(RecordCrc16, length),
+			TimeCheck(RecordCrc32, length), TimeCheck(BitwiseCrc16, length),
+			TimeCheck(BitwiseCrc32, length));
+	}
+
+	return 0;
+}
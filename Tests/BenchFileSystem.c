@@ -0,0 +1,182 @@
+/******************************************************************************
+ *
+ *	Filename:		BenchFileSystem.c
+ *
+ *	Author:			Adam Johnson
+ *
+ *	Description:	Measures how fast FileRead is with small reads, on a PC,
+ *					with files kept in (simulated) FRAM.  It writes a file,
+ *					then reads it in different ways, and for each prints one
+ *					CSV line with the mean time per read on this PC, how long
+ *					the SPI bus would be busy per read (see FRAM_SPI_HZ in
+ *					MB85RS64_Linux.c), the SPI transactions per read, the
+ *					resulting throughput, and the read cache's hits, misses
+ *					and lines read ahead.  The ways of reading are:
+ *					sequential - the whole file, front to back
+ *					random - pieces from anywhere in the file
+ *					repeat - the same few pieces over and over (like a
+ *						header that's looked at for every record)
+ *
+ *					It models a 32 KB FRAM (like an MB85RS256), so the file
+ *					is big enough to measure.  Build it with the cache (from
+ *					this folder):
+ *					gcc -O2 -DFS_DEVICE=2 -DFS_NUM_BLOCKS=64
+ *						-DFS_FRAM_SIZE=32768 -I../Utilities
+ *						-I../External_Peripherals/FRAM BenchFileSystem.c
+ *						../Utilities/FileSystem.c ../Utilities/Crc.c
+ *						../External_Peripherals/FRAM/MB85RS64_Linux.c
+ *						-o BenchFileSystem
+ *					./BenchFileSystem > fs_cache.csv
+ *
+ *					and again with -DFS_CACHE_LINES=0 to compare without it.
+ *					Try -DFS_CACHE_READ_AHEAD=0 to see what read-ahead adds.
+ *
+ *	Terms of Use:	MIT License
+ *
+ *****************************************************************************/
+
+#include <stdint.h>						// universal data types
+#include <stdbool.h>					// defines "bool"
+#include <stddef.h>						// defines "size_t"
+#include <stdio.h>						// printf
+#include <stdlib.h>						// rand
+#include <unistd.h>						// unlink
+#include <time.h>						// clock_gettime
+#include "MB85RS64.h"					// simulated FRAM
+#include "FileSystem.h"					// module under test
+
+#define FRAM_PATH			"BenchFileSystem.fram"	// holds the FRAM's contents
+#define FRAM_SIZE			(32 * 1024)	// size of the FRAM (FS_FRAM_SIZE)
+#define FILE_SIZE			(24 * 1024)	// size of the file read [bytes]
+#define WRITE_SIZE			256			// bytes written at a time
+#define RANDOM_READS		20000		// reads measured for random and repeat
+#define REPEAT_SPAN			64			// bytes read over and over in repeat
+#define MAX_READ			64			// biggest read [bytes]
+
+// the cache setting FileSystem.c was built with (its default for FRAM)
+#ifndef FS_CACHE_LINES
+#define FS_CACHE_LINES		4
+#endif
+
+typedef enum							// ways of reading the file
+{
+	PATTERN_SEQUENTIAL,
+	PATTERN_RANDOM,
+	PATTERN_REPEAT,
+	NUM_PATTERNS
+} pattern_t;
+
+static const char *mPatternNames[NUM_PATTERNS] = { "sequential", "random", "repeat" };
+
+static volatile uint32_t mSink;			// keeps results from being optimized away
+
+static uint64_t NowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t)ts.tv_sec * 1000000000u) + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief	Time one way of reading the file, and print a CSV line.
+ * @param	pattern - how to read it
+ * @param	readSize - bytes in each read
+ */
+static void TimeReads(pattern_t pattern, uint32_t readSize)
+{
+	uint8_t data[MAX_READ];
+	file_t handle;
+	fileCacheStats_t cache;
+	framStats_t bus;
+	uint32_t reads;
+	uint32_t index;
+	uint32_t result = 0;
+	uint64_t start;
+	uint64_t elapsed;
+	uint32_t i;
+
+	reads = (pattern == PATTERN_SEQUENTIAL) ? (FILE_SIZE / readSize) : RANDOM_READS;
+
+	FileInit();							// start with an empty cache
+	FileOpen("bench", FILE_MODE_READ, 0, &handle);
+	FileResetCacheStats();
+	FramImageResetStats();
+
+	start = NowNs();
+	for (i = 0; i < reads; i++)
+	{
+		if (pattern == PATTERN_SEQUENTIAL)
+		{
+			index = i * readSize;
+		}
+		else if (pattern == PATTERN_RANDOM)
+		{
+			index = rand() % (FILE_SIZE - readSize);
+		}
+		else
+		{
+			index = (i * readSize) % REPEAT_SPAN;
+		}
+
+		FileRead(handle, index, data, readSize);
+		result += data[0];
+	}
+	elapsed = NowNs() - start;
+	mSink = result;
+
+	FileGetCacheStats(&cache);
+	FramImageGetStats(&bus);
+
+	printf("%u,%s,%u,%u,%.1f,%.1f,%.2f,%.1f,%u,%u,%u\n", FS_CACHE_LINES, mPatternNames[pattern], readSize,
+		reads, (double)elapsed / reads, (double)bus.busyNs / reads,
+		(double)bus.transactions / reads,
+		((double)reads * readSize) / ((double)bus.busyNs / 1e9) / 1024.0,
+		cache.hits, cache.misses, cache.readAheads);
+
+	FileClose(handle);
+}
+
+int main(void)
+{
+	static const uint32_t readSizes[] = { 1, 4, 16, 64 };
+	uint8_t data[WRITE_SIZE];
+	file_t handle;
+	uint32_t i;
+	uint32_t j;
+
+	unlink(FRAM_PATH);
+	if (!FramImageOpen(FRAM_PATH, FRAM_SIZE) || (FileInit() != FILE_RESULT_OK) ||
+		(FileOpen("bench", FILE_MODE_CREATE, FILE_SIZE, &handle) != FILE_RESULT_OK))
+	{
+		printf("FileInit failed\n");
+		return 1;
+	}
+
+	for (i = 0; i < FILE_SIZE; i += WRITE_SIZE)
+	{
+		for (j = 0; j < WRITE_SIZE; j++)
+		{
+			data[j] = (uint8_t)(i + j);
+		}
+		FileWrite(handle, i, data, WRITE_SIZE);
+	}
+	FileClose(handle);
+
+	printf("cache_lines,pattern,read_size,reads,ns_per_read,bus_ns_per_read,"
+		"transactions_per_read,bus_kbytes_per_s,hits,misses,read_aheads\n");
+
+	for (i = 0; i < (sizeof(readSizes) / sizeof(readSizes[0])); i++)
+	{
+		for (j = 0; j < NUM_PATTERNS; j++)
+		{
+			TimeReads((pattern_t)j, readSizes[i]);
+		}
+	}
+
+	FramImageClose();
+	unlink(FRAM_PATH);
+
+	return 0;
+}
@@ -0,0 +1,210 @@
+/******************************************************************************
+ *
+ *	Filename:		BenchFlashManager.c
+ *
+ *	Author:			Adam Johnson
+ *
+ *	Description:	Measures how long FlashManSetVariable takes as the number
+ *					of stored variables grows, on a PC.  For each number of
+ *					variables, it updates random variables and prints one CSV
+ *					line with the mean and worst-case set latency (the worst
+ *					case includes garbage collection), plus how long
+ *					FlashManInit takes to rebuild everything for comparison.
+ *					It runs on simulated flash, which also reports what the
+ *					sets cost the flash:  segments erased, write
+ *					amplification (bytes programmed per byte of data), how
+ *					long the real flash would be busy per set (on average,
+ *					and for the worst set), how much of that was spent
+ *					programming rather than erasing, and the most erases of
+ *					any one segment.  FlashManCollectTask is called between
+ *					sets, the way a background task would, and isn't counted
+ *					in the set latencies.  Last, it prints the mean time to
+ *					get a variable, copied out with FlashManGetVariable or
+ *					pointed to with FlashManGetVariableRef.
+ *
+ *					The sectors need to be much bigger than the MSP430's
+ *					info segments to hold a useful number of variables, so
+ *					build with bigger settings (from this folder).  Try other
+ *					values of NUM_SECTORS to see how they change the worst
+ *					case:
+ *					gcc -O2 -DSECTOR_SIZE=4096 -DFLASH_SEGMENT_SIZE=4096
+ *						-DNUM_SECTORS=4 -DLOOKUP_TABLE_SIZE=4096 -I../Utilities
+ *						-I../Processor_Peripherals/Linux BenchFlashManager.c
+ *						../Utilities/FlashManager.c ../Utilities/Crc.c
+ *						../Processor_Peripherals/Linux/Flash.c
+ *						-o BenchFlashManager
+ *					./BenchFlashManager > flashman.csv
+ *
+ *					To see how an index checkpoint shortens init_ns, add
+ *					-DCHECKPOINT_ENTRIES=200 -DMAX_VARIABLE_SIZE=250
+ *					-DTRANSACTION_SIZE=512 (bigger records hold more
+ *					checkpoint entries each).  To see how collecting garbage
+ *					a step at a time bounds the worst case, add
+ *					-DFLASH_GC_INCREMENTAL=1.  To see how records laid out
+ *					for word writes change write_us_per_set, add
+ *					-DMIN_WRITE_SIZE=4.
+ *
+ *	Terms of Use:	MIT License
+ *
+ *****************************************************************************/
+
+#include <stdint.h>						// universal data types
+#include <stdbool.h>					// defines "bool"
+#include <stdio.h>						// printf
+#include <stdlib.h>						// rand
+#include <time.h>						// clock_gettime
+#include "Flash.h"						// simulated flash
+#include "FlashManager.h"				// module under test
+
+#define SETS_PER_POINT		2000		// updates measured for each point
+#define VALUE_SIZE			4			// size of each variable [bytes]
+#define FLASH_SIZE			(256 * 1024)	// enough for any sensible settings
+#define GETS_PER_POINT		100000		// gets measured for each point
+
+static volatile uint32_t mSink;			// keeps results from being optimized away
+
+static uint64_t NowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t)ts.tv_sec * 1000000000u) + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief	Time getting random variables [ns per get].
+ * @param	numVariables - variables stored (IDs 0 to numVariables - 1)
+ * @param	byRef - use FlashManGetVariableRef instead of copying the value
+ */
+static double TimeGets(uint32_t numVariables, bool byRef)
+{
+	uint8_t value[VALUE_SIZE];
+	const uint8_t *data;
+	uint16_t size;
+	uint32_t result = 0;
+	uint64_t start;
+	uint32_t i;
+
+	start = NowNs();
+	for (i = 0; i < GETS_PER_POINT; i++)
+	{
+		if (byRef)
+		{
+			FlashManGetVariableRef((uint16_t)(rand() % numVariables), &data, &size);
+			result += data[0];
+		}
+		else
+		{
+			FlashManGetVariable((uint16_t)(rand() % numVariables), value, VALUE_SIZE);
+			result += value[0];
+		}
+	}
+	mSink = result;
+
+	return (double)(NowNs() - start) / GETS_PER_POINT;
+}
+
+int main(void)
+{
+	uint32_t maxVariables;				// most variables flash can hold
+	uint32_t numVariables = 0;			// variables stored so far
+	uint32_t target;					// variables stored for this point
+	uint32_t counter = 0;				// makes every value different
+	uint64_t start;
+	uint64_t elapsed;
+	uint64_t total;
+	uint64_t worst;
+	uint64_t busyNs;					// flash busy time before the set
+	uint64_t worstBusyNs;				// longest flash busy time for a set
+	uint32_t maxErases;					// most erases of any segment
+	flashStats_t stats;					// what the flash did
+	uint32_t i;
+
+	if (!FlashMemImageOpen(NULL, FLASH_SIZE) || !FlashManInit())
+	{
+		printf("FlashManInit failed\n");
+		return 1;
+	}
+
+	maxVariables = FlashManGetMaxVariables();
+
+	printf("variables,sets,mean_set_ns,max_set_ns,init_ns,"
+		"erases,write_amp,flash_us_per_set,max_set_flash_us,write_us_per_set,"
+		"max_segment_erases,get_ns,get_ref_ns\n");
+
+	// Leave free space in the sector, or every set would be a swap.
+	for (target = 1; target <= (maxVariables * 3) / 4; target *= 2)
+	{
+		// Store more variables until we reach this point.
+		while (numVariables < target)
+		{
+			counter++;
+			FlashManSetVariable((uint16_t)numVariables, (uint8_t *)&counter, VALUE_SIZE);
+			numVariables++;
+		}
+
+		// Update random variables that already exist.
+		total = 0;
+		worst = 0;
+		worstBusyNs = 0;
+		FlashMemResetStats();
+		for (i = 0; i < SETS_PER_POINT; i++)
+		{
+			counter++;
+			FlashMemGetStats(&stats);
+			busyNs = stats.busyNs;
+			start = NowNs();
+			if (!FlashManSetVariable((uint16_t)(rand() % numVariables),
+					(uint8_t *)&counter, VALUE_SIZE))
+			{
+				printf("FlashManSetVariable failed\n");
+				return 1;
+			}
+			elapsed = NowNs() - start;
+
+			total += elapsed;
+			if (elapsed > worst)
+			{
+				worst = elapsed;
+			}
+
+			FlashMemGetStats(&stats);
+			if ((stats.busyNs - busyNs) > worstBusyNs)
+			{
+				worstBusyNs = stats.busyNs - busyNs;
+			}
+
+			FlashManCollectTask();
+		}
+
+		FlashMemGetStats(&stats);
+
+		maxErases = 0;
+		for (i = 0; i < FLASH_SIZE / FLASH_SEGMENT_SIZE; i++)
+		{
+			if (FlashMemGetEraseCount(i) > maxErases)
+			{
+				maxErases = FlashMemGetEraseCount(i);
+			}
+		}
+
+		// Measure a full rebuild, for comparison.
+		start = NowNs();
+		FlashManInit();
+		elapsed = NowNs() - start;
+
+		printf("%u,%u,%llu,%llu,%llu,%u,%.2f,%.1f,%.1f,%.1f,%u,%.1f,%.1f\n", numVariables, SETS_PER_POINT,
+			(unsigned long long)(total / SETS_PER_POINT),
+			(unsigned long long)worst, (unsigned long long)elapsed,
+			stats.erases, (double)stats.bytesWritten / (SETS_PER_POINT * VALUE_SIZE),
+			(double)stats.busyNs / (SETS_PER_POINT * 1000.0),
+			(double)worstBusyNs / 1000.0,
+			(double)(stats.busyNs - ((uint64_t)stats.erases * FLASH_ERASE_NS)) / (SETS_PER_POINT * 1000.0),
+			maxErases, TimeGets(numVariables, false), TimeGets(numVariables, true));
+	}
+
+	FlashMemImageClose();
+
+	return 0;
+}
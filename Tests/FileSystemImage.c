@@ -0,0 +1,491 @@
+/******************************************************************************
+ *
+ *	Filename:		FileSystemImage.c
+ *
+ *	Author:			Adam Johnson
+ *
+ *	Description:	Makes, looks inside and measures FileSystem images on a
+ *					PC.  An image is a file holding the file system's flash,
+ *					as the chip would hold it (see FileImageOpen).
+ *
+ *					FileSystemImage IMAGE format
+ *						make an empty file system (making IMAGE if needed)
+ *					FileSystemImage IMAGE add NAME FILE [MAX_SIZE]
+ *						copy FILE into the image, as NAME (which can hold
+ *						MAX_SIZE bytes; FILE's size if it isn't given)
+ *					FileSystemImage IMAGE list
+ *						list the files, and the free space
+ *					FileSystemImage IMAGE extract NAME [FILE]
+ *						copy NAME out of the image (to stdout if no FILE)
+ *					FileSystemImage IMAGE verify
+ *						check the file system, read every file, and print
+ *						each one's CRC-16
+ *					FileSystemImage IMAGE bench [RECORD_SIZE]
+ *						on a copy of the image, time appending records to a
+ *						new file until it's full, reading them back,
+ *						changing a few, FileInit, and deleting the file.
+ *						Prints a CSV line for each, with the time on this PC
+ *						and how long real flash would be busy (see the
+ *						timing settings in Flash.h).
+ *
+ *					The image only makes sense to code built with the same
+ *					settings, so build this with the firmware's (from this
+ *					folder):
+ *					gcc -O2 -I../Utilities -I../Processor_Peripherals/Linux
+ *						FileSystemImage.c ../Utilities/FileSystem.c
+ *						../Utilities/Crc.c ../Processor_Peripherals/Linux/Flash.c
+ *						-o FileSystemImage
+ *
+ *					Other flash can be modeled with its timing, e.g.
+ *					-DFLASH_SEGMENT_SIZE=4096 -DFLASH_ERASE_NS=45000000.
+ *
+ *	Terms of Use:	MIT License
+ *
+ *****************************************************************************/
+
+#include <stdint.h>						// universal data types
+#include <stdbool.h>					// defines "bool"
+#include <stdio.h>						// printf, fopen
+#include <stdlib.h>						// malloc, strtoul
+#include <string.h>						// strcmp
+#include <unistd.h>						// access, unlink
+#include <time.h>						// clock_gettime
+#include "Crc.h"						// CRC-16
+#include "Flash.h"						// simulated flash
+#include "FileSystem.h"					// file system in the image
+
+#define COPY_SIZE			256			// bytes copied in or out at a time
+#define NAME_SIZE			32			// room for any file name
+#define BENCH_NAME			"~bench"	// file made by the benchmark
+#define BENCH_REWRITES		4			// records changed by the benchmark
+#define BENCH_INITS			100			// times FileInit is timed
+#define MAX_RECORD			256			// biggest record for the benchmark
+
+// the block size FileSystem.c was built with (its default)
+#ifndef FS_BLOCK_SIZE
+#define FS_BLOCK_SIZE		512
+#endif
+
+static volatile uint32_t mSink;			// keeps results from being optimized away
+
+static uint64_t NowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t)ts.tv_sec * 1000000000u) + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief	Open an image, and find its files.
+ * @param	path - name of the image
+ * @param	format - true to make an empty file system if there isn't one
+ * @returns	true for success; false otherwise (after saying why)
+ */
+static bool OpenImage(const char *path, bool format)
+{
+	fileErr_t result;
+	bool status = false;
+
+	if (!format && (access(path, F_OK) != 0))
+	{
+		fprintf(stderr, "%s:  no such image\n", path);
+	}
+	else
+	{
+		result = FileImageOpen(path);
+		if ((result == FILE_RESULT_INVALID_SELECTION) && format)
+		{
+			result = FileFormat();
+		}
+
+		if (result == FILE_RESULT_INVALID_SELECTION)
+		{
+			fprintf(stderr, "%s:  no file system (try format)\n", path);
+		}
+		else if (result != FILE_RESULT_OK)
+		{
+			fprintf(stderr, "%s:  can't open it\n", path);
+		}
+		else
+		{
+			status = true;
+		}
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Copy a file from the PC into the image.
+ */
+static bool AddFile(char *name, const char *hostPath, uint32_t maxSize)
+{
+	uint8_t *data = NULL;
+	FILE *hostFile;
+	file_t handle;
+	long size = -1;
+	bool status = false;
+
+	hostFile = fopen(hostPath, "rb");
+	if ((hostFile != NULL) && (fseek(hostFile, 0, SEEK_END) == 0))
+	{
+		size = ftell(hostFile);
+		rewind(hostFile);
+	}
+
+	if (size >= 0)
+	{
+		data = malloc(size + 1);
+
+		// An empty file still needs room for something.
+		if (maxSize == 0)
+		{
+			maxSize = (size > 0) ? (uint32_t)size : 1;
+		}
+	}
+
+	if ((data == NULL) || (fread(data, 1, size, hostFile) != (size_t)size))
+	{
+		fprintf(stderr, "%s:  can't read it\n", hostPath);
+	}
+	else if (FileOpen(name, FILE_MODE_CREATE, maxSize, &handle) != FILE_RESULT_OK)
+	{
+		fprintf(stderr, "%s:  can't make it (bad name, or no room?)\n", name);
+	}
+	else
+	{
+		status = (FileWrite(handle, 0, data, size) == FILE_RESULT_OK);
+		status = (FileClose(handle) == FILE_RESULT_OK) && status;
+		if (!status)
+		{
+			fprintf(stderr, "%s:  can't write it (too big?)\n", name);
+		}
+	}
+
+	if (hostFile != NULL)
+	{
+		fclose(hostFile);
+	}
+	free(data);
+
+	return status;
+}
+
+/**
+ * @brief	List the files in the image.
+ */
+static bool ListFiles(void)
+{
+	char name[NAME_SIZE];
+	fileInfo_t info;
+	fileCheck_t check;
+	uint8_t i;
+
+	printf("%-16s %10s %10s\n", "name", "size", "max_size");
+	for (i = 0; FileList(i, name, sizeof(name), &info) == FILE_RESULT_OK; i++)
+	{
+		if (info.status != 0)
+		{
+			printf("%-16s %10u %10u\n", name, info.size, info.maxSize);
+		}
+	}
+
+	FileCheck(&check);
+	printf("%u files, %u free blocks of %u bytes\n", check.files, check.freeBlocks, FS_BLOCK_SIZE);
+
+	return true;
+}
+
+/**
+ * @brief	Copy a file out of the image, to a file on the PC or stdout.
+ */
+static bool ExtractFile(char *name, const char *hostPath)
+{
+	uint8_t data[COPY_SIZE];
+	fileInfo_t info;
+	file_t handle;
+	FILE *hostFile = stdout;
+	uint32_t index;
+	uint32_t bytes;
+	bool status;
+
+	status = (FileSearch(name, &info) == FILE_RESULT_OK) && (info.status != 0) &&
+		(FileOpen(name, FILE_MODE_READ, 0, &handle) == FILE_RESULT_OK);
+	if (!status)
+	{
+		fprintf(stderr, "%s:  no such file in the image\n", name);
+	}
+	else
+	{
+		if (hostPath != NULL)
+		{
+			hostFile = fopen(hostPath, "wb");
+		}
+
+		status = (hostFile != NULL);
+		for (index = 0; status && (index < info.size); index += bytes)
+		{
+			bytes = ((info.size - index) < COPY_SIZE) ? (info.size - index) : COPY_SIZE;
+			status = (FileRead(handle, index, data, bytes) == FILE_RESULT_OK) &&
+				(fwrite(data, 1, bytes, hostFile) == bytes);
+		}
+
+		if (!status)
+		{
+			fprintf(stderr, "%s:  can't copy it out\n", name);
+		}
+
+		if ((hostFile != NULL) && (hostFile != stdout))
+		{
+			fclose(hostFile);
+		}
+		FileClose(handle);
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Check the file system, and read every file.
+ */
+static bool VerifyImage(void)
+{
+	uint8_t data[COPY_SIZE];
+	char name[NAME_SIZE];
+	fileInfo_t info;
+	fileCheck_t check;
+	file_t handle;
+	uint32_t index;
+	uint32_t bytes;
+	uint16_t crc;
+	bool readable;
+	bool status;
+	uint8_t i;
+
+	status = (FileCheck(&check) == FILE_RESULT_OK);
+
+	printf("%-16s %10s %6s\n", "name", "size", "crc16");
+	for (i = 0; FileList(i, name, sizeof(name), &info) == FILE_RESULT_OK; i++)
+	{
+		if (info.status == 0)
+		{
+			continue;
+		}
+
+		crc = CRC16_START;
+		readable = (FileOpen(name, FILE_MODE_READ, 0, &handle) == FILE_RESULT_OK);
+		for (index = 0; readable && (index < info.size); index += bytes)
+		{
+			bytes = ((info.size - index) < COPY_SIZE) ? (info.size - index) : COPY_SIZE;
+			readable = (FileRead(handle, index, data, bytes) == FILE_RESULT_OK);
+			crc = Crc16Update(crc, data, (uint16_t)bytes);
+		}
+		FileClose(handle);
+
+		if (readable)
+		{
+			printf("%-16s %10u %#6x\n", name, info.size, crc);
+		}
+		else
+		{
+			printf("%-16s %10u unreadable\n", name, info.size);
+			status = false;
+		}
+	}
+
+	printf("%u files (%u bad), %u free blocks, %u directory records cut short, "
+		"most erases of a block %u\n", check.files, check.badFiles, check.freeBlocks,
+		check.badRecords, check.maxEraseCount);
+	printf("%s\n", status ? "image OK" : "image is damaged");
+
+	return status;
+}
+
+/**
+ * @brief	Print a CSV line for part of the benchmark.
+ */
+static void PrintResult(const char *operation, uint32_t count, uint32_t recordSize, uint64_t elapsed)
+{
+	flashStats_t stats;
+
+	FlashMemGetStats(&stats);
+
+	printf("%s,%u,%u,%.1f,%.1f,%llu,%u\n", operation, count, recordSize,
+		(double)elapsed / count, (double)stats.busyNs / 1000.0 / count,
+		(unsigned long long)stats.bytesWritten, stats.erases);
+
+	FlashMemResetStats();
+}
+
+/**
+ * @brief	Measure the file system on a copy of the image.
+ * @remarks	The new file takes half the free blocks, so there's room to copy
+ *			it when records are changed.
+ */
+static bool BenchImage(const char *path, uint32_t recordSize)
+{
+	static uint8_t data[MAX_RECORD];
+	char benchPath[FILENAME_MAX];
+	fileCheck_t check;
+	file_t handle;
+	FILE *from;
+	FILE *to;
+	uint32_t maxSize;
+	uint32_t records;
+	uint32_t result = 0;
+	uint64_t start;
+	uint32_t i;
+	int c;
+	bool status;
+
+	// Copy the image, so it isn't changed.
+	snprintf(benchPath, sizeof(benchPath), "%s.bench", path);
+	from = fopen(path, "rb");
+	to = fopen(benchPath, "wb");
+	status = (from != NULL) && (to != NULL);
+	while (status && ((c = fgetc(from)) != EOF))
+	{
+		fputc(c, to);
+	}
+	if (from != NULL)
+	{
+		fclose(from);
+	}
+	if (to != NULL)
+	{
+		fclose(to);
+	}
+
+	status = status && OpenImage(benchPath, false);
+	if (status)
+	{
+		FileCheck(&check);
+
+		// (less room for each block's header)
+		maxSize = (check.freeBlocks / 2) * (FS_BLOCK_SIZE - 16);
+		records = maxSize / recordSize;
+		status = (records > BENCH_REWRITES) &&
+			(FileOpen(BENCH_NAME, FILE_MODE_CREATE, maxSize, &handle) == FILE_RESULT_OK) &&
+			(FileClose(handle) == FILE_RESULT_OK);
+		if (!status)
+		{
+			fprintf(stderr, "%s:  not enough room to measure anything\n", path);
+		}
+	}
+
+	if (status)
+	{
+		printf("operation,count,record_size,ns_per_op,flash_us_per_op,bytes_programmed,erases\n");
+
+		FileOpen(BENCH_NAME, FILE_MODE_APPEND, 0, &handle);
+		FlashMemResetStats();
+		start = NowNs();
+		for (i = 0; status && (i < records); i++)
+		{
+			memset(data, (uint8_t)i, recordSize);
+			status = (FileWrite(handle, 0, data, recordSize) == FILE_RESULT_OK);
+		}
+		status = (FileClose(handle) == FILE_RESULT_OK) && status;
+		PrintResult("append", records, recordSize, NowNs() - start);
+
+		FileOpen(BENCH_NAME, FILE_MODE_READ, 0, &handle);
+		start = NowNs();
+		for (i = 0; status && (i < records); i++)
+		{
+			status = (FileRead(handle, i * recordSize, data, recordSize) == FILE_RESULT_OK);
+			result += data[0];
+		}
+		FileClose(handle);
+		PrintResult("read", records, recordSize, NowNs() - start);
+
+		FileOpen(BENCH_NAME, FILE_MODE_WRITE, 0, &handle);
+		start = NowNs();
+		for (i = 0; status && (i < BENCH_REWRITES); i++)
+		{
+			memset(data, 0x55, recordSize);
+			status = (FileWrite(handle, ((records / 2) + i) * recordSize, data, recordSize) == FILE_RESULT_OK);
+		}
+		FileClose(handle);
+		PrintResult("rewrite", BENCH_REWRITES, recordSize, NowNs() - start);
+
+		start = NowNs();
+		for (i = 0; status && (i < BENCH_INITS); i++)
+		{
+			status = (FileInit() == FILE_RESULT_OK);
+		}
+		PrintResult("init", BENCH_INITS, recordSize, NowNs() - start);
+
+		FileOpen(BENCH_NAME, FILE_MODE_WRITE, 0, &handle);
+		start = NowNs();
+		status = (FileDelete(handle) == FILE_RESULT_OK) && status;
+		PrintResult("delete", 1, recordSize, NowNs() - start);
+
+		mSink = result;
+		if (!status)
+		{
+			fprintf(stderr, "%s:  the file system failed partway through\n", path);
+		}
+	}
+
+	FileImageClose();
+	unlink(benchPath);
+
+	return status;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = (argc > 1) ? argv[1] : "";
+	const char *command = (argc > 2) ? argv[2] : "";
+	uint32_t recordSize;
+	bool status = false;
+
+	if (strcmp(command, "format") == 0)
+	{
+		status = OpenImage(path, true) && (FileFormat() == FILE_RESULT_OK);
+	}
+	else if ((strcmp(command, "add") == 0) && (argc >= 5))
+	{
+		status = OpenImage(path, true) &&
+			AddFile(argv[3], argv[4], (argc > 5) ? strtoul(argv[5], NULL, 0) : 0);
+	}
+	else if (strcmp(command, "list") == 0)
+	{
+		status = OpenImage(path, false) && ListFiles();
+	}
+	else if ((strcmp(command, "extract") == 0) && (argc >= 4))
+	{
+		status = OpenImage(path, false) && ExtractFile(argv[3], (argc > 4) ? argv[4] : NULL);
+	}
+	else if (strcmp(command, "verify") == 0)
+	{
+		status = OpenImage(path, false) && VerifyImage();
+	}
+	else if (strcmp(command, "bench") == 0)
+	{
+		recordSize = (argc > 3) ? strtoul(argv[3], NULL, 0) : 16;
+		if ((recordSize == 0) || (recordSize > MAX_RECORD))
+		{
+			fprintf(stderr, "record size must be 1 to %u\n", MAX_RECORD);
+		}
+		else
+		{
+			status = BenchImage(path, recordSize);
+		}
+	}
+	else
+	{
+		fprintf(stderr, "usage:  %s IMAGE format | add NAME FILE [MAX_SIZE] | list |\n"
+			"\textract NAME [FILE] | verify | bench [RECORD_SIZE]\n",
+			(argc > 0) ? argv[0] : "FileSystemImage");
+	}
+
+	if (strcmp(command, "bench") != 0)
+	{
+		FileImageClose();
+	}
+
+	return status ? 0 : 1;
+}
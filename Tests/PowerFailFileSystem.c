@@ -0,0 +1,414 @@
+/******************************************************************************
+ *
+ *	Filename:		PowerFailFileSystem.c
+ *
+ *	Author:			Adam Johnson
+ *
+ *	Description:	Checks that FileSystem survives losing power at any
+ *					moment, on a PC.  It runs a long, random series of
+ *					operations on a few files in simulated flash:  creating
+ *					(or replacing) a file, appending to it, writing over part
+ *					of it, and deleting it.  For each operation, it cuts the
+ *					power after every single step the operation takes
+ *					(programming one byte, or erasing one segment), reboots
+ *					with FileInit, and checks that the file being changed is
+ *					either just as it was or just as it should be afterwards,
+ *					and that the other files are untouched.  (Appends are
+ *					written a buffer at a time, so they can also be cut
+ *					short, as long as what's there is right.)  The workload
+ *					carries on from some of the cut states, so interrupted
+ *					operations pile up the way they would in the field.  The
+ *					rest of the time it carries on without a reboot, to check
+ *					what's kept in RAM too.
+ *
+ *					Use small blocks, so the directory block fills up often
+ *					and files span several blocks (from this folder):
+ *					gcc -O2 -DFLASH_SEGMENT_SIZE=128 -DFS_BLOCK_SIZE=256
+ *						-DFS_NUM_BLOCKS=24 -DFS_MAX_FILES=4 -I../Utilities
+ *						-I../Processor_Peripherals/Linux PowerFailFileSystem.c
+ *						../Utilities/FileSystem.c ../Utilities/Crc.c
+ *						../Processor_Peripherals/Linux/Flash.c
+ *						-o PowerFailFileSystem
+ *					./PowerFailFileSystem
+ *
+ *	Terms of Use:	MIT License
+ *
+ *****************************************************************************/
+
+#include <stdint.h>						// universal data types
+#include <stdbool.h>					// defines "bool"
+#include <stdio.h>						// printf
+#include <stdlib.h>						// rand
+#include <string.h>						// memcpy, memcmp
+#include "Flash.h"						// simulated flash
+#include "FileSystem.h"					// module under test
+
+#define NUM_FILES			4			// number of files in the workload
+#define MAX_FILE_SIZE		1000		// largest file [bytes]
+#define MAX_WRITE			100			// largest write [bytes]
+#define NUM_OPS				1000		// length of the workload
+#define FLASH_SIZE			(16 * 1024)	// enough for any sensible settings
+
+typedef enum							// kinds of operation
+{
+	OP_CREATE,
+	OP_APPEND,
+	OP_WRITE,
+	OP_DELETE,
+} opType_t;
+
+typedef struct							// one operation in the workload
+{
+	opType_t type;						// what to do
+	uint8_t file;						// which file to do it to
+	uint32_t index;						// where to write (OP_WRITE)
+	uint32_t size;						// bytes to write, or max size (OP_CREATE)
+	uint8_t data[MAX_WRITE];			// bytes to write
+} operation_t;
+
+typedef struct							// what a file should hold
+{
+	bool exists;
+	uint32_t size;
+	uint32_t maxSize;
+	uint8_t data[MAX_FILE_SIZE];
+} model_t;
+
+static model_t mFiles[NUM_FILES];		// expected files
+static uint8_t mBefore[FLASH_SIZE];		// flash before the operation
+static uint32_t mViolations = 0;		// bad writes seen by simulated flash
+
+/**
+ * @brief	Get the number of steps flash has taken since the stats were reset.
+ */
+static uint32_t CountSteps(void)
+{
+	flashStats_t stats;
+
+	FlashMemGetStats(&stats);
+	mViolations += stats.violations;
+
+	return (uint32_t)(stats.bytesWritten + stats.erases);
+}
+
+/**
+ * @brief	Get a file's name.
+ */
+static char *FileName(uint8_t file)
+{
+	static char name[4] = "f0";
+
+	name[1] = '0' + file;
+
+	return name;
+}
+
+/**
+ * @brief	Run an operation.
+ * @returns	true if the file system said it worked
+ */
+static bool RunOperation(const operation_t *op)
+{
+	file_t handle;
+	fileErr_t result;
+
+	switch (op->type)
+	{
+	case OP_CREATE:
+		result = FileOpen(FileName(op->file), FILE_MODE_CREATE, op->size, &handle);
+		break;
+	case OP_APPEND:
+		result = FileOpen(FileName(op->file), FILE_MODE_APPEND, 0, &handle);
+		if (result == FILE_RESULT_OK)
+		{
+			result = FileWrite(handle, 0, (uint8_t *)op->data, op->size);
+		}
+		break;
+	case OP_WRITE:
+		result = FileOpen(FileName(op->file), FILE_MODE_WRITE, 0, &handle);
+		if (result == FILE_RESULT_OK)
+		{
+			result = FileWrite(handle, op->index, (uint8_t *)op->data, op->size);
+		}
+		break;
+	default:
+		result = FileOpen(FileName(op->file), FILE_MODE_WRITE, 0, &handle);
+		if (result == FILE_RESULT_OK)
+		{
+			result = FileDelete(handle);
+			handle = 0xFF;
+		}
+		break;
+	}
+
+	// Closing writes any appended bytes that are waiting, so it can fail too.
+	if ((result == FILE_RESULT_OK) && (handle != 0xFF))
+	{
+		result = FileClose(handle);
+	}
+
+	return (result == FILE_RESULT_OK);
+}
+
+/**
+ * @brief	Work out what a file should hold after an operation.
+ */
+static void ApplyOperation(const operation_t *op, model_t *file)
+{
+	switch (op->type)
+	{
+	case OP_CREATE:
+		file->exists = true;
+		file->size = 0;
+		file->maxSize = op->size;
+		break;
+	case OP_APPEND:
+		memcpy(&file->data[file->size], op->data, op->size);
+		file->size += op->size;
+		break;
+	case OP_WRITE:
+		memcpy(&file->data[op->index], op->data, op->size);
+		if ((op->index + op->size) > file->size)
+		{
+			file->size = op->index + op->size;
+		}
+		break;
+	default:
+		file->exists = false;
+		break;
+	}
+}
+
+/**
+ * @brief	Check that a file holds what it should.
+ */
+static bool IsFileEqual(uint8_t file, const model_t *expected)
+{
+	static uint8_t readBack[MAX_FILE_SIZE];
+	fileInfo_t info;
+	file_t handle;
+	bool result;
+
+	FileSearch(FileName(file), &info);
+
+	result = (info.status == (expected->exists ? 1 : 0));
+	if (result && expected->exists)
+	{
+		result = (info.size == expected->size) && (info.maxSize == expected->maxSize) &&
+			(FileOpen(FileName(file), FILE_MODE_READ, 0, &handle) == FILE_RESULT_OK) &&
+			(FileRead(handle, 0, readBack, expected->size) == FILE_RESULT_OK) &&
+			(memcmp(readBack, expected->data, expected->size) == 0);
+		FileClose(handle);
+	}
+
+	return result;
+}
+
+/**
+ * @brief	Check that the file the operation changes is either as it was or
+ *			as it should be afterwards (or, for an append, has some of the
+ *			bytes appended), and the rest are untouched.
+ * @param	now - returns what the file holds (NULL if not needed)
+ * @returns	true if the operation landed; false otherwise
+ */
+static bool CheckFiles(const operation_t *op, const model_t *after, uint32_t opNumber, uint32_t cut,
+	model_t *now)
+{
+	static model_t partial;				// file with part of an append
+	bool landed = IsFileEqual(op->file, after);
+	bool kept = IsFileEqual(op->file, &mFiles[op->file]);
+	bool cutShort = false;
+	fileInfo_t info;
+	uint8_t i;
+
+	if (!landed && !kept && (op->type == OP_APPEND))
+	{
+		FileSearch(FileName(op->file), &info);
+		partial = *after;
+		partial.size = info.size;
+		cutShort = (info.size > mFiles[op->file].size) && (info.size < after->size) &&
+			IsFileEqual(op->file, &partial);
+	}
+
+	for (i = 0; i < NUM_FILES; i++)
+	{
+		if ((i != op->file) && !IsFileEqual(i, &mFiles[i]))
+		{
+			printf("operation %u, cut after step %u:  file %u is wrong\n", opNumber, cut, i);
+			exit(1);
+		}
+	}
+
+	if (!landed && !kept && !cutShort)
+	{
+		printf("operation %u, cut after step %u:  file %u is neither old nor new\n",
+			opNumber, cut, op->file);
+		exit(1);
+	}
+
+	if (mViolations != 0)
+	{
+		printf("operation %u, cut after step %u:  flash was written without erasing\n",
+			opNumber, cut);
+		exit(1);
+	}
+
+	if (now != NULL)
+	{
+		*now = landed ? *after : (kept ? mFiles[op->file] : partial);
+	}
+
+	return landed;
+}
+
+/**
+ * @brief	Restore flash to how it was before the operation, and reboot.
+ */
+static void Restore(void)
+{
+	memcpy(FlashMemGetBase(), mBefore, FLASH_SIZE);
+	FlashMemSetPowerFail(0);
+	FileInit();
+}
+
+/**
+ * @brief	Pick a random operation that makes sense for the files.
+ */
+static void PickOperation(operation_t *op)
+{
+	model_t *file;
+	uint32_t room;
+	uint32_t i;
+
+	memset(op, 0, sizeof(*op));
+	op->file = rand() % NUM_FILES;
+	file = &mFiles[op->file];
+	room = file->maxSize - file->size;
+
+	op->type = rand() % 8;
+	if (!file->exists || ((rand() % 20) == 0))
+	{
+		op->type = OP_CREATE;
+	}
+	else if (op->type > OP_DELETE)
+	{
+		op->type = ((room > 0) && ((rand() % 3) != 0)) ? OP_APPEND : OP_WRITE;
+	}
+	else if ((op->type == OP_DELETE) && ((rand() % 4) != 0))
+	{
+		op->type = OP_APPEND;
+	}
+
+	if ((op->type == OP_APPEND) && (room == 0))
+	{
+		op->type = OP_WRITE;
+	}
+
+	switch (op->type)
+	{
+	case OP_CREATE:
+		op->size = 1 + (rand() % MAX_FILE_SIZE);
+		break;
+	case OP_APPEND:
+		op->size = 1 + (rand() % ((room < MAX_WRITE) ? room : MAX_WRITE));
+		break;
+	case OP_WRITE:
+		op->index = rand() % (file->size + 1);
+		room = file->maxSize - op->index;
+		op->size = (room == 0) ? 0 : 1 + (rand() % ((room < MAX_WRITE) ? room : MAX_WRITE));
+		break;
+	default:
+		break;
+	}
+
+	for (i = 0; i < op->size && i < MAX_WRITE; i++)
+	{
+		op->data[i] = rand();
+	}
+}
+
+int main(void)
+{
+	static model_t after;				// what the file should hold after
+	operation_t op;						// operation being checked
+	uint32_t steps;						// steps the operation takes
+	uint32_t cuts = 0;					// number of cuts checked
+	uint32_t keep;						// cut to carry on from (0 = none)
+	uint32_t failed = 0;				// operations that found no room
+	uint32_t opNumber;
+	uint32_t cut;
+
+	srand(1);
+
+	if (!FlashMemImageOpen(NULL, FLASH_SIZE) || (FileInit() != FILE_RESULT_OK))
+	{
+		printf("FileInit failed\n");
+		return 1;
+	}
+
+	for (opNumber = 0; opNumber < NUM_OPS; opNumber++)
+	{
+		PickOperation(&op);
+
+		// Count the steps the operation takes, and see whether it works.
+		memcpy(mBefore, FlashMemGetBase(), FLASH_SIZE);
+		FlashMemResetStats();
+		after = mFiles[op.file];
+		if (RunOperation(&op))
+		{
+			ApplyOperation(&op, &after);
+		}
+		else
+		{
+			failed++;
+		}
+		steps = CountSteps();
+
+		// Without a cut, it should have landed, even before a reboot.
+		if (!CheckFiles(&op, &after, opNumber, 0, NULL))
+		{
+			printf("operation %u:  file %u is wrong\n", opNumber, op.file);
+			return 1;
+		}
+
+		// Cut the power after each step.
+		for (cut = 1; cut <= steps; cut++)
+		{
+			Restore();
+			FlashMemResetStats();
+			FlashMemSetPowerFail(cut);
+			RunOperation(&op);
+			CountSteps();
+
+			FlashMemSetPowerFail(0);
+			FileInit();
+			CheckFiles(&op, &after, opNumber, cut, NULL);
+			cuts++;
+		}
+
+		// Usually carry on from the finished operation.  Sometimes carry on from
+		// one of the cuts instead.
+		keep = ((steps > 0) && ((rand() % 4) == 0)) ? 1 + (rand() % steps) : 0;
+
+		Restore();
+		FlashMemResetStats();
+		FlashMemSetPowerFail(keep);
+		RunOperation(&op);
+		CountSteps();
+		if (keep != 0)
+		{
+			FlashMemSetPowerFail(0);
+			FileInit();
+		}
+
+		CheckFiles(&op, &after, opNumber, keep, &after);
+		mFiles[op.file] = after;
+	}
+
+	printf("%u operations (%u found no room), %u cuts checked, all recovered\n",
+		NUM_OPS, failed, cuts);
+
+	FlashMemImageClose();
+
+	return 0;
+}
@@ -0,0 +1,333 @@
+/******************************************************************************
+ *
+ *	Filename:		PowerFailFlashManager.c
+ *
+ *	Author:			Adam Johnson
+ *
+ *	Description:	Checks that FlashManager survives losing power at any
+ *					moment, on a PC.  It runs a long, random series of
+ *					operations on simulated flash:  mostly single
+ *					FlashManSetVariable calls, and some transactions that set
+ *					several variables at once.  For each operation, it cuts
+ *					the power after every single step the operation takes
+ *					(programming one byte, or erasing one segment), reboots
+ *					with FlashManInit, and checks that the variables being
+ *					set either all have their new values or all have their
+ *					old ones, and that the rest are untouched.  Each recovery
+ *					is also cut partway through once, to check that recovery
+ *					itself can be interrupted.  The workload carries on from
+ *					some of the cut states, so interrupted operations pile up
+ *					the way they would in the field.
+ *
+ *					At the end, it prints how many cuts were checked and how
+ *					long recovery took:  the time FlashManInit took on this
+ *					PC, and the time the real flash would have been busy.
+ *
+ *					Use sectors bigger than a segment, so cuts partway
+ *					through erasing a sector are checked too (from this
+ *					folder):
+ *					gcc -O2 -DSECTOR_SIZE=256 -DFLASH_SEGMENT_SIZE=128
+ *						-DNUM_SECTORS=3 -DLOOKUP_TABLE_SIZE=128
+ *						-I../Utilities -I../Processor_Peripherals/Linux
+ *						PowerFailFlashManager.c ../Utilities/FlashManager.c
+ *						../Utilities/Crc.c ../Processor_Peripherals/Linux/Flash.c
+ *						-o PowerFailFlashManager
+ *					./PowerFailFlashManager
+ *
+ *					Build it again with -DFLASH_GC_INCREMENTAL=1 to check
+ *					garbage collection a step at a time.
+ *
+ *	Terms of Use:	MIT License
+ *
+ *****************************************************************************/
+
+#include <stdint.h>						// universal data types
+#include <stdbool.h>					// defines "bool"
+#include <stdio.h>						// printf
+#include <stdlib.h>						// rand
+#include <string.h>						// memcpy, memcmp
+#include <time.h>						// clock_gettime
+#include "Flash.h"						// simulated flash
+#include "FlashManager.h"				// module under test
+
+#define NUM_IDS				12			// number of variables in the workload
+#define MAX_SIZE			8			// largest variable [bytes]
+#define NUM_SETS			3000		// length of the workload
+#define MAX_OP_SETS			3			// most sets in one transaction
+#define FLASH_SIZE			(16 * 1024)	// enough for any sensible settings
+
+typedef struct							// one operation in the workload
+{
+	uint16_t numSets;					// number of sets (1 = no transaction)
+	uint16_t ids[MAX_OP_SETS];			// variables to set
+	uint16_t sizes[MAX_OP_SETS];		// sizes of new values [bytes]
+	uint8_t values[MAX_OP_SETS][MAX_SIZE];	// new values (zero-padded)
+} operation_t;
+
+static uint8_t mValues[NUM_IDS][MAX_SIZE];	// expected values (zero-padded)
+static bool mStored[NUM_IDS];			// has each variable been stored?
+static uint8_t mBefore[FLASH_SIZE];		// flash before the set being checked
+static uint8_t mAfterCut[FLASH_SIZE];	// flash right after a cut
+
+static uint32_t mViolations = 0;		// bad writes seen by simulated flash
+static uint32_t mRecoveries = 0;		// number of recoveries measured
+static uint64_t mTotalNs = 0;			// total time to recover [ns]
+static uint64_t mMaxNs = 0;				// longest time to recover [ns]
+static uint64_t mTotalBusyNs = 0;		// total flash time to recover [ns]
+static uint64_t mMaxBusyNs = 0;			// longest flash time to recover [ns]
+
+static uint64_t NowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t)ts.tv_sec * 1000000000u) + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief	Get the number of steps flash has taken since the stats were reset.
+ */
+static uint32_t CountSteps(void)
+{
+	flashStats_t stats;
+
+	FlashMemGetStats(&stats);
+	mViolations += stats.violations;
+
+	return (uint32_t)(stats.bytesWritten + stats.erases);
+}
+
+/**
+ * @brief	Turn the power back on and reboot, measuring how long it takes.
+ * @returns	steps flash took to recover
+ */
+static uint32_t Recover(void)
+{
+	flashStats_t stats;
+	uint64_t start;
+	uint64_t elapsed;
+
+	FlashMemSetPowerFail(0);
+	FlashMemResetStats();
+
+	start = NowNs();
+	if (!FlashManInit())
+	{
+		printf("FlashManInit failed\n");
+		exit(1);
+	}
+	elapsed = NowNs() - start;
+
+	FlashMemGetStats(&stats);
+
+	mRecoveries++;
+	mTotalNs += elapsed;
+	mTotalBusyNs += stats.busyNs;
+	if (elapsed > mMaxNs)
+	{
+		mMaxNs = elapsed;
+	}
+	if (stats.busyNs > mMaxBusyNs)
+	{
+		mMaxBusyNs = stats.busyNs;
+	}
+
+	return CountSteps();
+}
+
+/**
+ * @brief	Run an operation.
+ */
+static void RunOperation(const operation_t *op)
+{
+	uint16_t i;
+
+	if (op->numSets == 1)
+	{
+		FlashManSetVariable(op->ids[0], (uint8_t *)op->values[0], op->sizes[0]);
+	}
+	else
+	{
+		FlashManBeginTransaction();
+		for (i = 0; i < op->numSets; i++)
+		{
+			FlashManSetVariable(op->ids[i], (uint8_t *)op->values[i], op->sizes[i]);
+
+			// Starting another transaction partway through must fail, and
+			// leave this one as it is.
+			if ((i == 0) && FlashManBeginTransaction())
+			{
+				printf("a transaction was started inside another\n");
+				exit(1);
+			}
+		}
+		FlashManCommitTransaction();
+	}
+
+	// a step of garbage collection, as a background task would do
+	FlashManCollectTask();
+}
+
+/**
+ * @brief	Check that the variables the operation sets all have their new
+ *			values or all have their old ones, and the rest are untouched.
+ * @param	op - operation that was running
+ * @returns	true if the new values landed; false if the old values are there
+ */
+static bool CheckValues(const operation_t *op, uint32_t set, uint32_t cut)
+{
+	const uint8_t *newValue[NUM_IDS] = { NULL };	// last new value of each
+	uint8_t readBack[MAX_SIZE];
+	bool found;
+	bool isNew;
+	bool isOld;
+	bool landed = true;
+	bool kept = true;
+	uint16_t i;
+
+	for (i = 0; i < op->numSets; i++)
+	{
+		newValue[op->ids[i]] = op->values[i];
+	}
+
+	for (i = 0; i < NUM_IDS; i++)
+	{
+		found = FlashManGetVariable(i, readBack, MAX_SIZE);
+
+		isNew = (newValue[i] != NULL) && found && (memcmp(readBack, newValue[i], MAX_SIZE) == 0);
+		isOld = (found == mStored[i]) && (!found || (memcmp(readBack, mValues[i], MAX_SIZE) == 0));
+
+		if (newValue[i] != NULL)
+		{
+			landed = landed && isNew;
+			kept = kept && isOld;
+		}
+		else if (!isOld)
+		{
+			printf("set %u, cut after step %u:  variable %u is wrong\n", set, cut, i);
+			exit(1);
+		}
+	}
+
+	if (!landed && !kept)
+	{
+		printf("set %u, cut after step %u:  only part of the operation landed\n", set, cut);
+		exit(1);
+	}
+
+	if (mViolations != 0)
+	{
+		printf("set %u, cut after step %u:  flash was written without erasing\n", set, cut);
+		exit(1);
+	}
+
+	return landed;
+}
+
+/**
+ * @brief	Restore flash to how it was before the set, and reboot.
+ */
+static void Restore(void)
+{
+	memcpy(FlashMemGetBase(), mBefore, FLASH_SIZE);
+	FlashMemSetPowerFail(0);
+	FlashManInit();
+}
+
+int main(void)
+{
+	operation_t op;						// operation being checked
+	uint32_t steps;						// steps the operation takes
+	uint32_t recoverySteps;				// steps recovery takes
+	uint32_t cuts = 0;					// number of cuts checked
+	uint32_t keep;						// cut to carry on from (0 = none)
+	uint32_t set;
+	uint32_t cut;
+	uint16_t i;
+	uint16_t j;
+
+	srand(1);
+
+	if (!FlashMemImageOpen(NULL, FLASH_SIZE) || !FlashManInit())
+	{
+		printf("FlashManInit failed\n");
+		return 1;
+	}
+
+	for (set = 0; set < NUM_SETS; set++)
+	{
+		// Make one set in four a transaction.
+		memset(&op, 0, sizeof(op));
+		op.numSets = ((rand() % 4) == 0) ? 2 + (rand() % (MAX_OP_SETS - 1)) : 1;
+		for (i = 0; i < op.numSets; i++)
+		{
+			op.ids[i] = rand() % NUM_IDS;
+			op.sizes[i] = 1 + (rand() % MAX_SIZE);
+			for (j = 0; j < op.sizes[i]; j++)
+			{
+				op.values[i][j] = rand();
+			}
+		}
+
+		// Count the steps the operation takes.
+		memcpy(mBefore, FlashMemGetBase(), FLASH_SIZE);
+		FlashMemResetStats();
+		RunOperation(&op);
+		steps = CountSteps();
+
+		// Cut the power after each step.
+		for (cut = 1; cut <= steps; cut++)
+		{
+			Restore();
+			FlashMemSetPowerFail(cut);
+			RunOperation(&op);
+			memcpy(mAfterCut, FlashMemGetBase(), FLASH_SIZE);
+
+			recoverySteps = Recover();
+			CheckValues(&op, set, cut);
+			cuts++;
+
+			// Cut the recovery partway through, and recover again.
+			if (recoverySteps > 0)
+			{
+				memcpy(FlashMemGetBase(), mAfterCut, FLASH_SIZE);
+				FlashMemSetPowerFail(1 + (rand() % recoverySteps));
+				FlashManInit();
+
+				Recover();
+				CheckValues(&op, set, cut);
+				cuts++;
+			}
+		}
+
+		// Usually carry on from the finished operation.  Sometimes carry on from
+		// one of the cuts instead.
+		keep = ((steps > 0) && ((rand() % 4) == 0)) ? 1 + (rand() % steps) : 0;
+
+		Restore();
+		FlashMemSetPowerFail(keep);
+		RunOperation(&op);
+		Recover();
+
+		if (CheckValues(&op, set, keep))
+		{
+			for (i = 0; i < op.numSets; i++)
+			{
+				memcpy(mValues[op.ids[i]], op.values[i], MAX_SIZE);
+				mStored[op.ids[i]] = true;
+			}
+		}
+	}
+
+	printf("%u operations, %u cuts checked, all recovered\n", NUM_SETS, cuts);
+	printf("recovery time on this PC:  mean %llu ns, max %llu ns\n",
+		(unsigned long long)(mTotalNs / mRecoveries), (unsigned long long)mMaxNs);
+	printf("recovery time on flash:  mean %llu us, max %llu us\n",
+		(unsigned long long)(mTotalBusyNs / mRecoveries / 1000),
+		(unsigned long long)(mMaxBusyNs / 1000));
+
+	FlashMemImageClose();
+
+	return 0;
+}
@@ -18,6 +18,7 @@
  *****************************************************************************/
 
 #include <stdint.h>						// universal data types
+#include <string.h>						// memchr, memcpy
 #include "CircularBuffer.h"				// header for this module
 
 /******************************************************************************
@@ -30,9 +31,9 @@
 
 void CBInit(circBuff_t *buffer)
 {
-	*buffer->length = 0;	// Set number of data to zero.
-	*buffer->readPos = 0;	// Set read position to first index in array.
-	*buffer->writePos = 0;	// Set write position to first index in array.
+	buffer->length = 0;		// Set number of data to zero.
+	buffer->readPos = 0;	// Set read position to first index in array.
+	buffer->writePos = 0;	// Set write position to first index in array.
 }
  
 /******************************************************************************
@@ -50,26 +51,29 @@ uint8_t CBAdd (circBuff_t *buffer, uint8_t newData)
 	uint8_t error = 0;					// an optimistic return value :)
 	
 	// If the buffer is full...
-	if (*buffer->length >= BUFFER_SIZE)
+	if (buffer->length >= BUFFER_SIZE)
 	{
 		// Alert the user.
 		error = 1;
 	}
 	
-	// Add the new element.
-	*buffer->data[*buffer->writePos] = newData;
+	else
+	{
+		// Add the new element.
+		buffer->data[buffer->writePos] = newData;
 
-	// Mark the buffer's new tail...
-	*buffer->writePos++;
+		// Mark the buffer's new tail...
+		buffer->writePos++;
 	
-	// ...wrap around the array if needed.
-	if (*buffer->writePos >= BUFFER_SIZE)
-	{
-		*buffer->writePos = 0;
-	}
+		// ...wrap around the array if needed.
+		if (buffer->writePos >= BUFFER_SIZE)
+		{
+			buffer->writePos = 0;
+		}
 
-	// Increment the buffer's length.
-	*buffer->length++;
+		// Increment the buffer's length.
+		buffer->length++;
+	}
 	
 	return error;
 }
@@ -78,13 +82,32 @@ uint8_t CBAdd (circBuff_t *buffer, uint8_t newData)
  *
  *	Function:		CBFetch
  *
- *	Description:	View a datum in a buffer, but don't remove it.
+ *	Description:	View a datum in a buffer, but don't remove it.  Position 0
+ *					is the oldest datum (the one CBRemove would return next).
+ *
+ *	Return value:	the datum; 0 if position is past the end of the data
  *
  *****************************************************************************/
 
-uint8_t CBFetch (circBuff_t buffer, uint8_t position)
+uint8_t CBFetch (circBuff_t *buffer, uint8_t position)
 {
-	// Not yet implemented :(
+	uint16_t index;						// index of the datum in the array
+	uint8_t datum = 0;					// return value
+
+	// Only look at data that's actually in the buffer.
+	if (position < buffer->length)
+	{
+		// Count from the read position, wrapping around the array if needed.
+		index = (uint16_t)buffer->readPos + position;
+		if (index >= BUFFER_SIZE)
+		{
+			index -= BUFFER_SIZE;
+		}
+
+		datum = buffer->data[index];
+	}
+
+	return datum;
 }
 
 /******************************************************************************
@@ -100,19 +123,19 @@ uint8_t CBRemove (circBuff_t *buffer)
 	uint8_t temp;						// stores a value from the buffer
 
 	// Read from the head of the buffer.
-	temp = *buffer->data[*buffer.readPos];
+	temp = buffer->data[buffer->readPos];
 
 	// Mark the buffer's new head...
-	*buffer->readPos++;
+	buffer->readPos++;
 	
 	// ...wrap around the array if needed.
-	if (*buffer.readPos >= BUFFER_SIZE)
+	if (buffer->readPos >= BUFFER_SIZE)
 	{
-		*buffer->readPos = 0;
+		buffer->readPos = 0;
 	}
 	
 	// Decrement the length.
-	*buffer->length--;
+	buffer->length--;
 
 	// Return the value from the buffer.
 	return temp;
@@ -128,5 +151,200 @@ uint8_t CBRemove (circBuff_t *buffer)
 
 uint8_t CBGetLength (circBuff_t *buffer)
 {
-	return *buffer->length;
+	return buffer->length;
+}
+
+/******************************************************************************
+ *
+ *	Function:		CBFind
+ *
+ *	Description:	Search a buffer for a datum (e.g. a '\n' at the end of a
+ *					command) without removing anything.  The data in the
+ *					buffer is at most two contiguous pieces of the array (the
+ *					part before the wrap and the part after it), so this is at
+ *					most two calls to memchr.
+ *
+ *	Parameters:		buffer - buffer to search
+ *					delimiter - value to look for
+ *					position - where it was found (0 = oldest datum), so the
+ *						caller knows how many bytes make up the frame
+ *
+ *	Return value:	0 if found; else the delimiter isn't in the buffer
+ *
+ *****************************************************************************/
+
+uint8_t CBFind (circBuff_t *buffer, uint8_t delimiter, uint8_t *position)
+{
+	uint8_t firstLength;				// number of data before the wrap
+	uint8_t *match = NULL;				// where the delimiter was found
+	uint8_t error = 1;					// a pessimistic return value :(
+
+	// Find the size of the piece between the read position and either the
+	// end of the data or the end of the array, whichever comes first.
+	firstLength = BUFFER_SIZE - buffer->readPos;
+	if (firstLength > buffer->length)
+	{
+		firstLength = buffer->length;
+	}
+
+	// Search the first piece.
+	if (firstLength > 0)
+	{
+		match = memchr(&buffer->data[buffer->readPos], delimiter, firstLength);
+		if (match != NULL)
+		{
+			*position = (uint8_t)(match - &buffer->data[buffer->readPos]);
+			error = 0;
+		}
+	}
+
+	// If it wasn't there, search the piece that wrapped to the array's start.
+	if ((match == NULL) && (buffer->length > firstLength))
+	{
+		match = memchr(&buffer->data[0], delimiter, buffer->length - firstLength);
+		if (match != NULL)
+		{
+			*position = (uint8_t)(firstLength + (match - &buffer->data[0]));
+			error = 0;
+		}
+	}
+
+	return error;
+}
+
+/******************************************************************************
+ *
+ *	Function:		CBIterInit
+ *
+ *	Description:	Start walking through the data in a buffer, oldest first,
+ *					without removing any of it.
+ *
+ *****************************************************************************/
+
+void CBIterInit (circBuff_t *buffer, cbIter_t *iter)
+{
+	iter->buffer = buffer;				// Remember which buffer to walk.
+	iter->position = 0;					// Start with the oldest datum.
+}
+
+/******************************************************************************
+ *
+ *	Function:		CBIterNext
+ *
+ *	Description:	Get the next datum in a walk through a buffer.  Data added
+ *					during the walk is visited too; don't remove data during
+ *					a walk.
+ *
+ *	Return value:	0 for success; else there's no more data
+ *
+ *****************************************************************************/
+
+uint8_t CBIterNext (cbIter_t *iter, uint8_t *datum)
+{
+	uint8_t error = 0;					// an optimistic return value :)
+
+	// If we've visited everything...
+	if (iter->position >= iter->buffer->length)
+	{
+		// Tell the user we're done.
+		error = 1;
+	}
+
+	else
+	{
+		// Fetch the datum and step to the next one.
+		*datum = CBFetch(iter->buffer, iter->position);
+		iter->position++;
+	}
+
+	return error;
+}
+
+/******************************************************************************
+ *
+ *	Function:		CBAddBlock
+ *
+ *	Description:	Pushes several data to a buffer at once.  This copies at
+ *					most two pieces (before and after the wrap), instead of
+ *					handling each datum separately.
+ *
+ *	Return value:	0 for success; else there isn't room for all the data, and
+ *					nothing was added
+ *
+ *****************************************************************************/
+
+uint8_t CBAddBlock (circBuff_t *buffer, const uint8_t *data, uint8_t count)
+{
+	uint8_t firstLength;				// number of data before the wrap
+	uint8_t error = 0;					// an optimistic return value :)
+
+	// If there isn't room for everything...
+	if (count > (BUFFER_SIZE - buffer->length))
+	{
+		// Alert the user.
+		error = 1;
+	}
+
+	else
+	{
+		// Copy as much as fits before the end of the array...
+		firstLength = BUFFER_SIZE - buffer->writePos;
+		if (firstLength > count)
+		{
+			firstLength = count;
+		}
+		memcpy(&buffer->data[buffer->writePos], data, firstLength);
+
+		// ...and the rest to the start of the array.
+		memcpy(&buffer->data[0], &data[firstLength], count - firstLength);
+
+		// Mark the buffer's new tail, wrapping around the array if needed.
+		buffer->writePos = (uint8_t)(((uint16_t)buffer->writePos + count) % BUFFER_SIZE);
+
+		// Update the buffer's length.
+		buffer->length += count;
+	}
+
+	return error;
+}
+
+/******************************************************************************
+ *
+ *	Function:		CBRemoveBlock
+ *
+ *	Description:	Pops several data from a buffer at once.
+ *
+ *	Return value:	number of data removed (less than count if the buffer
+ *					didn't have that many)
+ *
+ *****************************************************************************/
+
+uint8_t CBRemoveBlock (circBuff_t *buffer, uint8_t *data, uint8_t count)
+{
+	uint8_t firstLength;				// number of data before the wrap
+
+	// Don't remove more than there is.
+	if (count > buffer->length)
+	{
+		count = buffer->length;
+	}
+
+	// Copy as much as there is before the end of the array...
+	firstLength = BUFFER_SIZE - buffer->readPos;
+	if (firstLength > count)
+	{
+		firstLength = count;
+	}
+	memcpy(data, &buffer->data[buffer->readPos], firstLength);
+
+	// ...and the rest from the start of the array.
+	memcpy(&data[firstLength], &buffer->data[0], count - firstLength);
+
+	// Mark the buffer's new head, wrapping around the array if needed.
+	buffer->readPos = (uint8_t)(((uint16_t)buffer->readPos + count) % BUFFER_SIZE);
+
+	// Update the buffer's length.
+	buffer->length -= count;
+
+	return count;
 }
@@ -29,11 +29,22 @@ typedef struct
 	uint8_t writePos;					// index in array where new datum goes
 } circBuff_t;
 
+typedef struct							// walks the data in a buffer
+{
+	circBuff_t *buffer;					// buffer being walked
+	uint8_t position;					// next position to visit (0 = oldest)
+} cbIter_t;
+
 void    CBInit(circBuff_t *buffer);						// Init/erase a buffer.
-uint8_t CBAdd (circBuff_t buffer, uint8_t character);	// Push newest datum.
-uint8_t CBFetch (circBuff_t buffer, uint8_t position);	// Peek at a datum.
-uint8_t CBRemove (circBuff_t buffer);					// Pop oldest datum.
-uint8_t CBGetLength (circBuff_t buffer);				// Get number of data.
+uint8_t CBAdd (circBuff_t *buffer, uint8_t newData);	// Push newest datum.
+uint8_t CBFetch (circBuff_t *buffer, uint8_t position);	// Peek at a datum.
+uint8_t CBRemove (circBuff_t *buffer);					// Pop oldest datum.
+uint8_t CBGetLength (circBuff_t *buffer);				// Get number of data.
+uint8_t CBFind (circBuff_t *buffer, uint8_t delimiter, uint8_t *position);	// Search.
+void    CBIterInit (circBuff_t *buffer, cbIter_t *iter);	// Start a walk.
+uint8_t CBIterNext (cbIter_t *iter, uint8_t *datum);		// Step a walk.
+uint8_t CBAddBlock (circBuff_t *buffer, const uint8_t *data, uint8_t count);	// Push many.
+uint8_t CBRemoveBlock (circBuff_t *buffer, uint8_t *data, uint8_t count);		// Pop many.
 
 #endif	/* CIRCULARBUFFER_H */
 
@@ -0,0 +1,208 @@
+/******************************************************************************
+ * @file	Crc.c
+ * @author	Adam Johnson
+ * @remarks	Calculates CRC-16 and CRC-32 with small tables, big tables, or
+ *			hardware (see Crc.h).
+ *
+ *			CRC-16 shifts bits in from the top (most significant bit first),
+ *			and CRC-32 shifts them in from the bottom (least significant bit
+ *			first), so their tables are used in opposite directions.
+ *****************************************************************************/
+
+#include <stdint.h>						// standard-size types
+#include <stdbool.h>					// defines "bool" type
+#include "Crc.h"						// header for this module
+
+#if (CRC_METHOD == CRC_METHOD_HARDWARE)
+#include <msp430.h>						// CRC16 module registers
+#endif
+
+/******************************************************************************
+ *	Local Settings
+ *****************************************************************************/
+
+#define CRC16_POLYNOMIAL		0x1021		// x^16 + x^12 + x^5 + 1
+#define CRC32_POLYNOMIAL		0xEDB88320	// reversed 0x04C11DB7
+
+/******************************************************************************
+ *	Local variables
+ *****************************************************************************/
+
+#if (CRC_METHOD != CRC_METHOD_SLICE8)
+// CRC-32 of each nibble, shifted in from the bottom
+static const uint32_t mCrc32Nibble[16] =
+{
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+	0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+	0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+	0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+#endif
+
+#if (CRC_METHOD == CRC_METHOD_NIBBLE)
+// CRC-16 of each nibble, shifted in from the top
+static const uint16_t mCrc16Nibble[16] =
+{
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+#endif
+
+#if (CRC_METHOD == CRC_METHOD_SLICE8)
+// mCrc16Slice[0] is the CRC-16 of each byte.  mCrc16Slice[k] is the CRC of
+// each byte followed by k zero bytes.  The same goes for mCrc32Slice.
+static uint16_t mCrc16Slice[8][256];
+static uint32_t mCrc32Slice[8][256];
+static bool mSliceTablesBuilt = false;	// have the tables been calculated?
+#endif
+
+/******************************************************************************
+ *	Local Functions
+ *****************************************************************************/
+
+#if (CRC_METHOD == CRC_METHOD_SLICE8)
+/**
+ * @brief	Calculate the slicing-by-8 tables.
+ */
+static void BuildSliceTables(void)
+{
+	uint16_t crc16;						// CRC-16 being calculated
+	uint32_t crc32;						// CRC-32 being calculated
+	uint16_t i;							// counter
+	uint16_t k;							// counter
+
+	for (i = 0; i < 256; i++)
+	{
+		crc16 = (uint16_t)(i << 8);
+		crc32 = i;
+		for (k = 0; k < 8; k++)
+		{
+			crc16 = (crc16 & 0x8000) ? (uint16_t)((crc16 << 1) ^ CRC16_POLYNOMIAL) : (uint16_t)(crc16 << 1);
+			crc32 = (crc32 & 1) ? ((crc32 >> 1) ^ CRC32_POLYNOMIAL) : (crc32 >> 1);
+		}
+		mCrc16Slice[0][i] = crc16;
+		mCrc32Slice[0][i] = crc32;
+	}
+
+	for (k = 1; k < 8; k++)
+	{
+		for (i = 0; i < 256; i++)
+		{
+			crc16 = mCrc16Slice[k - 1][i];
+			mCrc16Slice[k][i] = (uint16_t)(crc16 << 8) ^ mCrc16Slice[0][crc16 >> 8];
+
+			crc32 = mCrc32Slice[k - 1][i];
+			mCrc32Slice[k][i] = (crc32 >> 8) ^ mCrc32Slice[0][crc32 & 0xFF];
+		}
+	}
+
+	mSliceTablesBuilt = true;
+}
+#endif
+
+/******************************************************************************
+ *	Public functions
+ *****************************************************************************/
+
+/**
+ * @brief	Add bytes to a CRC-16.
+ * @param	crc - CRC of the bytes so far (CRC16_START for the first piece)
+ * @param	data - bytes to add
+ * @param	count - number of bytes
+ * @returns	CRC of the bytes so far, including these
+ */
+uint16_t Crc16Update(uint16_t crc, const uint8_t *data, uint16_t count)
+{
+	uint16_t i = 0;						// counter
+
+#if (CRC_METHOD == CRC_METHOD_HARDWARE)
+	// Bytes written to CRCDIRB are bit-reversed, so the module gives the
+	// standard (most significant bit first) CRC.
+	CRCINIRES = crc;
+	for (i = 0; i < count; i++)
+	{
+		CRCDIRB_L = data[i];
+	}
+	crc = CRCINIRES;
+
+#elif (CRC_METHOD == CRC_METHOD_SLICE8)
+	if (mSliceTablesBuilt == false)
+	{
+		BuildSliceTables();
+	}
+
+	// 8 bytes at a time
+	for (; (i + 8) <= count; i += 8)
+	{
+		crc ^= (uint16_t)((data[i] << 8) | data[i + 1]);
+		crc = mCrc16Slice[7][crc >> 8] ^ mCrc16Slice[6][crc & 0xFF] ^
+			mCrc16Slice[5][data[i + 2]] ^ mCrc16Slice[4][data[i + 3]] ^
+			mCrc16Slice[3][data[i + 4]] ^ mCrc16Slice[2][data[i + 5]] ^
+			mCrc16Slice[1][data[i + 6]] ^ mCrc16Slice[0][data[i + 7]];
+	}
+
+	// the rest, a byte at a time
+	for (; i < count; i++)
+	{
+		crc = (uint16_t)(crc << 8) ^ mCrc16Slice[0][(crc >> 8) ^ data[i]];
+	}
+
+#else
+	for (i = 0; i < count; i++)
+	{
+		crc = (uint16_t)(crc << 4) ^ mCrc16Nibble[(crc >> 12) ^ (data[i] >> 4)];
+		crc = (uint16_t)(crc << 4) ^ mCrc16Nibble[(crc >> 12) ^ (data[i] & 0x0F)];
+	}
+#endif
+
+	return crc;
+}
+
+/**
+ * @brief	Add bytes to a CRC-32.
+ * @param	crc - CRC of the bytes so far (CRC32_START for the first piece)
+ * @param	data - bytes to add
+ * @param	count - number of bytes
+ * @returns	CRC of the bytes so far, including these
+ */
+uint32_t Crc32Update(uint32_t crc, const uint8_t *data, uint16_t count)
+{
+	uint16_t i = 0;						// counter
+
+	// CRC-32 starts at 0xFFFFFFFF and is inverted at the end.  Undo that
+	// here, so the result can be passed back in.
+	crc = ~crc;
+
+#if (CRC_METHOD == CRC_METHOD_SLICE8)
+	if (mSliceTablesBuilt == false)
+	{
+		BuildSliceTables();
+	}
+
+	// 8 bytes at a time
+	for (; (i + 8) <= count; i += 8)
+	{
+		crc ^= (uint32_t)data[i] | ((uint32_t)data[i + 1] << 8) |
+			((uint32_t)data[i + 2] << 16) | ((uint32_t)data[i + 3] << 24);
+		crc = mCrc32Slice[7][crc & 0xFF] ^ mCrc32Slice[6][(crc >> 8) & 0xFF] ^
+			mCrc32Slice[5][(crc >> 16) & 0xFF] ^ mCrc32Slice[4][crc >> 24] ^
+			mCrc32Slice[3][data[i + 4]] ^ mCrc32Slice[2][data[i + 5]] ^
+			mCrc32Slice[1][data[i + 6]] ^ mCrc32Slice[0][data[i + 7]];
+	}
+
+	// the rest, a byte at a time
+	for (; i < count; i++)
+	{
+		crc = (crc >> 8) ^ mCrc32Slice[0][(crc ^ data[i]) & 0xFF];
+	}
+
+#else
+	for (i = 0; i < count; i++)
+	{
+		crc = (crc >> 4) ^ mCrc32Nibble[(crc ^ data[i]) & 0x0F];
+		crc = (crc >> 4) ^ mCrc32Nibble[(crc ^ (data[i] >> 4)) & 0x0F];
+	}
+#endif
+
+	return ~crc;
+}
@@ -0,0 +1,59 @@
+/******************************************************************************
+ * @file	Crc.h
+ * @author	Adam Johnson
+ * @remarks	Calculates CRC-16 (CCITT-FALSE:  polynomial 0x1021, starting at
+ *			0xFFFF) and CRC-32 (the one used by Ethernet and zip files).
+ *			Both can be calculated a piece at a time:  start with
+ *			CRC16_START or CRC32_START, and pass the result of each call
+ *			into the next.  The result after the last piece is the CRC.
+ *
+ *			There are three ways to calculate them (see CRC_METHOD):
+ *			CRC_METHOD_NIBBLE	16-entry tables, 4 bits at a time.  Small
+ *								enough for any micro.
+ *			CRC_METHOD_SLICE8	eight 256-entry tables, 8 bytes at a time
+ *								("slicing-by-8").  Fast, but the tables take
+ *								4 KB (CRC-16) or 8 KB (CRC-32) of RAM, so
+ *								it's for PCs.
+ *			CRC_METHOD_HARDWARE	the MSP430's CRC16 module.  It only does
+ *								CRC-16, so CRC-32 uses the nibble tables.
+ *****************************************************************************/
+
+#ifndef CRC_H
+#define CRC_H
+
+/******************************************************************************
+ *	Configuration Settings
+ *	(Settings with #ifndef can be changed from the compiler's command line.)
+ *****************************************************************************/
+
+#define CRC_METHOD_NIBBLE		1		// 4 bits at a time
+#define CRC_METHOD_SLICE8		2		// 8 bytes at a time
+#define CRC_METHOD_HARDWARE		3		// MSP430 CRC16 module
+
+// how to calculate CRCs (one of the above)
+#ifndef CRC_METHOD
+#ifdef __linux__
+#define CRC_METHOD				CRC_METHOD_SLICE8
+#else
+#define CRC_METHOD				CRC_METHOD_NIBBLE
+#endif
+#endif
+
+/******************************************************************************
+ *	Constants
+ *****************************************************************************/
+
+#define CRC16_START				0xFFFF	// pass this in with the first piece
+#define CRC32_START				0		// pass this in with the first piece
+
+/******************************************************************************
+ *	Public functions
+ *****************************************************************************/
+
+// Add bytes to a CRC-16.
+uint16_t Crc16Update(uint16_t crc, const uint8_t *data, uint16_t count);
+
+// Add bytes to a CRC-32.
+uint32_t Crc32Update(uint32_t crc, const uint8_t *data, uint16_t count);
+
+#endif
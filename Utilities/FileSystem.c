@@ -0,0 +1,2409 @@
+/******************************************************************************
+ * @file	FileSystem.c
+ * @author	Adam Johnson
+ * @remarks	A small log-structured file system, for logs and configuration
+ *			blobs that are too big for FlashManager.
+ *
+ *			The storage is split into blocks (erasable pieces of flash).
+ *			Each file gets one extent:  a run of blocks big enough for its
+ *			maximum size, picked when it's created.  A byte's place in flash
+ *			is found from its index with a division, so reads and appends
+ *			take the same time wherever they are in the file.  Extents are
+ *			picked to keep the free blocks in long runs, unless much less
+ *			worn blocks are free, and each block's header holds its erase
+ *			count.
+ *
+ *			The directory (each file's name, extent and size) is kept in
+ *			RAM, and saved as a log of records in one of the first two
+ *			blocks.  Changing a file appends a record (written flag-last, so
+ *			a power cut leaves either the old record or the new one).  When
+ *			the block fills up, the whole directory is written to the other
+ *			block, and then that block is marked as the current one.
+ *
+ *			Data is never written over.  Appending programs the erased bytes
+ *			after the end of the file, and then records the new size.
+ *			Changing bytes that were already written copies the file to a
+ *			new extent with the change, and then records the new extent;
+ *			the old blocks are erased when they're next used.  Either way, a
+ *			power cut leaves the file as it was before the write.
+ *
+ *			Files opened with FILE_MODE_APPEND keep a pointer to their end in
+ *			the storage, and small appends are collected in RAM and written
+ *			a block write at a time (see FS_APPEND_BUFFER).  A new size is
+ *			saved as a short record with just the size, rather than the
+ *			whole entry, so the directory block fills up more slowly.
+ *
+ *			The storage can also be FRAM (see FS_DEVICE).  FRAM doesn't need
+ *			erasing, but the same layout is used, so a power cut is just as
+ *			safe.
+ *
+ *			Reads can go through a small cache of the storage (see
+ *			FS_CACHE_LINES), so many small reads of the same place don't each
+ *			cost an SPI transaction.  When each read starts where the last
+ *			one ended, the next lines are read in the same transaction.
+ *****************************************************************************/
+
+#include <stdint.h>						// standard-size types
+#include <stdbool.h>					// defines "bool" type
+#include <stddef.h>						// defines "NULL", "offsetof"
+#include "Crc.h"						// CRC-16
+#include "FileSystem.h"					// header for this module
+
+/******************************************************************************
+ *	Configuration Settings
+ *	(Settings with #ifndef can be changed from the compiler's command line.)
+ *****************************************************************************/
+
+#define FS_DEVICE_FLASH			1		// the chip's flash (see Flash.h)
+#define FS_DEVICE_FRAM			2		// MB85RS64 FRAM, over SPI
+
+// where files are kept (one of the above)
+#ifndef FS_DEVICE
+#define FS_DEVICE				FS_DEVICE_FLASH
+#endif
+
+#if (FS_DEVICE == FS_DEVICE_FLASH)
+#include "Flash.h"						// device specific Flash functions
+#else
+#include "MB85RS64.h"					// FRAM driver
+#endif
+
+// size of a block [bytes].  For flash, this must be a multiple of
+// FLASH_SEGMENT_SIZE (512 for MSP430 main memory).
+#ifndef FS_BLOCK_SIZE
+#define FS_BLOCK_SIZE			512
+#endif
+
+// number of blocks, including the two that hold the directory.  In FRAM,
+// the default fills a whole MB85RS64 (8 KB).
+#ifndef FS_NUM_BLOCKS
+#if (FS_DEVICE == FS_DEVICE_FLASH)
+#define FS_NUM_BLOCKS			32
+#else
+#define FS_NUM_BLOCKS			16
+#endif
+#endif
+
+// most files there can be.  Each takes 24 bytes of RAM (with 12-byte names).
+#ifndef FS_MAX_FILES
+#define FS_MAX_FILES			8
+#endif
+
+// longest file name [characters] (a multiple of 4)
+#ifndef FS_NAME_SIZE
+#define FS_NAME_SIZE			12
+#endif
+
+// On a PC, where in simulated flash the blocks start [bytes]
+#ifndef FS_FLASH_OFFSET
+#define FS_FLASH_OFFSET			0
+#endif
+
+// address in FRAM where the blocks start.  Move it past anything else kept
+// in FRAM (like PersistentLog and MeasurementStore, which fill an MB85RS64
+// between them), and shrink FS_NUM_BLOCKS to fit.
+#ifndef FS_FRAM_BASE
+#define FS_FRAM_BASE			0
+#endif
+
+// size of the FRAM [bytes] (8192 for an MB85RS64).  Addresses past the end
+// wrap around to the start, so the blocks must all fit.
+#ifndef FS_FRAM_SIZE
+#define FS_FRAM_SIZE			8192
+#endif
+
+// erases the best-fitting free blocks can be ahead of the least worn before
+// a file goes in the least worn instead (see AllocateExtent).  Smaller
+// spreads wear more evenly; bigger keeps the free blocks in longer runs.
+#ifndef FS_WEAR_MARGIN
+#define FS_WEAR_MARGIN			16
+#endif
+
+// size of the RAM buffer used to copy and compare data [bytes]
+#ifndef FS_COPY_SIZE
+#define FS_COPY_SIZE			32
+#endif
+
+// most bytes written in one block write (FlashMemWrite32).  See
+// FLASH_WRITE_BLOCK in FlashManager.c.
+#ifndef FS_WRITE_BLOCK
+#define FS_WRITE_BLOCK			32
+#endif
+
+// size of the RAM buffer that collects appended bytes, so small appends are
+// written a whole buffer (one block write) at a time [bytes].  The bytes wait
+// there until it fills, or the file is flushed or closed, so a power cut can
+// lose them.  0 writes every append straight away.
+#ifndef FS_APPEND_BUFFER
+#define FS_APPEND_BUFFER		FS_WRITE_BLOCK
+#endif
+
+// number of lines in the read cache (0 leaves it out).  Each takes
+// FS_CACHE_LINE_SIZE + 8 bytes of RAM.  Every read of FRAM is an SPI
+// transaction, so it has a cache by default.  Flash is read directly, so it
+// doesn't.
+#ifndef FS_CACHE_LINES
+#if (FS_DEVICE == FS_DEVICE_FRAM)
+#define FS_CACHE_LINES			4
+#else
+#define FS_CACHE_LINES			0
+#endif
+#endif
+
+// bytes in each cache line (a power of 2, no more than FS_BLOCK_SIZE)
+#ifndef FS_CACHE_LINE_SIZE
+#define FS_CACHE_LINE_SIZE		32
+#endif
+
+// lines read ahead when reads are sequential (less than FS_CACHE_LINES).
+// They're read in the same transaction as the line that was asked for.
+#ifndef FS_CACHE_READ_AHEAD
+#define FS_CACHE_READ_AHEAD		1
+#endif
+
+/******************************************************************************
+ *	Local Settings, Typedefs
+ *****************************************************************************/
+
+// This struct starts every block.
+typedef struct __attribute__((__packed__))
+{
+	uint32_t eraseCount;				// times the block has been erased
+	uint32_t sequence;					// (directory blocks) order written
+	uint8_t flag;						// (directory blocks) set when complete
+	uint8_t spare[3];					// keeps the data aligned
+} fsBlockHeader_t;
+
+// This struct starts every directory record.  A CRC-16 of the rest of the
+// header and the body follows the body.
+typedef struct __attribute__((__packed__))
+{
+	uint8_t flag;						// set when the record is complete
+	uint8_t type;						// FS_RECORD_xxx
+	uint8_t slot;						// directory slot (file handle)
+	uint8_t spare;						// keeps the body aligned
+} fsRecordHeader_t;
+
+// This struct describes a file.  It's kept in RAM, and is the body of an
+// FS_RECORD_ENTRY record.
+typedef struct __attribute__((__packed__))
+{
+	uint32_t size;						// size of the file [bytes]
+	uint32_t maxSize;					// most it can hold [bytes]
+	uint16_t firstBlock;				// start of its extent
+	uint16_t numBlocks;					// length of its extent (0 = no file)
+	char name[FS_NAME_SIZE];			// name (padded with '\0')
+} fsEntry_t;
+
+// This flag marks a complete record, or a complete directory block.
+#define FS_FLAG_VALID			0xAA
+
+// record types
+#define FS_RECORD_ENTRY			0x01	// a file's directory entry
+#define FS_RECORD_DELETE		0x02	// a file was deleted
+#define FS_RECORD_SIZE			0x03	// a file's new size (uint32_t)
+
+// This struct tells where the next byte appended to a file goes.
+typedef struct
+{
+	uint32_t addr;						// its place in the storage
+	uint16_t room;						// bytes left in its block
+} fsTail_t;
+
+// This value in a block header means it hasn't been written.
+#define FS_BLANK				0xFFFFFFFF
+
+// number of blocks holding the directory
+#define FS_META_BLOCKS			2
+
+// This open mode means the file isn't open.
+#define FS_CLOSED				0xFF
+
+// bytes of file data in a block
+#define BLOCK_DATA_SIZE			(FS_BLOCK_SIZE - sizeof(fsBlockHeader_t))
+
+// size of the storage [bytes]
+#define STORAGE_SIZE			((uint32_t)FS_NUM_BLOCKS * FS_BLOCK_SIZE)
+
+// where a block, or its data, starts in the storage
+#define BLOCK_ADDR(block)		((uint32_t)(block) * FS_BLOCK_SIZE)
+#define DATA_ADDR(block)		(BLOCK_ADDR(block) + sizeof(fsBlockHeader_t))
+
+// size of a record with a body of a certain size [bytes].  Records are
+// rounded up to 4 bytes so they stay aligned for word writes.
+#define RECORD_SIZE(bodySize)	\
+	((((sizeof(fsRecordHeader_t) + (bodySize) + sizeof(uint16_t)) + 3) / 4) * 4)
+
+// size of the biggest record [bytes]
+#define MAX_RECORD_SIZE			RECORD_SIZE(sizeof(fsEntry_t))
+
+// Find a place in the storage.  On a PC, the blocks are in simulated flash
+// (see Processor_Peripherals/Linux/Flash.h).
+#ifdef __linux__
+#define FS_PTR(addr)			(FlashMemGetBase() + FS_FLASH_OFFSET + (addr))
+#else
+#define FS_PTR(addr)			(&mBlockArray[0][0] + (addr))
+#endif
+
+// Make sure the whole directory, and one more record, fits in a block, and
+// that slots fit in a byte.
+typedef char fsDirectorySizeCheck_t[
+	((sizeof(fsBlockHeader_t) + ((FS_MAX_FILES + 1) * MAX_RECORD_SIZE) <= FS_BLOCK_SIZE) &&
+	 (FS_MAX_FILES < FS_CLOSED)) ? 1 : -1];
+
+// Make sure there are blocks for files, and names keep records aligned.
+typedef char fsBlocksCheck_t[
+	((FS_NUM_BLOCKS > FS_META_BLOCKS) && (FS_BLOCK_SIZE <= 0x8000) &&
+	 ((FS_NAME_SIZE % 4) == 0)) ? 1 : -1];
+
+#if (FS_CACHE_LINES > 0)
+// This struct holds a piece of the storage in the read cache.
+typedef struct
+{
+	uint32_t addr;						// where it's from (FS_CACHE_EMPTY = unused)
+	uint32_t lastUse;					// mCacheClock when it was last read
+	uint8_t data[FS_CACHE_LINE_SIZE];	// what's there
+} fsCacheLine_t;
+
+// This address means a cache line is unused.
+#define FS_CACHE_EMPTY			0xFFFFFFFF
+
+// Make sure lines fit evenly in blocks, and read-ahead leaves a line for
+// what was asked for.
+typedef char fsCacheCheck_t[
+	(((FS_CACHE_LINE_SIZE & (FS_CACHE_LINE_SIZE - 1)) == 0) &&
+	 ((FS_BLOCK_SIZE % FS_CACHE_LINE_SIZE) == 0) &&
+	 (FS_CACHE_READ_AHEAD < FS_CACHE_LINES)) ? 1 : -1];
+#endif
+
+#if (FS_APPEND_BUFFER > 0)
+// Make sure the append buffer fills up at the end of a block.
+typedef char fsAppendCheck_t[
+	(((FS_APPEND_BUFFER & (FS_APPEND_BUFFER - 1)) == 0) &&
+	 ((FS_BLOCK_SIZE % FS_APPEND_BUFFER) == 0)) ? 1 : -1];
+#endif
+
+#if (FS_DEVICE == FS_DEVICE_FLASH)
+// Make sure blocks can be erased on their own.
+typedef char fsSegmentCheck_t[((FS_BLOCK_SIZE % FLASH_SEGMENT_SIZE) == 0) ? 1 : -1];
+#else
+// Make sure the blocks fit in the FRAM.
+typedef char fsFramSizeCheck_t[((FS_FRAM_BASE + STORAGE_SIZE) <= FS_FRAM_SIZE) ? 1 : -1];
+#endif
+
+/******************************************************************************
+ *	Local variables
+ *****************************************************************************/
+
+// Allocate memory for the blocks so it isn't used by the linker for
+// something else.  The linker command file must put this section in flash,
+// starting on a segment boundary.
+#if (FS_DEVICE == FS_DEVICE_FLASH) && !defined(__linux__)
+#pragma DATA_SECTION(mBlockArray, ".fileSystem")
+static uint8_t mBlockArray[FS_NUM_BLOCKS][FS_BLOCK_SIZE];
+#endif
+
+static fsEntry_t mDirectory[FS_MAX_FILES];	// every file, by slot
+static uint8_t mOpenMode[FS_MAX_FILES];	// how each file was opened
+static fsTail_t mTail[FS_MAX_FILES];	// where each file's next byte goes
+
+static uint8_t mAppendSlot = FS_MAX_FILES;	// file being appended to
+#if (FS_APPEND_BUFFER > 0)
+static uint8_t mAppendBuffer[FS_APPEND_BUFFER];	// bytes appended to it, not
+										// written yet
+static uint16_t mAppendCount;			// number of bytes in mAppendBuffer
+#endif
+
+static uint16_t mMetaBlock;				// block holding the directory
+static uint32_t mMetaSequence;			// its sequence number
+static uint32_t mMetaOffset;			// where its next record goes
+
+#if (FS_CACHE_LINES > 0)
+static fsCacheLine_t mCache[FS_CACHE_LINES];	// the read cache
+static uint32_t mCacheClock;			// counts reads of the cache
+static uint32_t mNextAddr;				// where the last read ended
+static uint32_t mMissedLines[FS_CACHE_LINES];	// lines missed, but not cached
+static uint8_t mMissedIndex;			// where the next missed line goes
+#endif
+static fileCacheStats_t mCacheStats;	// how well the cache is working
+
+/******************************************************************************
+ *	Local Functions (storage)
+ *****************************************************************************/
+
+#if (FS_DEVICE == FS_DEVICE_FLASH)
+/**
+ * @brief	Write bytes to flash, and check that they were written.
+ * @remarks	Uses the widest writes the address allows, like WriteFlash in
+ *			FlashManager.c.
+ * @param	dataPtr - data to write
+ * @param	flashPtr - where to write it
+ * @param	count - number of bytes to write
+ * @returns	true for success; false otherwise
+ */
+static bool WriteFlash(const uint8_t *dataPtr, uint8_t *flashPtr, uint32_t count)
+{
+	uint32_t words[FS_WRITE_BLOCK / 4];	// aligned copy of the data
+	uint16_t halfWord;					// aligned copy of the data
+	uint8_t byte;						// copy of the data
+	uint32_t bytes;						// bytes written in one go
+	uint32_t i;							// counter
+	bool result = true;					// an optimistic return value :)
+
+	while ((result == true) && (count > 0))
+	{
+		// Block-write whole words, up to the end of the block.
+		if ((((uintptr_t)flashPtr % 4) == 0) && (count >= 4))
+		{
+			bytes = FS_WRITE_BLOCK - ((uintptr_t)flashPtr % FS_WRITE_BLOCK);
+			if (bytes > count)
+			{
+				bytes = count & ~3;
+			}
+
+			for (i = 0; i < bytes; i++)
+			{
+				((uint8_t *)words)[i] = dataPtr[i];
+			}
+
+			FlashMemWrite32(words, (uint32_t *)flashPtr, (uint16_t)(bytes / 4));
+
+			// Verify the data was written correctly.
+			for (i = 0; i < (bytes / 4); i++)
+			{
+				if (((volatile uint32_t *)flashPtr)[i] != words[i])
+				{
+					result = false;
+				}
+			}
+		}
+		else if ((((uintptr_t)flashPtr % 2) == 0) && (count >= 2))
+		{
+			bytes = 2;
+			((uint8_t *)&halfWord)[0] = dataPtr[0];
+			((uint8_t *)&halfWord)[1] = dataPtr[1];
+
+			FlashMemWrite16(&halfWord, (uint16_t *)flashPtr, 1);
+			result = (*(volatile uint16_t *)flashPtr == halfWord);
+		}
+		else
+		{
+			bytes = 1;
+			byte = *dataPtr;
+			FlashMemWrite8(&byte, flashPtr, 1);
+			result = (*(volatile uint8_t *)flashPtr == byte);
+		}
+
+		dataPtr += bytes;
+		flashPtr += bytes;
+		count -= bytes;
+	}
+
+	return result;
+}
+#endif
+
+/**
+ * @brief	Read bytes from the storage itself (not the cache).
+ * @param	addr - where to read from
+ * @param	data - returns the bytes
+ * @param	count - number of bytes to read
+ */
+static void DevReadDirect(uint32_t addr, uint8_t *data, uint32_t count)
+{
+#if (FS_DEVICE == FS_DEVICE_FLASH)
+	const uint8_t *flashPtr = FS_PTR(addr);	// where the bytes are
+	uint32_t i;							// counter
+
+	for (i = 0; i < count; i++)
+	{
+		data[i] = flashPtr[i];
+	}
+#else
+	FramRead(FS_FRAM_BASE + addr, data, count);
+#endif
+}
+
+#if (FS_CACHE_LINES > 0)
+/**
+ * @brief	Find a line in the cache.
+ * @param	lineAddr - where the line is from (a multiple of FS_CACHE_LINE_SIZE)
+ * @returns	the line; NULL if it isn't cached
+ */
+static fsCacheLine_t *FindLine(uint32_t lineAddr)
+{
+	fsCacheLine_t *line = NULL;			// return value
+	uint8_t i;							// counter
+
+	for (i = 0; (line == NULL) && (i < FS_CACHE_LINES); i++)
+	{
+		if (mCache[i].addr == lineAddr)
+		{
+			line = &mCache[i];
+		}
+	}
+
+	return line;
+}
+
+/**
+ * @brief	Check whether a line was missed recently (and remember it if not).
+ * @param	lineAddr - where the line is from
+ * @returns	true if it was missed recently; false otherwise
+ */
+static bool CheckMissed(uint32_t lineAddr)
+{
+	bool result = false;				// a pessimistic return value :(
+	uint8_t i;							// counter
+
+	for (i = 0; (result == false) && (i < FS_CACHE_LINES); i++)
+	{
+		result = (mMissedLines[i] == lineAddr);
+	}
+
+	if (result == false)
+	{
+		mMissedLines[mMissedIndex] = lineAddr;
+		mMissedIndex = (mMissedIndex + 1) % FS_CACHE_LINES;
+	}
+
+	return result;
+}
+
+/**
+ * @brief	Read lines of the storage into the cache, in one transaction.
+ * @remarks	Each line replaces an unused line, or the least recently used.
+ * @param	lineAddr - where the first line is from
+ * @param	numLines - number of lines (no more than FS_CACHE_READ_AHEAD + 1)
+ */
+static void FillLines(uint32_t lineAddr, uint32_t numLines)
+{
+	uint8_t buffer[(FS_CACHE_READ_AHEAD + 1) * FS_CACHE_LINE_SIZE];	// lines read
+	fsCacheLine_t *line;				// line to fill
+	uint32_t i;							// counter
+	uint8_t j;							// counter
+
+	DevReadDirect(lineAddr, buffer, numLines * FS_CACHE_LINE_SIZE);
+
+	for (i = 0; i < numLines; i++)
+	{
+		line = FindLine(lineAddr);
+		if (line == NULL)
+		{
+			line = &mCache[0];
+			for (j = 1; j < FS_CACHE_LINES; j++)
+			{
+				if ((line->addr != FS_CACHE_EMPTY) &&
+					((mCache[j].addr == FS_CACHE_EMPTY) || (mCache[j].lastUse < line->lastUse)))
+				{
+					line = &mCache[j];
+				}
+			}
+		}
+
+		line->addr = lineAddr;
+		line->lastUse = ++mCacheClock;
+		for (j = 0; j < FS_CACHE_LINE_SIZE; j++)
+		{
+			line->data[j] = buffer[(i * FS_CACHE_LINE_SIZE) + j];
+		}
+
+		lineAddr += FS_CACHE_LINE_SIZE;
+	}
+}
+#endif
+
+/**
+ * @brief	Keep the cache up to date after the storage is written.
+ * @param	addr - where the storage was written
+ * @param	data - what was written (NULL if it isn't known, or was erased)
+ * @param	count - number of bytes written
+ */
+static void UpdateCache(uint32_t addr, const uint8_t *data, uint32_t count)
+{
+#if (FS_CACHE_LINES > 0)
+	fsCacheLine_t *line;				// a cache line
+	uint32_t i;							// counter
+	uint8_t j;							// counter
+
+	for (j = 0; j < FS_CACHE_LINES; j++)
+	{
+		line = &mCache[j];
+		if ((line->addr == FS_CACHE_EMPTY) || (line->addr >= (addr + count)) ||
+			((line->addr + FS_CACHE_LINE_SIZE) <= addr))
+		{
+			continue;
+		}
+
+		if (data == NULL)
+		{
+			line->addr = FS_CACHE_EMPTY;
+			continue;
+		}
+
+		for (i = 0; i < FS_CACHE_LINE_SIZE; i++)
+		{
+			if (((line->addr + i) >= addr) && ((line->addr + i) < (addr + count)))
+			{
+				line->data[i] = data[line->addr + i - addr];
+			}
+		}
+	}
+#else
+	(void)addr;
+	(void)data;
+	(void)count;
+#endif
+}
+
+/**
+ * @brief	Empty the cache (when the storage may have changed under it).
+ */
+static void ClearCache(void)
+{
+#if (FS_CACHE_LINES > 0)
+	uint8_t i;							// counter
+
+	for (i = 0; i < FS_CACHE_LINES; i++)
+	{
+		mCache[i].addr = FS_CACHE_EMPTY;
+		mMissedLines[i] = FS_CACHE_EMPTY;
+	}
+
+	mNextAddr = FS_CACHE_EMPTY;
+#endif
+}
+
+/**
+ * @brief	Read bytes from the storage, through the cache.
+ * @remarks	If a read starts where the last one ended, missed lines are read
+ *			into the cache along with the next FS_CACHE_READ_AHEAD lines.
+ *			Otherwise, a line is only cached the second time it's missed;
+ *			the first time, just the bytes asked for are read.  (Filling a
+ *			line costs more than a small read, which is wasted if reads are
+ *			all over the place.)  Reads bigger than the cache, and sequential
+ *			reads of two or more lines, go straight to the storage, so they
+ *			don't push out what's in the cache.
+ * @param	addr - where to read from
+ * @param	data - returns the bytes
+ * @param	count - number of bytes to read
+ */
+static void DevRead(uint32_t addr, uint8_t *data, uint32_t count)
+{
+#if (FS_CACHE_LINES > 0)
+	bool sequential = (addr == mNextAddr);	// does it follow the last read?
+	fsCacheLine_t *line;				// line holding the bytes
+	uint32_t lineAddr;					// where the line is from
+	uint32_t numLines;					// lines to read into the cache
+	uint32_t offset;					// offset of the bytes in the line
+	uint32_t bytes;						// bytes read in one go
+	uint32_t i;							// counter
+
+	mNextAddr = addr + count;
+
+	while (count > 0)
+	{
+		offset = addr % FS_CACHE_LINE_SIZE;
+		lineAddr = addr - offset;
+		bytes = FS_CACHE_LINE_SIZE - offset;
+		if (bytes > count)
+		{
+			bytes = count;
+		}
+
+		line = FindLine(lineAddr);
+		if (line != NULL)
+		{
+			mCacheStats.hits++;
+		}
+		else
+		{
+			mCacheStats.misses++;
+
+			// Read the rest straight from the storage, if it isn't worth
+			// caching:  it wouldn't fit, it's a stream that won't be read
+			// again, or it hasn't been missed before.
+			if (((offset + count) > (FS_CACHE_LINES * FS_CACHE_LINE_SIZE)) ||
+				((sequential == true) && (count >= (2 * FS_CACHE_LINE_SIZE))))
+			{
+				bytes = count;
+				DevReadDirect(addr, data, bytes);
+			}
+			else if ((sequential == false) && (CheckMissed(lineAddr) == false))
+			{
+				// Remember the rest of its lines, too, so they're all cached
+				// if it's read again.
+				for (i = lineAddr + FS_CACHE_LINE_SIZE; i < (addr + count); i += FS_CACHE_LINE_SIZE)
+				{
+					if (FindLine(i) == NULL)
+					{
+						CheckMissed(i);
+					}
+				}
+
+				bytes = count;
+				DevReadDirect(addr, data, bytes);
+			}
+			else
+			{
+				numLines = 1;
+				if (sequential == true)
+				{
+					numLines += FS_CACHE_READ_AHEAD;
+					if (numLines > ((STORAGE_SIZE - lineAddr) / FS_CACHE_LINE_SIZE))
+					{
+						numLines = (STORAGE_SIZE - lineAddr) / FS_CACHE_LINE_SIZE;
+					}
+				}
+
+				mCacheStats.readAheads += numLines - 1;
+				FillLines(lineAddr, numLines);
+				line = FindLine(lineAddr);
+			}
+		}
+
+		if (line != NULL)
+		{
+			for (i = 0; i < bytes; i++)
+			{
+				data[i] = line->data[offset + i];
+			}
+			line->lastUse = ++mCacheClock;
+		}
+
+		addr += bytes;
+		data += bytes;
+		count -= bytes;
+	}
+#else
+	mCacheStats.misses++;
+	DevReadDirect(addr, data, count);
+#endif
+}
+
+/**
+ * @brief	Write bytes to the storage, and check that they were written.
+ * @remarks	In flash, the bytes must be erased first.
+ * @param	addr - where to write to
+ * @param	data - bytes to write
+ * @param	count - number of bytes to write
+ * @returns	true for success; false otherwise
+ */
+static bool DevWrite(uint32_t addr, const uint8_t *data, uint32_t count)
+{
+	bool result = true;					// an optimistic return value :)
+
+#if (FS_DEVICE == FS_DEVICE_FLASH)
+	result = WriteFlash(data, FS_PTR(addr), count);
+#else
+	uint8_t check[FS_COPY_SIZE];		// bytes read back
+	uint32_t bytes;						// bytes checked in one go
+	uint32_t i;							// counter
+	uint32_t j;							// counter
+
+	FramWriteEnable(true);
+	FramWrite(FS_FRAM_BASE + addr, data, count);
+
+	// Verify the data was written correctly.
+	for (i = 0; (result == true) && (i < count); i += bytes)
+	{
+		bytes = ((count - i) < FS_COPY_SIZE) ? (count - i) : FS_COPY_SIZE;
+		FramRead(FS_FRAM_BASE + addr + i, check, bytes);
+		for (j = 0; j < bytes; j++)
+		{
+			if (check[j] != data[i + j])
+			{
+				result = false;
+			}
+		}
+	}
+#endif
+
+	// If it failed, we don't know what's there.
+	UpdateCache(addr, (result == true) ? data : NULL, count);
+
+	return result;
+}
+
+/**
+ * @brief	Check that bytes in the storage are erased.
+ * @param	addr - where to start
+ * @param	count - number of bytes to check
+ * @returns	true if they're all erased; false otherwise
+ */
+static bool DevIsErased(uint32_t addr, uint32_t count)
+{
+#if (FS_DEVICE == FS_DEVICE_FLASH)
+	return FlashMemEraseCheck(FS_PTR(addr), (uint16_t)count);
+#else
+	uint8_t data[FS_COPY_SIZE];			// bytes read
+	uint32_t bytes;						// bytes checked in one go
+	uint32_t i;							// counter
+	bool result = true;					// an optimistic return value :)
+
+	while ((result == true) && (count > 0))
+	{
+		bytes = (count < FS_COPY_SIZE) ? count : FS_COPY_SIZE;
+		FramRead(FS_FRAM_BASE + addr, data, bytes);
+		for (i = 0; i < bytes; i++)
+		{
+			if (data[i] != 0xFF)
+			{
+				result = false;
+			}
+		}
+
+		addr += bytes;
+		count -= bytes;
+	}
+
+	return result;
+#endif
+}
+
+/**
+ * @brief	Erase a block (in FRAM, fill it with 0xFF like erased flash).
+ * @param	block - block to erase
+ */
+static void DevErase(uint16_t block)
+{
+	uint32_t i;							// counter
+
+#if (FS_DEVICE == FS_DEVICE_FLASH)
+	for (i = 0; i < FS_BLOCK_SIZE; i += FLASH_SEGMENT_SIZE)
+	{
+		FlashMemSegmentErase(FS_PTR(BLOCK_ADDR(block) + i));
+	}
+#else
+	uint8_t blank[FS_COPY_SIZE];		// erased bytes
+
+	for (i = 0; i < FS_COPY_SIZE; i++)
+	{
+		blank[i] = 0xFF;
+	}
+
+	FramWriteEnable(true);
+	for (i = 0; i < FS_BLOCK_SIZE; i += FS_COPY_SIZE)
+	{
+		FramWrite(FS_FRAM_BASE + BLOCK_ADDR(block) + i, blank,
+			((FS_BLOCK_SIZE - i) < FS_COPY_SIZE) ? (FS_BLOCK_SIZE - i) : FS_COPY_SIZE);
+	}
+#endif
+
+	UpdateCache(BLOCK_ADDR(block), NULL, FS_BLOCK_SIZE);
+}
+
+/******************************************************************************
+ *	Local Functions (blocks)
+ *****************************************************************************/
+
+/**
+ * @brief	Get the number of times a block has been erased.
+ * @param	block - block to act upon
+ * @returns	erase count (0 if it was never recorded)
+ */
+static uint32_t GetEraseCount(uint16_t block)
+{
+	uint32_t eraseCount;				// return value
+
+	DevRead(BLOCK_ADDR(block) + offsetof(fsBlockHeader_t, eraseCount),
+		(uint8_t *)&eraseCount, sizeof(eraseCount));
+
+	if (eraseCount == FS_BLANK)
+	{
+		eraseCount = 0;
+	}
+
+	return eraseCount;
+}
+
+/**
+ * @brief	Get a block ready to be written:  erase it if it isn't already,
+ *			and record its erase count.
+ * @remarks	If power is lost before the erase count is written, the count
+ *			starts again from 0.
+ * @param	block - block to act upon
+ * @returns	true for success; false otherwise
+ */
+static bool PrepareBlock(uint16_t block)
+{
+	uint32_t eraseCount;				// times the block has been erased
+	uint32_t oldCount;					// erase count in the header
+	bool status = true;					// an optimistic return value :)
+
+	DevRead(BLOCK_ADDR(block) + offsetof(fsBlockHeader_t, eraseCount),
+		(uint8_t *)&oldCount, sizeof(oldCount));
+	eraseCount = GetEraseCount(block);
+
+	if (DevIsErased(BLOCK_ADDR(block) + offsetof(fsBlockHeader_t, sequence),
+			FS_BLOCK_SIZE - offsetof(fsBlockHeader_t, sequence)) == false)
+	{
+		DevErase(block);
+		eraseCount++;
+		oldCount = FS_BLANK;
+		status = DevIsErased(BLOCK_ADDR(block), FS_BLOCK_SIZE);
+	}
+
+	if ((status == true) && (oldCount == FS_BLANK))
+	{
+		status = DevWrite(BLOCK_ADDR(block) + offsetof(fsBlockHeader_t, eraseCount),
+			(uint8_t *)&eraseCount, sizeof(eraseCount));
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Check whether a run of blocks is free.
+ * @param	firstBlock - start of the run
+ * @param	numBlocks - length of the run
+ * @returns	0 if it's free; otherwise, the block after the extent in the way
+ */
+static uint16_t FindOverlap(uint16_t firstBlock, uint16_t numBlocks)
+{
+	fsEntry_t *entry;					// a file's entry
+	uint16_t end = 0;					// return value
+	uint8_t i;							// counter
+
+	for (i = 0; i < FS_MAX_FILES; i++)
+	{
+		entry = &mDirectory[i];
+		if ((entry->numBlocks != 0) &&
+			(entry->firstBlock < (firstBlock + numBlocks)) &&
+			(firstBlock < (entry->firstBlock + entry->numBlocks)) &&
+			((entry->firstBlock + entry->numBlocks) > end))
+		{
+			end = entry->firstBlock + entry->numBlocks;
+		}
+	}
+
+	return end;
+}
+
+/**
+ * @brief	Find the erase count of the most-worn block in a run.
+ * @param	firstBlock - start of the run
+ * @param	numBlocks - length of the run
+ * @returns	erase count
+ */
+static uint32_t GetRunWear(uint16_t firstBlock, uint16_t numBlocks)
+{
+	uint32_t wear = 0;					// return value
+	uint32_t eraseCount;				// erase count of one block
+	uint16_t i;							// counter
+
+	for (i = firstBlock; i < (firstBlock + numBlocks); i++)
+	{
+		eraseCount = GetEraseCount(i);
+		if (eraseCount > wear)
+		{
+			wear = eraseCount;
+		}
+	}
+
+	return wear;
+}
+
+/**
+ * @brief	Pick free blocks for a file, and get them ready.
+ * @remarks	Puts the file at one end of the shortest stretch of free blocks
+ *			it fits in, so the free blocks stay in long stretches for files
+ *			that are created or copied later.  But if another run of free
+ *			blocks is more than FS_WEAR_MARGIN erases less worn (comparing
+ *			the most-worn block of each), that one is picked instead, so
+ *			erases are still spread over all the blocks.  Blocks in use
+ *			(including the extent of a file being copied) aren't picked.
+ * @param	entry - file's entry (sets firstBlock, for numBlocks blocks)
+ * @returns	true for success; false if there's no room, or error
+ */
+static bool AllocateExtent(fsEntry_t *entry)
+{
+	uint16_t numBlocks = entry->numBlocks;	// blocks needed
+	uint16_t gapStart = FS_META_BLOCKS;	// start of a stretch of free blocks
+	uint16_t gapEnd;					// block after the stretch
+	uint16_t overlap;					// end of the extent in the way
+	uint32_t wear;						// wear of the run being checked
+	uint32_t leastWear = 0;				// least wear found so far
+	uint16_t leastWorn = FS_NUM_BLOCKS;	// run with the least wear
+	uint32_t fitWear = 0;				// wear of the best fit
+	uint16_t fitSize = 0;				// size of the best fit's stretch
+	uint16_t fit = FS_NUM_BLOCKS;		// run in the shortest stretch
+	uint16_t start;						// start of the run being checked
+	uint16_t i;							// counter
+	bool status = true;					// an optimistic return value :)
+
+	while (gapStart < FS_NUM_BLOCKS)
+	{
+		overlap = FindOverlap(gapStart, 1);
+		if (overlap != 0)
+		{
+			gapStart = overlap;
+			continue;
+		}
+
+		gapEnd = gapStart + 1;
+		while ((gapEnd < FS_NUM_BLOCKS) && (FindOverlap(gapEnd, 1) == 0))
+		{
+			gapEnd++;
+		}
+
+		for (start = gapStart; (start + numBlocks) <= gapEnd; start++)
+		{
+			wear = GetRunWear(start, numBlocks);
+			if ((leastWorn == FS_NUM_BLOCKS) || (wear < leastWear))
+			{
+				leastWorn = start;
+				leastWear = wear;
+			}
+
+			// Only the ends of the stretch leave the rest of it in one piece.
+			if (((start == gapStart) || ((start + numBlocks) == gapEnd)) &&
+				((fit == FS_NUM_BLOCKS) || ((gapEnd - gapStart) < fitSize) ||
+				 (((gapEnd - gapStart) == fitSize) && (wear < fitWear))))
+			{
+				fit = start;
+				fitSize = gapEnd - gapStart;
+				fitWear = wear;
+			}
+		}
+
+		gapStart = gapEnd;
+	}
+
+	if ((fit != FS_NUM_BLOCKS) && (fitWear > (leastWear + FS_WEAR_MARGIN)))
+	{
+		fit = leastWorn;
+	}
+
+	if (fit == FS_NUM_BLOCKS)
+	{
+		status = false;
+	}
+
+	for (i = fit; (status == true) && (i < (fit + numBlocks)); i++)
+	{
+		status = PrepareBlock(i);
+	}
+
+	entry->firstBlock = fit;
+
+	return status;
+}
+
+/******************************************************************************
+ *	Local Functions (directory)
+ *****************************************************************************/
+
+/**
+ * @brief	Get the size of a type of record's body.
+ * @param	type - FS_RECORD_xxx
+ * @returns	size [bytes]
+ */
+static uint32_t GetBodySize(uint8_t type)
+{
+	uint32_t size = 0;					// return value
+
+	if (type == FS_RECORD_ENTRY)
+	{
+		size = sizeof(fsEntry_t);
+	}
+	else if (type == FS_RECORD_SIZE)
+	{
+		size = sizeof(uint32_t);
+	}
+
+	return size;
+}
+
+/**
+ * @brief	Get the size of a type of record.
+ * @param	type - FS_RECORD_xxx
+ * @returns	size [bytes]; 0 if the type isn't known
+ */
+static uint32_t GetRecordSize(uint8_t type)
+{
+	uint32_t size = 0;					// return value
+
+	if ((type == FS_RECORD_ENTRY) || (type == FS_RECORD_DELETE) || (type == FS_RECORD_SIZE))
+	{
+		size = RECORD_SIZE(GetBodySize(type));
+	}
+
+	return size;
+}
+
+/**
+ * @brief	Write a record to a directory block.
+ * @remarks	The flag is written last, so the record doesn't count until
+ *			it's all there.
+ * @param	addr - where to write it
+ * @param	type - FS_RECORD_xxx
+ * @param	slot - directory slot the record is about
+ * @param	body - body of the record
+ * @param	bodySize - size of the body [bytes]
+ * @returns	true for success; false otherwise
+ */
+static bool WriteRecord(uint32_t addr, uint8_t type, uint8_t slot, const void *body, uint32_t bodySize)
+{
+	uint8_t record[MAX_RECORD_SIZE];	// the record, assembled
+	fsRecordHeader_t *header = (fsRecordHeader_t *)record;
+	uint16_t crc;						// CRC of the record
+	uint32_t size = RECORD_SIZE(bodySize);	// size of the record
+	uint32_t i;							// counter
+	bool status;						// return value
+
+	for (i = 0; i < size; i++)
+	{
+		record[i] = 0xFF;
+	}
+
+	header->type = type;
+	header->slot = slot;
+	for (i = 0; i < bodySize; i++)
+	{
+		record[sizeof(fsRecordHeader_t) + i] = ((const uint8_t *)body)[i];
+	}
+
+	crc = Crc16Update(CRC16_START, &record[1], (uint16_t)(sizeof(fsRecordHeader_t) - 1 + bodySize));
+	record[sizeof(fsRecordHeader_t) + bodySize] = (uint8_t)crc;
+	record[sizeof(fsRecordHeader_t) + bodySize + 1] = (uint8_t)(crc >> 8);
+
+	// Write everything but the flag, then the flag.
+	status = DevWrite(addr + 1, &record[1], size - 1);
+	if (status == true)
+	{
+		header->flag = FS_FLAG_VALID;
+		status = DevWrite(addr, &header->flag, 1);
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Read a record from a directory block, and check it.
+ * @param	addr - where it is
+ * @param	record - returns the record (MAX_RECORD_SIZE bytes)
+ * @returns	true if it's complete and correct; false otherwise
+ */
+static bool ReadRecord(uint32_t addr, uint8_t *record)
+{
+	fsRecordHeader_t *header = (fsRecordHeader_t *)record;
+	uint32_t bodySize;					// size of the body [bytes]
+	uint16_t crc;						// CRC of the record
+	bool result = false;				// a pessimistic return value :(
+
+	DevRead(addr, record, sizeof(fsRecordHeader_t));
+	if (GetRecordSize(header->type) != 0)
+	{
+		DevRead(addr, record, GetRecordSize(header->type));
+		bodySize = GetBodySize(header->type);
+
+		crc = Crc16Update(CRC16_START, &record[1], (uint16_t)(sizeof(fsRecordHeader_t) - 1 + bodySize));
+		result = (header->flag == FS_FLAG_VALID) && (header->slot < FS_MAX_FILES) &&
+			(record[sizeof(fsRecordHeader_t) + bodySize] == (uint8_t)crc) &&
+			(record[sizeof(fsRecordHeader_t) + bodySize + 1] == (uint8_t)(crc >> 8));
+	}
+
+	return result;
+}
+
+/**
+ * @brief	Write the whole directory to the other directory block, and make
+ *			it the current one.
+ * @remarks	The block is marked as complete last, so if power is lost
+ *			partway through, the old block is still used.
+ * @param	slot - slot to change on the way (FS_MAX_FILES for none)
+ * @param	entry - its new entry (NULL to delete the file)
+ * @returns	true for success; false otherwise
+ */
+static bool CompactDirectory(uint8_t slot, const fsEntry_t *entry)
+{
+	uint16_t block = (mMetaBlock + 1) % FS_META_BLOCKS;	// block to write
+	uint32_t sequence = mMetaSequence + 1;	// its sequence number
+	uint32_t offset = sizeof(fsBlockHeader_t);	// where the next record goes
+	const fsEntry_t *oldEntry;			// entry being copied
+	uint8_t flag = FS_FLAG_VALID;		// marks the block as complete
+	uint8_t i;							// counter
+	bool status;						// an optimistic return value :)
+
+	status = PrepareBlock(block);
+
+	for (i = 0; (status == true) && (i < FS_MAX_FILES); i++)
+	{
+		oldEntry = (i == slot) ? entry : &mDirectory[i];
+		if ((oldEntry != NULL) && (oldEntry->numBlocks != 0))
+		{
+			status = WriteRecord(BLOCK_ADDR(block) + offset, FS_RECORD_ENTRY, i,
+				oldEntry, sizeof(fsEntry_t));
+			offset += RECORD_SIZE(sizeof(fsEntry_t));
+		}
+	}
+
+	if (status == true)
+	{
+		status = DevWrite(BLOCK_ADDR(block) + offsetof(fsBlockHeader_t, sequence),
+			(uint8_t *)&sequence, sizeof(sequence));
+	}
+
+	if (status == true)
+	{
+		status = DevWrite(BLOCK_ADDR(block) + offsetof(fsBlockHeader_t, flag), &flag, 1);
+	}
+
+	if (status == true)
+	{
+		mMetaBlock = block;
+		mMetaSequence = sequence;
+		mMetaOffset = offset;
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Save a change to a file's directory entry, in flash and in RAM.
+ * @remarks	If only the size changed (like after an append), just the size
+ *			is saved, in a smaller record.
+ * @param	slot - file's slot
+ * @param	entry - its new entry (NULL to delete the file)
+ * @returns	true for success; false otherwise
+ */
+static bool CommitEntry(uint8_t slot, const fsEntry_t *entry)
+{
+	fsEntry_t *oldEntry = &mDirectory[slot];	// the entry now
+	uint8_t type = FS_RECORD_DELETE;	// record to write
+	const void *body = NULL;			// its body
+	bool status;						// return value
+
+	if (entry != NULL)
+	{
+		type = FS_RECORD_ENTRY;
+		body = entry;
+		if ((oldEntry->numBlocks == entry->numBlocks) && (oldEntry->numBlocks != 0) &&
+			(oldEntry->firstBlock == entry->firstBlock) && (oldEntry->maxSize == entry->maxSize))
+		{
+			type = FS_RECORD_SIZE;
+			body = &entry->size;
+		}
+	}
+
+	if ((mMetaOffset + GetRecordSize(type)) <= FS_BLOCK_SIZE)
+	{
+		status = WriteRecord(BLOCK_ADDR(mMetaBlock) + mMetaOffset, type, slot,
+			body, GetBodySize(type));
+
+		// Even if it failed, some of it may have been written.
+		mMetaOffset += GetRecordSize(type);
+	}
+	else
+	{
+		status = CompactDirectory(slot, entry);
+	}
+
+	if (status == true)
+	{
+		if (entry != NULL)
+		{
+			mDirectory[slot] = *entry;
+		}
+		else
+		{
+			mDirectory[slot].numBlocks = 0;
+		}
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Save a file's new size.
+ * @param	slot - file's slot
+ * @param	size - its new size [bytes]
+ * @returns	true for success; false otherwise
+ */
+static bool CommitSize(uint8_t slot, uint32_t size)
+{
+	fsEntry_t newEntry = mDirectory[slot];	// entry with the new size
+
+	newEntry.size = size;
+
+	return CommitEntry(slot, &newEntry);
+}
+
+/**
+ * @brief	Load the directory from a directory block.
+ * @remarks	Replays the block's records in order.  The next record goes
+ *			after the last one that was started.
+ * @param	block - block to read
+ */
+static void LoadDirectory(uint16_t block)
+{
+	uint8_t record[MAX_RECORD_SIZE];	// a record
+	fsRecordHeader_t *header = (fsRecordHeader_t *)record;
+	uint32_t offset = sizeof(fsBlockHeader_t);	// where the record is
+	uint8_t i;							// counter
+
+	for (i = 0; i < FS_MAX_FILES; i++)
+	{
+		mDirectory[i].numBlocks = 0;
+	}
+
+	while ((offset + sizeof(fsRecordHeader_t)) <= FS_BLOCK_SIZE)
+	{
+		DevRead(BLOCK_ADDR(block) + offset, record, sizeof(fsRecordHeader_t));
+
+		// The type is written first, so if it's blank, nothing more is.
+		if (header->type == 0xFF)
+		{
+			break;
+		}
+
+		// If it's garbage, we can't tell where the next record is.  Don't
+		// add any more records to this block.
+		if ((GetRecordSize(header->type) == 0) ||
+			((offset + GetRecordSize(header->type)) > FS_BLOCK_SIZE))
+		{
+			offset = FS_BLOCK_SIZE;
+			break;
+		}
+
+		if (ReadRecord(BLOCK_ADDR(block) + offset, record) == true)
+		{
+			if (header->type == FS_RECORD_ENTRY)
+			{
+				mDirectory[header->slot] = *(fsEntry_t *)&record[sizeof(fsRecordHeader_t)];
+			}
+			else if (header->type == FS_RECORD_SIZE)
+			{
+				// (The size is first in an entry, too.)
+				mDirectory[header->slot].size = ((fsEntry_t *)&record[sizeof(fsRecordHeader_t)])->size;
+			}
+			else
+			{
+				mDirectory[header->slot].numBlocks = 0;
+			}
+		}
+
+		offset += GetRecordSize(header->type);
+	}
+
+	mMetaBlock = block;
+	mMetaOffset = offset;
+}
+
+/******************************************************************************
+ *	Local Functions (files)
+ *****************************************************************************/
+
+/**
+ * @brief	Find where a byte of a file is in the storage.
+ * @param	entry - file's entry
+ * @param	index - index of the byte in the file
+ * @returns	address of the byte
+ */
+static uint32_t GetDataAddr(const fsEntry_t *entry, uint32_t index)
+{
+	return DATA_ADDR(entry->firstBlock + (index / BLOCK_DATA_SIZE)) + (index % BLOCK_DATA_SIZE);
+}
+
+/**
+ * @brief	Get the number of bytes from an index to the end of its block.
+ * @param	index - index of a byte in a file
+ * @param	count - most bytes wanted
+ * @returns	count, or fewer if the block ends first
+ */
+static uint32_t GetPieceSize(uint32_t index, uint32_t count)
+{
+	uint32_t room = BLOCK_DATA_SIZE - (index % BLOCK_DATA_SIZE);	// return value
+
+	return (count < room) ? count : room;
+}
+
+/**
+ * @brief	Read bytes from a file.
+ * @param	entry - file's entry
+ * @param	index - index of the first byte
+ * @param	data - returns the bytes
+ * @param	count - number of bytes to read
+ */
+static void ReadData(const fsEntry_t *entry, uint32_t index, uint8_t *data, uint32_t count)
+{
+	uint32_t bytes;						// bytes read in one go
+
+	while (count > 0)
+	{
+		bytes = GetPieceSize(index, count);
+		DevRead(GetDataAddr(entry, index), data, bytes);
+
+		index += bytes;
+		data += bytes;
+		count -= bytes;
+	}
+}
+
+/**
+ * @brief	Write bytes to a file (which must be erased there).
+ * @param	entry - file's entry
+ * @param	index - index of the first byte
+ * @param	data - bytes to write
+ * @param	count - number of bytes to write
+ * @returns	true for success; false otherwise
+ */
+static bool WriteData(const fsEntry_t *entry, uint32_t index, const uint8_t *data, uint32_t count)
+{
+	uint32_t bytes;						// bytes written in one go
+	bool status = true;					// an optimistic return value :)
+
+	while ((status == true) && (count > 0))
+	{
+		bytes = GetPieceSize(index, count);
+		status = DevWrite(GetDataAddr(entry, index), data, bytes);
+
+		index += bytes;
+		data += bytes;
+		count -= bytes;
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Check whether bytes of a file are erased.
+ * @param	entry - file's entry
+ * @param	index - index of the first byte
+ * @param	count - number of bytes to check
+ * @returns	true if they all are; false otherwise
+ */
+static bool IsDataErased(const fsEntry_t *entry, uint32_t index, uint32_t count)
+{
+	uint32_t bytes;						// bytes checked in one go
+	bool result = true;					// an optimistic return value :)
+
+	while ((result == true) && (count > 0))
+	{
+		bytes = GetPieceSize(index, count);
+		result = DevIsErased(GetDataAddr(entry, index), bytes);
+
+		index += bytes;
+		count -= bytes;
+	}
+
+	return result;
+}
+
+/**
+ * @brief	Check whether bytes of a file already hold some data.
+ * @param	entry - file's entry
+ * @param	index - index of the first byte
+ * @param	data - data to compare with
+ * @param	count - number of bytes to compare
+ * @returns	true if they match; false otherwise
+ */
+static bool IsDataEqual(const fsEntry_t *entry, uint32_t index, const uint8_t *data, uint32_t count)
+{
+	uint8_t buffer[FS_COPY_SIZE];		// bytes from the file
+	uint32_t bytes;						// bytes compared in one go
+	uint32_t i;							// counter
+	bool result = true;					// an optimistic return value :)
+
+	while ((result == true) && (count > 0))
+	{
+		bytes = (count < FS_COPY_SIZE) ? count : FS_COPY_SIZE;
+		ReadData(entry, index, buffer, bytes);
+		for (i = 0; i < bytes; i++)
+		{
+			if (buffer[i] != data[i])
+			{
+				result = false;
+			}
+		}
+
+		index += bytes;
+		data += bytes;
+		count -= bytes;
+	}
+
+	return result;
+}
+
+/**
+ * @brief	Copy bytes from one extent to another.
+ * @param	from - entry of the file to copy from
+ * @param	to - entry of the file to copy to
+ * @param	index - index of the first byte (the same in both)
+ * @param	count - number of bytes to copy
+ * @returns	true for success; false otherwise
+ */
+static bool CopyData(const fsEntry_t *from, const fsEntry_t *to, uint32_t index, uint32_t count)
+{
+	uint8_t buffer[FS_COPY_SIZE];		// bytes being copied
+	uint32_t bytes;						// bytes copied in one go
+	bool status = true;					// an optimistic return value :)
+
+	while ((status == true) && (count > 0))
+	{
+		bytes = (count < FS_COPY_SIZE) ? count : FS_COPY_SIZE;
+		ReadData(from, index, buffer, bytes);
+		status = WriteData(to, index, buffer, bytes);
+
+		index += bytes;
+		count -= bytes;
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Change bytes that were already written, by copying the file to a
+ *			new extent with the change.
+ * @param	slot - file's slot
+ * @param	index - index of the first byte to change
+ * @param	data - new bytes
+ * @param	count - number of bytes
+ * @returns	true for success; false if there's no room, or error
+ */
+static bool RewriteFile(uint8_t slot, uint32_t index, const uint8_t *data, uint32_t count)
+{
+	fsEntry_t *oldEntry = &mDirectory[slot];	// where the file is now
+	fsEntry_t newEntry = *oldEntry;		// where it's going
+	uint32_t end = index + count;		// index after the change
+	bool status;						// an optimistic return value :)
+
+	status = AllocateExtent(&newEntry);
+
+	if (status == true)
+	{
+		status = CopyData(oldEntry, &newEntry, 0, index);
+	}
+
+	if (status == true)
+	{
+		status = WriteData(&newEntry, index, data, count);
+	}
+
+	if ((status == true) && (end < oldEntry->size))
+	{
+		status = CopyData(oldEntry, &newEntry, end, oldEntry->size - end);
+	}
+
+	// Switch to the new copy.
+	if (status == true)
+	{
+		if (end > newEntry.size)
+		{
+			newEntry.size = end;
+		}
+
+		status = CommitEntry(slot, &newEntry);
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Find where the next byte appended to a file goes.
+ * @param	slot - file's slot
+ */
+static void SetTail(uint8_t slot)
+{
+	mTail[slot].addr = GetDataAddr(&mDirectory[slot], mDirectory[slot].size);
+	mTail[slot].room = (uint16_t)GetPieceSize(mDirectory[slot].size, BLOCK_DATA_SIZE);
+}
+
+/**
+ * @brief	Write appended bytes that end at a file's tail.
+ * @remarks	They might not be erased if power was lost during an earlier
+ *			append.  Then the file is copied with them instead.
+ * @param	slot - file's slot
+ * @param	index - index of the first byte in the file
+ * @param	data - bytes to write
+ * @param	count - number of bytes to write (all in the tail's block)
+ * @returns	true for success; false if there's no room to copy it, or error
+ */
+static bool WriteAppend(uint8_t slot, uint32_t index, const uint8_t *data, uint32_t count)
+{
+	uint32_t addr = mTail[slot].addr - count;	// where the bytes go
+	bool status;						// an optimistic return value :)
+
+	status = DevIsErased(addr, count) && DevWrite(addr, data, count);
+	if (status == false)
+	{
+		status = RewriteFile(slot, index, data, count);
+		SetTail(slot);
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Write the bytes waiting in the append buffer, and save the file's
+ *			new size.
+ * @returns	true for success; false if there's no room, or error
+ */
+static bool FlushAppend(void)
+{
+	bool status = true;					// an optimistic return value :)
+
+#if (FS_APPEND_BUFFER > 0)
+	uint8_t slot = mAppendSlot;			// file being appended to
+	uint32_t size;						// its size, with the bytes
+
+	if ((slot != FS_MAX_FILES) && (mAppendCount > 0))
+	{
+		size = mDirectory[slot].size + mAppendCount;
+		status = WriteAppend(slot, mDirectory[slot].size, mAppendBuffer, mAppendCount);
+		if ((status == true) && (size > mDirectory[slot].size))
+		{
+			status = CommitSize(slot, size);
+		}
+
+		if (status == false)
+		{
+			SetTail(slot);
+		}
+
+		mAppendCount = 0;
+	}
+#endif
+
+	mAppendSlot = FS_MAX_FILES;
+
+	return status;
+}
+
+/**
+ * @brief	Append bytes to a file.
+ * @remarks	The file's tail is kept, so this doesn't look anything up.  Bytes
+ *			are collected in the append buffer, and written when it fills up
+ *			(at an FS_APPEND_BUFFER boundary in the storage, so it's one
+ *			block write), or at the end of a block.  The size is saved once,
+ *			after the bytes that were written.
+ * @param	slot - file's slot
+ * @param	data - bytes to append
+ * @param	count - number of bytes (which must fit)
+ * @returns	true for success; false if there's no room to copy it, or error
+ */
+static bool AppendFile(uint8_t slot, const uint8_t *data, uint32_t count)
+{
+	fsTail_t *tail = &mTail[slot];		// where the bytes go
+	uint32_t size = mDirectory[slot].size;	// size, with the bytes written
+	uint32_t bytes;						// bytes appended in one go
+	bool status = true;					// an optimistic return value :)
+
+#if (FS_APPEND_BUFFER > 0)
+	uint32_t i;							// counter
+
+	// Only one file's bytes can wait in the buffer.
+	if (mAppendSlot != slot)
+	{
+		status = FlushAppend();
+		mAppendSlot = slot;
+	}
+#endif
+
+	while ((status == true) && (count > 0))
+	{
+		bytes = (count < tail->room) ? count : tail->room;
+#if (FS_APPEND_BUFFER > 0)
+		if (bytes > (FS_APPEND_BUFFER - (tail->addr % FS_APPEND_BUFFER)))
+		{
+			bytes = FS_APPEND_BUFFER - (tail->addr % FS_APPEND_BUFFER);
+		}
+
+		for (i = 0; i < bytes; i++)
+		{
+			mAppendBuffer[mAppendCount + i] = data[i];
+		}
+		mAppendCount += (uint16_t)bytes;
+		tail->addr += bytes;
+		tail->room -= (uint16_t)bytes;
+
+		if (((tail->addr % FS_APPEND_BUFFER) == 0) || (tail->room == 0))
+		{
+			status = WriteAppend(slot, size, mAppendBuffer, mAppendCount);
+			size += mAppendCount;
+			mAppendCount = 0;
+		}
+#else
+		tail->addr += bytes;
+		tail->room -= (uint16_t)bytes;
+		status = WriteAppend(slot, size, data, bytes);
+		size += bytes;
+#endif
+
+		// Move on to the next block.
+		if (tail->room == 0)
+		{
+			tail->addr += sizeof(fsBlockHeader_t);
+			tail->room = BLOCK_DATA_SIZE;
+		}
+
+		data += bytes;
+		count -= bytes;
+	}
+
+	if ((status == true) && (size > mDirectory[slot].size))
+	{
+		status = CommitSize(slot, size);
+	}
+
+	// If it failed, we don't know what was written.  Start again from the end
+	// of the file.
+	if (status == false)
+	{
+#if (FS_APPEND_BUFFER > 0)
+		mAppendCount = 0;
+#endif
+		SetTail(slot);
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Write the bytes waiting to be appended to a file, if any.
+ * @param	slot - file's slot
+ * @returns	true for success; false if there's no room, or error
+ */
+static bool FlushFile(uint8_t slot)
+{
+	bool status = true;					// an optimistic return value :)
+
+	if ((slot != FS_MAX_FILES) && (mAppendSlot == slot))
+	{
+		status = FlushAppend();
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Throw away the bytes waiting to be appended.
+ */
+static void DropAppend(void)
+{
+#if (FS_APPEND_BUFFER > 0)
+	mAppendCount = 0;
+#endif
+	mAppendSlot = FS_MAX_FILES;
+}
+
+/**
+ * @brief	Check a file name, and find the file with that name.
+ * @param	fileNamePtr - name to look for
+ * @param	slot - returns its slot (FS_MAX_FILES if there's no such file)
+ * @returns	true if the name is valid; false otherwise
+ */
+static bool FindFile(const char *fileNamePtr, uint8_t *slot)
+{
+	uint8_t length = 0;					// length of the name
+	uint8_t i;							// counter
+	uint8_t j;							// counter
+	bool result = true;					// an optimistic return value :)
+
+	while ((length <= FS_NAME_SIZE) && (fileNamePtr[length] != '\0'))
+	{
+		length++;
+	}
+
+	if ((length == 0) || (length > FS_NAME_SIZE))
+	{
+		result = false;
+	}
+
+	*slot = FS_MAX_FILES;
+	for (i = 0; (result == true) && (i < FS_MAX_FILES) && (*slot == FS_MAX_FILES); i++)
+	{
+		if (mDirectory[i].numBlocks == 0)
+		{
+			continue;
+		}
+
+		for (j = 0; (j < length) && (mDirectory[i].name[j] == fileNamePtr[j]); j++)
+		{
+		}
+
+		if ((j == length) && ((length == FS_NAME_SIZE) || (mDirectory[i].name[length] == '\0')))
+		{
+			*slot = i;
+		}
+	}
+
+	return result;
+}
+
+/**
+ * @brief	Find the newest complete directory block.
+ * @remarks	Compares sequence numbers so that rollover doesn't matter.
+ * @param	block - returns the block
+ * @returns	true if there is one; false if there's no file system
+ */
+static bool FindDirectory(uint16_t *block)
+{
+	fsBlockHeader_t header[FS_META_BLOCKS];	// directory blocks' headers
+	bool valid[FS_META_BLOCKS];			// which are complete
+	uint8_t i;							// counter
+
+	for (i = 0; i < FS_META_BLOCKS; i++)
+	{
+		DevRead(BLOCK_ADDR(i), (uint8_t *)&header[i], sizeof(fsBlockHeader_t));
+		valid[i] = (header[i].flag == FS_FLAG_VALID);
+	}
+
+	*block = valid[0] ? 0 : 1;
+	if (valid[0] && valid[1] && ((int32_t)(header[1].sequence - header[0].sequence) > 0))
+	{
+		*block = 1;
+	}
+
+	mMetaSequence = header[*block].sequence;
+
+	return (valid[0] || valid[1]);
+}
+
+/**
+ * @brief	Check that a file handle is for an open file.
+ * @param	fileHandle - handle to check
+ * @returns	true if it is; false otherwise
+ */
+static bool IsOpen(file_t fileHandle)
+{
+	return (fileHandle < FS_MAX_FILES) && (mOpenMode[fileHandle] != FS_CLOSED) &&
+		(mDirectory[fileHandle].numBlocks != 0);
+}
+
+/******************************************************************************
+ *	Public functions
+ *****************************************************************************/
+
+/**
+ * @brief	Find the files after a reset.
+ * @remarks	If there's no file system, makes an empty one.  On a PC, open
+ *			simulated flash (or FRAM) first, or use FileImageOpen.
+ * @returns	FILE_RESULT_OK for success; FILE_RESULT_FAIL otherwise
+ */
+fileErr_t FileInit(void)
+{
+	uint16_t block;						// directory block to use
+	uint8_t i;							// counter
+	fileErr_t result = FILE_RESULT_OK;	// an optimistic return value :)
+
+	for (i = 0; i < FS_MAX_FILES; i++)
+	{
+		mOpenMode[i] = FS_CLOSED;
+	}
+
+	ClearCache();
+	DropAppend();
+
+	if (FindDirectory(&block) == true)
+	{
+		LoadDirectory(block);
+	}
+	else
+	{
+		result = FileFormat();
+	}
+
+	return result;
+}
+
+/**
+ * @brief	Delete every file.
+ * @returns	FILE_RESULT_OK for success; FILE_RESULT_FAIL otherwise
+ */
+fileErr_t FileFormat(void)
+{
+	uint8_t i;							// counter
+	fileErr_t result = FILE_RESULT_OK;	// an optimistic return value :)
+
+	for (i = 0; i < FS_MAX_FILES; i++)
+	{
+		mDirectory[i].numBlocks = 0;
+		mOpenMode[i] = FS_CLOSED;
+	}
+
+	DropAppend();
+
+	if (CompactDirectory(FS_MAX_FILES, NULL) == false)
+	{
+		result = FILE_RESULT_FAIL;
+	}
+
+	return result;
+}
+
+/**
+ * @brief	Open a file.
+ * @remarks	FILE_MODE_CREATE makes a new, empty file (replacing any file
+ *			with the same name) that can hold maxSize bytes.  The other
+ *			modes open a file that already exists, and ignore maxSize.
+ *			FILE_MODE_APPEND writes always go at the end of the file.
+ * @param	fileNamePtr - name of the file
+ * @param	mode - how to open it
+ * @param	maxSize - most it can hold [bytes] (FILE_MODE_CREATE only)
+ * @param	fileHandle - returns a handle to access the file with
+ * @returns	FILE_RESULT_OK for success; FILE_RESULT_INVALID_SELECTION if the
+ *			name is bad, or there's no such file; FILE_RESULT_FAIL if there's
+ *			no room, or error
+ */
+fileErr_t FileOpen(char *fileNamePtr, fileMode_t mode, uint32_t maxSize, file_t *fileHandle)
+{
+	fsEntry_t newEntry;					// entry for a new file
+	uint8_t slot;						// file's slot
+	uint8_t i;							// counter
+	fileErr_t result = FILE_RESULT_OK;	// an optimistic return value :)
+
+	if (FindFile(fileNamePtr, &slot) == false)
+	{
+		result = FILE_RESULT_INVALID_SELECTION;
+	}
+	else if (FlushFile(slot) == false)
+	{
+		result = FILE_RESULT_FAIL;
+	}
+	else if (mode == FILE_MODE_CREATE)
+	{
+		// Use a free slot, unless the file is being replaced.
+		for (i = 0; (slot == FS_MAX_FILES) && (i < FS_MAX_FILES); i++)
+		{
+			if (mDirectory[i].numBlocks == 0)
+			{
+				slot = i;
+			}
+		}
+
+		if ((maxSize == 0) || (maxSize > ((uint32_t)(FS_NUM_BLOCKS - FS_META_BLOCKS) * BLOCK_DATA_SIZE)))
+		{
+			result = FILE_RESULT_INVALID_SELECTION;
+		}
+		else if (slot == FS_MAX_FILES)
+		{
+			result = FILE_RESULT_FAIL;
+		}
+		else
+		{
+			for (i = 0; i < FS_NAME_SIZE; i++)
+			{
+				newEntry.name[i] = fileNamePtr[i];
+				if (fileNamePtr[i] == '\0')
+				{
+					break;
+				}
+			}
+			for (; i < FS_NAME_SIZE; i++)
+			{
+				newEntry.name[i] = '\0';
+			}
+
+			newEntry.size = 0;
+			newEntry.maxSize = maxSize;
+			newEntry.numBlocks = (uint16_t)((maxSize + BLOCK_DATA_SIZE - 1) / BLOCK_DATA_SIZE);
+
+			if ((AllocateExtent(&newEntry) == false) ||
+				(CommitEntry(slot, &newEntry) == false))
+			{
+				result = FILE_RESULT_FAIL;
+			}
+		}
+	}
+	else if (slot == FS_MAX_FILES)
+	{
+		result = FILE_RESULT_INVALID_SELECTION;
+	}
+
+	if (result == FILE_RESULT_OK)
+	{
+		mOpenMode[slot] = (uint8_t)mode;
+		SetTail(slot);
+		*fileHandle = slot;
+	}
+
+	return result;
+}
+
+/**
+ * @brief	Close a file, after writing any bytes waiting to be appended.
+ * @param	fileHandle - file to close
+ * @returns	FILE_RESULT_OK for success; FILE_RESULT_INVALID_SELECTION if it
+ *			isn't open; FILE_RESULT_FAIL if the waiting bytes couldn't be
+ *			written (it's closed anyway)
+ */
+fileErr_t FileClose(file_t fileHandle)
+{
+	fileErr_t result = FILE_RESULT_OK;	// an optimistic return value :)
+
+	if (IsOpen(fileHandle) == false)
+	{
+		result = FILE_RESULT_INVALID_SELECTION;
+	}
+	else
+	{
+		if (FlushFile(fileHandle) == false)
+		{
+			result = FILE_RESULT_FAIL;
+		}
+
+		mOpenMode[fileHandle] = FS_CLOSED;
+	}
+
+	return result;
+}
+
+/**
+ * @brief	Write any bytes waiting to be appended to a file.
+ * @remarks	Appends (with FS_APPEND_BUFFER) wait in RAM until there's a
+ *			block write's worth.  Call this to make sure they survive a
+ *			power cut.
+ * @param	fileHandle - file to flush
+ * @returns	FILE_RESULT_OK for success; FILE_RESULT_INVALID_SELECTION if it
+ *			isn't open; FILE_RESULT_FAIL if there's no room, or error
+ */
+fileErr_t FileFlush(file_t fileHandle)
+{
+	fileErr_t result = FILE_RESULT_OK;	// an optimistic return value :)
+
+	if (IsOpen(fileHandle) == false)
+	{
+		result = FILE_RESULT_INVALID_SELECTION;
+	}
+	else if (FlushFile(fileHandle) == false)
+	{
+		result = FILE_RESULT_FAIL;
+	}
+
+	return result;
+}
+
+/**
+ * @brief	Read bytes from a file.
+ * @param	fileHandle - file to read
+ * @param	index - index of the first byte
+ * @param	data - returns the bytes
+ * @param	numData - number of bytes to read
+ * @remarks	Bytes waiting to be appended to the file are written first.
+ * @returns	FILE_RESULT_OK for success; FILE_RESULT_INVALID_SELECTION if the
+ *			file isn't open, or the bytes are past its end; FILE_RESULT_FAIL
+ *			if the waiting bytes couldn't be written
+ */
+fileErr_t FileRead(file_t fileHandle, uint32_t index, uint8_t *data, uint32_t numData)
+{
+	fileErr_t result = FILE_RESULT_OK;	// an optimistic return value :)
+
+	if (IsOpen(fileHandle) == false)
+	{
+		result = FILE_RESULT_INVALID_SELECTION;
+	}
+	else if (FlushFile(fileHandle) == false)
+	{
+		result = FILE_RESULT_FAIL;
+	}
+	else if ((index > mDirectory[fileHandle].size) || (numData > (mDirectory[fileHandle].size - index)))
+	{
+		result = FILE_RESULT_INVALID_SELECTION;
+	}
+	else
+	{
+		ReadData(&mDirectory[fileHandle], index, data, numData);
+	}
+
+	return result;
+}
+
+/**
+ * @brief	Write bytes to a file.
+ * @remarks	Writing at the end of the file (or past bytes that don't change)
+ *			is quick.  Changing bytes that were already written copies the
+ *			whole file, so it needs a run of free blocks as big as the file
+ *			(the whole run, not just as many blocks free in total).  A power
+ *			cut leaves the file as it was before.
+ *			In FILE_MODE_APPEND, writes are quicker still (see AppendFile),
+ *			but bytes wait in RAM until there's a block write's worth (see
+ *			FS_APPEND_BUFFER and FileFlush).  A power cut loses the bytes
+ *			that were waiting, and leaves the rest.
+ * @param	fileHandle - file to write
+ * @param	index - index of the first byte (no more than the file's size;
+ *			ignored in FILE_MODE_APPEND)
+ * @param	data - bytes to write
+ * @param	numData - number of bytes to write
+ * @returns	FILE_RESULT_OK for success; FILE_RESULT_INVALID_SELECTION if the
+ *			file isn't open for writing, or the bytes don't fit;
+ *			FILE_RESULT_FAIL if there's no room to copy it, or error
+ */
+fileErr_t FileWrite(file_t fileHandle, uint32_t index, uint8_t *data, uint32_t numData)
+{
+	fsEntry_t *entry;					// file's entry
+	uint32_t overlap = 0;				// bytes already in the file
+	bool status;						// an optimistic return value :)
+	fileErr_t result = FILE_RESULT_INVALID_SELECTION;
+
+	if ((IsOpen(fileHandle) == true) && (mOpenMode[fileHandle] != FILE_MODE_READ))
+	{
+		entry = &mDirectory[fileHandle];
+		if (mOpenMode[fileHandle] == FILE_MODE_APPEND)
+		{
+			index = entry->size;
+#if (FS_APPEND_BUFFER > 0)
+			if (mAppendSlot == fileHandle)
+			{
+				index += mAppendCount;
+			}
+#endif
+		}
+
+		// (Appended bytes that are waiting go past the end of the file.)
+		if (((index <= entry->size) || (mOpenMode[fileHandle] == FILE_MODE_APPEND)) &&
+			(numData <= (entry->maxSize - index)))
+		{
+			result = FILE_RESULT_OK;
+		}
+	}
+
+	if ((result == FILE_RESULT_OK) && (numData > 0))
+	{
+		if (mOpenMode[fileHandle] == FILE_MODE_APPEND)
+		{
+			status = AppendFile(fileHandle, data, numData);
+		}
+		else
+		{
+			if (index < entry->size)
+			{
+				overlap = entry->size - index;
+				if (overlap > numData)
+				{
+					overlap = numData;
+				}
+			}
+
+			// If the bytes already in the file don't change, and the rest are
+			// erased, write the rest in place.  (They might not be erased if
+			// power was lost during an earlier write.)
+			status = IsDataEqual(entry, index, data, overlap) &&
+				IsDataErased(entry, index + overlap, numData - overlap);
+			if (status == true)
+			{
+				status = WriteData(entry, index + overlap, data + overlap, numData - overlap);
+			}
+
+			if ((status == true) && ((index + numData) > entry->size))
+			{
+				status = CommitSize(fileHandle, index + numData);
+			}
+
+			// Otherwise, copy the file with the change.
+			else if (status == false)
+			{
+				status = RewriteFile(fileHandle, index, data, numData);
+			}
+		}
+
+		if (status == false)
+		{
+			result = FILE_RESULT_FAIL;
+		}
+	}
+
+	return result;
+}
+
+/**
+ * @brief	Find out about a file.
+ * @param	fileNamePtr - name of the file
+ * @param	info - returns whether it exists (status = 1), and its sizes
+ *			(counting bytes waiting to be appended)
+ * @returns	FILE_RESULT_OK for success; FILE_RESULT_INVALID_SELECTION if the
+ *			name is bad
+ */
+fileErr_t FileSearch(char *fileNamePtr, fileInfo_t *info)
+{
+	uint8_t slot;						// file's slot
+	fileErr_t result = FILE_RESULT_OK;	// an optimistic return value :)
+
+	info->status = 0;
+	info->size = 0;
+	info->maxSize = 0;
+
+	if (FindFile(fileNamePtr, &slot) == false)
+	{
+		result = FILE_RESULT_INVALID_SELECTION;
+	}
+	else if (slot != FS_MAX_FILES)
+	{
+		info->status = 1;
+		info->size = mDirectory[slot].size;
+		info->maxSize = mDirectory[slot].maxSize;
+#if (FS_APPEND_BUFFER > 0)
+		if (mAppendSlot == slot)
+		{
+			info->size += mAppendCount;
+		}
+#endif
+	}
+
+	return result;
+}
+
+/**
+ * @brief	Find out about the file in a directory slot, to list the files.
+ * @param	index - slot to look at (0 to FS_MAX_FILES - 1)
+ * @param	namePtr - returns the file's name (with a '\0' at the end)
+ * @param	nameSize - size of namePtr [bytes] (FS_NAME_SIZE + 1 fits any
+ *			name; a longer name is cut short)
+ * @param	info - returns whether there's a file (status = 1), and its sizes
+ *			(counting bytes waiting to be appended)
+ * @returns	FILE_RESULT_OK for success; FILE_RESULT_INVALID_SELECTION if
+ *			there's no such slot (so there are no more files)
+ */
+fileErr_t FileList(uint8_t index, char *namePtr, uint8_t nameSize, fileInfo_t *info)
+{
+	uint8_t i;							// counter
+	fileErr_t result = FILE_RESULT_OK;	// an optimistic return value :)
+
+	info->status = 0;
+	info->size = 0;
+	info->maxSize = 0;
+
+	if ((index >= FS_MAX_FILES) || (nameSize == 0))
+	{
+		result = FILE_RESULT_INVALID_SELECTION;
+	}
+	else
+	{
+		for (i = 0; (i < (nameSize - 1)) && (i < FS_NAME_SIZE) &&
+			(mDirectory[index].numBlocks != 0) && (mDirectory[index].name[i] != '\0'); i++)
+		{
+			namePtr[i] = mDirectory[index].name[i];
+		}
+		namePtr[i] = '\0';
+
+		if (mDirectory[index].numBlocks != 0)
+		{
+			info->status = 1;
+			info->size = mDirectory[index].size;
+			info->maxSize = mDirectory[index].maxSize;
+#if (FS_APPEND_BUFFER > 0)
+			if (mAppendSlot == index)
+			{
+				info->size += mAppendCount;
+			}
+#endif
+		}
+	}
+
+	return result;
+}
+
+/**
+ * @brief	Check that the file system makes sense.
+ * @remarks	Checks each file's entry (its extent is in the storage and
+ *			doesn't overlap another, and its sizes fit), and counts the
+ *			records in the directory block that are incomplete or damaged.
+ *			Some can be left by power cuts, and are ignored, so they don't
+ *			make it fail.
+ * @param	check - returns what was found
+ * @returns	FILE_RESULT_OK if every entry makes sense; FILE_RESULT_FAIL
+ *			otherwise
+ */
+fileErr_t FileCheck(fileCheck_t *check)
+{
+	uint8_t record[MAX_RECORD_SIZE];	// a directory record
+	fsRecordHeader_t *header = (fsRecordHeader_t *)record;
+	fsEntry_t *entry;					// a file's entry
+	fsEntry_t *other;					// another file's entry
+	uint32_t offset;					// where a record is
+	uint32_t eraseCount;				// times a block has been erased
+	uint16_t usedBlocks = 0;			// blocks in files' extents
+	uint8_t i;							// counter
+	uint8_t j;							// counter
+	bool valid;							// does an entry make sense?
+	fileErr_t result = FILE_RESULT_OK;	// an optimistic return value :)
+
+	check->files = 0;
+	check->badFiles = 0;
+	check->badRecords = 0;
+	check->maxEraseCount = 0;
+
+	for (i = 0; i < FS_MAX_FILES; i++)
+	{
+		entry = &mDirectory[i];
+		if (entry->numBlocks == 0)
+		{
+			continue;
+		}
+
+		valid = (entry->firstBlock >= FS_META_BLOCKS) &&
+			((entry->firstBlock + entry->numBlocks) <= FS_NUM_BLOCKS) &&
+			(entry->numBlocks == ((entry->maxSize + BLOCK_DATA_SIZE - 1) / BLOCK_DATA_SIZE)) &&
+			(entry->size <= entry->maxSize) && (entry->name[0] != '\0');
+
+		for (j = 0; j < FS_MAX_FILES; j++)
+		{
+			other = &mDirectory[j];
+			if ((j != i) && (other->numBlocks != 0) &&
+				(other->firstBlock < (entry->firstBlock + entry->numBlocks)) &&
+				(entry->firstBlock < (other->firstBlock + other->numBlocks)))
+			{
+				valid = false;
+			}
+		}
+
+		check->files++;
+		usedBlocks += entry->numBlocks;
+		if (valid == false)
+		{
+			check->badFiles++;
+			result = FILE_RESULT_FAIL;
+		}
+	}
+
+	check->freeBlocks = (usedBlocks < (FS_NUM_BLOCKS - FS_META_BLOCKS)) ?
+		(FS_NUM_BLOCKS - FS_META_BLOCKS - usedBlocks) : 0;
+
+	// Go through the records, the way LoadDirectory did.
+	offset = sizeof(fsBlockHeader_t);
+	while (offset < mMetaOffset)
+	{
+		DevRead(BLOCK_ADDR(mMetaBlock) + offset, record, sizeof(fsRecordHeader_t));
+		if ((GetRecordSize(header->type) == 0) ||
+			((offset + GetRecordSize(header->type)) > FS_BLOCK_SIZE))
+		{
+			check->badRecords++;
+			break;
+		}
+
+		if (ReadRecord(BLOCK_ADDR(mMetaBlock) + offset, record) == false)
+		{
+			check->badRecords++;
+		}
+
+		offset += GetRecordSize(header->type);
+	}
+
+	for (i = 0; i < FS_NUM_BLOCKS; i++)
+	{
+		eraseCount = GetEraseCount(i);
+		if (eraseCount > check->maxEraseCount)
+		{
+			check->maxEraseCount = eraseCount;
+		}
+	}
+
+	return result;
+}
+
+/**
+ * @brief	Delete a file (which closes it, and throws away bytes waiting to
+ *			be appended).
+ * @param	fileHandle - file to delete
+ * @returns	FILE_RESULT_OK for success; FILE_RESULT_INVALID_SELECTION if it
+ *			isn't open; FILE_RESULT_FAIL otherwise
+ */
+fileErr_t FileDelete(file_t fileHandle)
+{
+	fileErr_t result = FILE_RESULT_OK;	// an optimistic return value :)
+
+	if (IsOpen(fileHandle) == false)
+	{
+		result = FILE_RESULT_INVALID_SELECTION;
+	}
+	else if (CommitEntry(fileHandle, NULL) == false)
+	{
+		result = FILE_RESULT_FAIL;
+	}
+	else
+	{
+		if (mAppendSlot == fileHandle)
+		{
+			DropAppend();
+		}
+
+		mOpenMode[fileHandle] = FS_CLOSED;
+	}
+
+	return result;
+}
+
+/**
+ * @brief	Get how well the read cache is working.
+ * @remarks	Without a cache (FS_CACHE_LINES = 0), every read of the storage
+ *			counts as a miss.
+ * @param	stats - returns the statistics
+ */
+void FileGetCacheStats(fileCacheStats_t *stats)
+{
+	*stats = mCacheStats;
+}
+
+/**
+ * @brief	Reset the read cache's statistics.
+ */
+void FileResetCacheStats(void)
+{
+	mCacheStats.hits = 0;
+	mCacheStats.misses = 0;
+	mCacheStats.readAheads = 0;
+}
+
+#ifdef __linux__
+/**
+ * @brief	Open a file that holds the storage, on a PC, and find the files
+ *			in it.
+ * @remarks	The file is mapped into memory, so changes are saved in it (see
+ *			FlashMemImageOpen, or FramImageOpen).  It's made big enough for
+ *			the settings this was compiled with, so an image must be used
+ *			with the same settings as the code that made it.  Unlike
+ *			FileInit, this doesn't make a new file system if there isn't
+ *			one; the image stays open, so FileFormat can make one.
+ * @param	path - name of the file (for flash, NULL keeps it in RAM)
+ * @returns	FILE_RESULT_OK for success; FILE_RESULT_INVALID_SELECTION if
+ *			there's no file system in it; FILE_RESULT_FAIL if it couldn't be
+ *			opened
+ */
+fileErr_t FileImageOpen(const char *path)
+{
+	uint16_t block;						// directory block to use
+	fileErr_t result = FILE_RESULT_OK;	// an optimistic return value :)
+
+#if (FS_DEVICE == FS_DEVICE_FLASH)
+	uint32_t size = FS_FLASH_OFFSET + STORAGE_SIZE;	// size of the image
+
+	// Flash is erased a segment at a time.
+	size = ((size + FLASH_SEGMENT_SIZE - 1) / FLASH_SEGMENT_SIZE) * FLASH_SEGMENT_SIZE;
+	if (FlashMemImageOpen(path, size) == false)
+#else
+	if (FramImageOpen(path, FS_FRAM_BASE + STORAGE_SIZE) == false)
+#endif
+	{
+		result = FILE_RESULT_FAIL;
+	}
+	else
+	{
+		ClearCache();
+		if (FindDirectory(&block) == false)
+		{
+			result = FILE_RESULT_INVALID_SELECTION;
+		}
+		else
+		{
+			result = FileInit();
+		}
+	}
+
+	return result;
+}
+
+/**
+ * @brief	Write any bytes waiting to be appended, and close the image.
+ */
+void FileImageClose(void)
+{
+	FlushAppend();
+
+#if (FS_DEVICE == FS_DEVICE_FLASH)
+	FlashMemImageClose();
+#else
+	FramImageClose();
+#endif
+}
+#endif
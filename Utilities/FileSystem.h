@@ -5,6 +5,9 @@
  *	Author:			Adam Johnson
  *
  *	Description:	Implements a fancy file system on your microcontroller.
+ *					Files are kept in flash (or FRAM); see FileSystem.c for
+ *					how, and for the settings.  Call FileInit before anything
+ *					else.
  *
  *****************************************************************************/
 
@@ -34,16 +37,45 @@ typedef struct							// holds info about a file
 	uint32_t maxSize;					// size allocated to file [bytes]
 } fileInfo_t;
 
-typedef file_t	uint8_t;				// defines size of a file handle
+typedef struct							// how well the read cache is working
+{
+	uint32_t hits;						// reads of a line that was cached
+	uint32_t misses;					// reads that went to the storage
+	uint32_t readAheads;				// lines read ahead of time
+} fileCacheStats_t;
+
+typedef struct							// what FileCheck found
+{
+	uint8_t files;						// number of files
+	uint8_t badFiles;					// files whose entries don't make sense
+	uint16_t badRecords;				// directory records cut short, or damaged
+	uint16_t freeBlocks;				// blocks no file is using
+	uint32_t maxEraseCount;				// most times a block has been erased
+} fileCheck_t;
+
+typedef uint8_t file_t;					// defines size of a file handle
 										// This is used to access any file once
 										// it's opened.
 
+fileErr_t FileInit(void);
+fileErr_t FileFormat(void);
 fileErr_t FileOpen(char *fileNamePtr, fileMode_t mode, uint32_t maxSize, file_t *fileHandle);
 fileErr_t FileClose(file_t fileHandle);
+fileErr_t FileFlush(file_t fileHandle);
 fileErr_t FileRead(file_t fileHandle, uint32_t index, uint8_t *data, uint32_t numData);
 fileErr_t FileWrite(file_t fileHandle, uint32_t index, uint8_t *data, uint32_t numData);
 fileErr_t FileSearch(char *fileNamePtr, fileInfo_t *info);
 fileErr_t FileDelete(file_t fileHandle);
+fileErr_t FileList(uint8_t index, char *namePtr, uint8_t nameSize, fileInfo_t *info);
+fileErr_t FileCheck(fileCheck_t *check);
+void FileGetCacheStats(fileCacheStats_t *stats);
+void FileResetCacheStats(void);
+
+#ifdef __linux__
+// On Linux, the storage is kept in a file (an image).
+fileErr_t FileImageOpen(const char *path);
+void FileImageClose(void);
+#endif
 
 #ifdef INCLUDE_TEST
 uint8_t FileTest(void);					// Test the file system library.
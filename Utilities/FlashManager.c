@@ -1,154 +1,672 @@
 /******************************************************************************
  * @file	FlashManager.c
  * @author	Adam Johnson
- * @remarks	Contains functions for EEPROM emulation using two pages of
- *			Flash memory.  Based on code from NXP's app note AN11008,
- *			titled "Flash based non-volatile storage."  Originally
- *			developed for MSP430.
+ * @remarks	Contains functions for EEPROM emulation using sectors of Flash
+ *			memory.  Based on code from NXP's app note AN11008, titled
+ *			"Flash based non-volatile storage."  Originally developed for
+ *			MSP430.
+ *
+ *			Records are appended to one sector at a time (the "head").  When
+ *			it fills up, the next erased sector becomes the head.  To keep an
+ *			erased sector in reserve, garbage collection copies the current
+ *			records out of the sector with the least current data, and then
+ *			erases it.  Each sector's header holds its erase count, which is
+ *			used to spread erases evenly across the sectors.
+ *
+ *			FlashManGetStats reports how hard the flash has been worked.
+ *			The totals are saved in each sector's header when it becomes
+ *			the head, and what's been written to the head since then is
+ *			counted again at startup, so they last for the life of the
+ *			flash.
+ *
+ *			Garbage collection can be done a little at a time (see
+ *			FLASH_GC_INCREMENTAL), so no single set has to wait for a whole
+ *			sector to be copied and erased.
+ *
+ *			Each head sector can start with a checkpoint of where every
+ *			variable is (see CHECKPOINT_ENTRIES).  Then FlashManInit only
+ *			has to check the records the checkpoint points to and the ones
+ *			written to the head since, instead of every record in flash.
+ *
+ *			Variables that change every few seconds can be cached in RAM
+ *			(see FlashManCacheVariable), so only their latest value is
+ *			written, when the cache is flushed.
  *****************************************************************************/
 
 #include <stdint.h>						// standard-size types
 #include <stdbool.h>					// defines "bool" type
+#include <stddef.h>						// defines "NULL", "offsetof"
 #include "Flash.h"						// device specific Flash functions
+#include "Crc.h"						// CRC-16 and CRC-32
 #include "FlashManager.h"				// header for this module
 
 /******************************************************************************
  *	Configuration Settings
+ *	(Settings with #ifndef can be changed from the compiler's command line.)
  *****************************************************************************/
 
-// size of a sector in bytes (this must be a multiple of the smallest size of
-// flash memory that can be erased)
-#define SECTOR_SIZE				128
+// Set this to 1 to keep the sectors in main flash (the ".flashManager"
+// section; see mSectorArray), so there can be more, or bigger, sectors.
+// With 0, the two sectors are info segments C and D.
+#ifndef FLASH_MAIN_MEMORY
+#define FLASH_MAIN_MEMORY		0
+#endif
 
-// minimum number of bytes that can be written at once
-#define MIN_WRITE_SIZE			1
+// size of the smallest piece of flash that can be erased [bytes] (128 for
+// MSP430 info memory, 512 for MSP430 main memory)
+#ifndef FLASH_SEGMENT_SIZE
+#if (FLASH_MAIN_MEMORY == 1)
+#define FLASH_SEGMENT_SIZE		512
+#else
+#define FLASH_SEGMENT_SIZE		128
+#endif
+#endif
 
-// max size of variable in bytes.  There are several restrictions on this.
-// It can't be bigger than SECTOR_SIZE - 4 (or the sector will be too small for
-// even a single variable).  It must also be sized such that the flashData_t
-// (below) has a size that is an exact multiple of MIN_WRITE_SIZE (or else
-// Flash can't write a whole flashData_t at once).
-#define MAX_VARIABLE_SIZE		22
+// size of a sector in bytes (this must be a multiple of FLASH_SEGMENT_SIZE)
+#ifndef SECTOR_SIZE
+#define SECTOR_SIZE				FLASH_SEGMENT_SIZE
+#endif
+
+// number of sectors (at least 2).  One sector is always kept erased, so the
+// others hold data.  With more sectors, garbage collection can choose sectors
+// with less current data in them, so less data is copied.
+#ifndef NUM_SECTORS
+#define NUM_SECTORS				2
+#endif
 
-// start address of 1st sector (best practice:  put at the end of flash)
-#define SECTOR1_ADDR			MEM_ADDR_INFO_C
+// minimum number of bytes that can be written at once (1, 2 or 4).  Records
+// and flags are laid out in pieces this size, so flash that can only be
+// written a word at a time (or that's faster that way) never has part of a
+// word written.  Bigger pieces waste a little flash on padding.
+#ifndef MIN_WRITE_SIZE
+#define MIN_WRITE_SIZE			1
+#endif
+
+// most bytes written in one block write (FlashMemWrite32).  Block writes
+// can't cross a block of the flash (128 bytes on MSP430F5xx), so this must
+// divide the block size.  The data is copied into a RAM buffer this big.
+#ifndef FLASH_WRITE_BLOCK
+#define FLASH_WRITE_BLOCK		32
+#endif
 
-// start address of 2nd sector (best practice:  locate next to 1st sector)
-#define SECTOR2_ADDR			MEM_ADDR_INFO_D
+// max size of variable in bytes.  It must be less than 255, and a record of
+// this size (see RECORD_SIZE below) must fit in a sector.  Records only take
+// as much space as the variable they hold, so this doesn't cost any flash.
+#ifndef MAX_VARIABLE_SIZE
+#define MAX_VARIABLE_SIZE		22
+#endif
 
 // Commenting this line will remove the checksum code from this module.  This
 // will reduce the size of the code, and you'll also be able to store memory
 // with greater density.  However, you'll be less likely to detect errors.
-// Also note that the size of flashData_t will change, so you may need to
-// reevaluate MAX_VARIABLE_SIZE.
 #define FLASH_USE_CHECKSUM
 
+// Commenting this line will stop the statistics (see FlashManGetStats) from
+// being saved in flash, which saves 20 bytes in each sector.  They'll only be
+// counted since the last reset.
+#define FLASH_SAVE_STATS
+
+#define FLASH_CHECK_SUM			1		// 8-bit sum (1 byte per record)
+#define FLASH_CHECK_CRC16		2		// CRC-16 (2 bytes per record)
+#define FLASH_CHECK_CRC32		3		// CRC-32 (4 bytes per record)
+
+// how records are checked for errors (one of the above).  A CRC catches far
+// more errors than a sum, like swapped or doubled bytes.  Crc.h chooses how
+// CRCs are calculated.
+#ifndef FLASH_CHECK
+#define FLASH_CHECK				FLASH_CHECK_CRC16
+#endif
+
+// number of entries in the variable lookup table.  This must be a power of 2,
+// and must be greater than the number of variables flash can hold (see
+// MAX_VARIABLES below).  About twice that keeps searches short.
+#ifndef LOOKUP_TABLE_SIZE
+#define LOOKUP_TABLE_SIZE		32
+#endif
+
+// bytes of records one transaction can hold (see FlashManBeginTransaction).
+// They're kept in RAM until the transaction is committed, and then written
+// to one sector along with the record that commits them.
+#ifndef TRANSACTION_SIZE
+#define TRANSACTION_SIZE		64
+#endif
+
+// number of variables that can be cached in RAM (see FlashManCacheVariable).
+// Each takes MAX_VARIABLE_SIZE + 8 bytes of RAM.  0 leaves the cache out.
+#ifndef FLASH_CACHE_SIZE
+#define FLASH_CACHE_SIZE		0
+#endif
+
+// Flush the cache after this many sets of cached variables (0 = never).
+#ifndef FLASH_CACHE_FLUSH_SETS
+#define FLASH_CACHE_FLUSH_SETS	100
+#endif
+
+// Flush the cache after this many calls to FlashManCacheTask (0 = never).
+#ifndef FLASH_CACHE_FLUSH_TICKS
+#define FLASH_CACHE_FLUSH_TICKS	60
+#endif
+
+// most variables the index checkpoint holds.  When a sector becomes the head,
+// it starts with a checkpoint of where every variable is, so FlashManInit
+// doesn't have to read the other sectors' old records.  Room for the
+// checkpoint (5 bytes per variable, plus a record header for every
+// MAX_VARIABLE_SIZE / 5 variables) is set aside in every sector, so it comes
+// out of CAPACITY.  If there are more variables than this, the checkpoint is
+// left out, and FlashManInit reads everything.  0 leaves it out.
+#ifndef CHECKPOINT_ENTRIES
+#define CHECKPOINT_ENTRIES		0
+#endif
+
+// Set this to 1 to collect garbage a little at a time.  When the reserve
+// sector is used, a sector is picked for collection, and FlashManCollectTask
+// copies FLASH_GC_STEP_RECORDS records, or erases one segment, each time it's
+// called.  Sets keep writing to the rest of the head sector meanwhile; only
+// if that fills up does a set have to finish the collection itself.  With 0,
+// the set that uses the reserve sector does the whole collection.
+#ifndef FLASH_GC_INCREMENTAL
+#define FLASH_GC_INCREMENTAL	0
+#endif
+
+// records copied by each step of incremental garbage collection
+#ifndef FLASH_GC_STEP_RECORDS
+#define FLASH_GC_STEP_RECORDS	4
+#endif
+
+// Sectors that hold variables that never change would never be erased, while
+// the other sectors wear out.  When a sector has been erased this many times
+// less than the most-erased sector, garbage collection moves its data so the
+// sector can be reused.
+#ifndef WEAR_LEVEL_THRESHOLD
+#define WEAR_LEVEL_THRESHOLD	16
+#endif
+
 /******************************************************************************
  *	Local Settings, Typedefs
  *****************************************************************************/
+typedef struct __attribute__((__packed__))	// totals kept for the statistics
+{
+	uint32_t sets;						// records written for the application
+	uint32_t copies;					// records copied by garbage collection
+	uint32_t collections;				// sectors garbage collected
+	uint32_t dataBytes;					// bytes of data in the sets
+	uint32_t flashBytes;				// bytes written to flash
+} flashTotals_t;
+
 // This struct defines a sector record.  It must be byte-aligned.  Only the
 // first byte of each flag array is used; the rest of the bytes are there so
 // that each flag can be written in a single write-operation.
 typedef struct __attribute__((__packed__))
 {
-	uint8_t flag1[MIN_WRITE_SIZE];
-	uint8_t flag2[MIN_WRITE_SIZE];
-	uint8_t flag3[MIN_WRITE_SIZE];
+	uint8_t flag1[MIN_WRITE_SIZE];		// cleared when the sector gets records
+	uint8_t flag2[MIN_WRITE_SIZE];		// cleared when its records are obsolete
+	uint32_t eraseCount;				// times the sector has been erased
+	uint32_t sequence;					// order in which sectors were filled
+#ifdef FLASH_SAVE_STATS
+	flashTotals_t totals;				// totals when the sector became the head
+#endif
 } flashHeader_t;
 
-// structure stored in flash for each variable.  This structure must be byte-
-// aligned (a.k.a. packed), and must have a size that is an exact multiple of
-// the MIN_WRITE_SIZE.
+#if (FLASH_CHECK == FLASH_CHECK_CRC32)
+typedef uint32_t flashCheck_t;			// a record's checksum
+#elif (FLASH_CHECK == FLASH_CHECK_CRC16)
+typedef uint16_t flashCheck_t;			// a record's checksum
+#else
+typedef uint8_t flashCheck_t;			// a record's checksum
+#endif
+
+// structure stored in flash at the start of each variable record.  The
+// variable's data comes right after it, and the record is padded to a
+// multiple of MIN_WRITE_SIZE (see RECORD_SIZE below).  This structure must be
+// byte-aligned (a.k.a. packed).
 typedef struct __attribute__((__packed__))
 {
 	uint8_t flag;						// variable's status
+#if (MIN_WRITE_SIZE > 1)
+	uint8_t flagPadding[MIN_WRITE_SIZE - 1];	// so the flag is written alone
+#endif
+	uint8_t size;						// size of variable's data [bytes]
 	uint16_t id;						// variable's id
-	uint8_t data[MAX_VARIABLE_SIZE];	// variable's data
 #ifdef FLASH_USE_CHECKSUM
-	uint8_t checksum;					// 2's complement checksum of id and data
+	flashCheck_t checksum;				// checksum (or CRC) of size, id and data
 #endif
-} flashData_t;
+} flashRecord_t;
 
 typedef struct							// entry in the variable lookup table
 {
-	uint16_t id;						// variable's ID
-	uint32_t offset;					// variable's location in the sector
+	uint16_t id;						// variable's ID (or LOOKUP_ID_EMPTY)
+	uint16_t offset;					// variable's location in the sector
+	uint8_t sector;						// sector holding the variable
 } flashTableEntry_t;
 
-// This flag indicates a sector is blank.
-#define HEADER_FLAG_EMPTY		0xFFFFFF
+typedef struct __attribute__((__packed__))	// entry in the index checkpoint
+{
+	uint16_t id;						// variable's ID
+	uint16_t offset;					// variable's location in the sector
+	uint8_t sector;						// sector holding the variable
+} flashCheckpointEntry_t;
+
+typedef struct							// a variable cached in RAM
+{
+	uint16_t id;						// variable's ID
+	uint8_t size;						// size of its value [bytes]
+	bool stored;						// does it have a value?
+	bool dirty;							// is the value newer than flash's?
+	uint16_t growth;					// bytes flushing it will add to mLiveBytes
+	uint8_t data[MAX_VARIABLE_SIZE];	// variable's value
+} flashCacheEntry_t;
+
+typedef struct							// what we know about each sector
+{
+	uint32_t eraseCount;				// times the sector has been erased
+	uint32_t sequence;					// order the sector was filled in
+	uint32_t freeOffset;				// next free offset (SECTOR_SIZE when full)
+	uint32_t liveBytes;					// bytes used by current records
+	uint8_t state;						// SECTOR_STATE_xxx
+} flashSectorInfo_t;
+
+// This ID marks an unused entry in the lookup table.  It's also what an
+// erased ID looks like in flash, so variables can't use it.
+#define LOOKUP_ID_EMPTY			0xFFFF
+
+// This flag indicates a sector is erased.
+#define HEADER_FLAG_EMPTY		0xFFFF
+
+// This flag indicates a sector holds records.
+#define HEADER_FLAG_VALID		0xAAFF
 
-// This flag indicates a sector is being initialized.
-#define HEADER_FLAG_INIT		0xAAFFFF
+// This flag indicates a sector's records have been copied elsewhere, and the
+// sector is waiting to be erased.
+#define HEADER_FLAG_INVALID		0xAAAA
 
-// This flag indicates a sector has been initialized.
-#define HEADER_FLAG_VALID		0xAAAAFF
+// This is what an erased erase count or sequence number looks like.
+#define HEADER_FIELD_BLANK		0xFFFFFFFF
 
-// This flag indicates a sector is corrupted or discarded.
-#define HEADER_FLAG_INVALID		0xAAAAAA
+// These are the states of a sector, as kept in RAM.
+#define SECTOR_STATE_FREE		0		// erased, ready to become the head
+#define SECTOR_STATE_USED		1		// holds records
+#define SECTOR_STATE_BAD		2		// couldn't be erased; don't use it
 
-// This flag indicates a data entry is blank.
-#define DATA_FLAG_BLANK			0xFF
+// This size indicates a data entry is blank.  (A record's flag is written
+// last, so it's the size that tells if anything has been written.)
+#define DATA_SIZE_BLANK			0xFF
 
 // This flag indicates a data entry is valid.
 #define DATA_FLAG_VALID			0xAA
 
+// This flag indicates a data entry is part of a transaction.  It only counts
+// if the transaction's commit record comes after it.
+#define DATA_FLAG_TRANSACTION	0xA8
+
+// This flag indicates a commit record.  Instead of an ID, it holds the number
+// of bytes of transaction records right before it.
+#define DATA_FLAG_COMMIT		0xA0
+
+// This flag indicates a valid data entry that garbage collection copied from
+// another sector.  (It's only different from DATA_FLAG_VALID so the
+// statistics can tell them apart.)
+#define DATA_FLAG_COPY			0xA2
+
+// This flag indicates part of an index checkpoint.  Instead of an ID, it
+// holds the number of entries in the whole checkpoint.
+#define DATA_FLAG_CHECKPOINT	0x8A
+
 // This datatype is used to point to a sector.
 typedef uint8_t flashSector_t;
 
-// maximum number of variables supported
-#define MAX_VARIABLES	\
-	((SECTOR_SIZE - sizeof(flashHeader_t)) / sizeof(flashData_t))
+// Round a number of bytes up to a multiple of MIN_WRITE_SIZE.
+#define ALIGN_TO_WRITE(bytes)	\
+	((((bytes) + MIN_WRITE_SIZE - 1) / MIN_WRITE_SIZE) * MIN_WRITE_SIZE)
+
+// size of a record holding a variable of a certain size [bytes]
+#define RECORD_SIZE(dataSize)	ALIGN_TO_WRITE(sizeof(flashRecord_t) + (dataSize))
+
+// size of the biggest record [bytes]
+#define MAX_RECORD_SIZE			RECORD_SIZE(MAX_VARIABLE_SIZE)
+
+// Find a record's data.
+#define RECORD_DATA(recPtr)		((uint8_t *)(recPtr) + sizeof(flashRecord_t))
+
+// Find a sector, or a field in its header.  On a PC, the sectors are at the
+// start of simulated flash (see Processor_Peripherals/Linux/Flash.h).
+#ifdef __linux__
+#define SECTOR_PTR(sector)		(FlashMemGetBase() + ((uint32_t)(sector) * SECTOR_SIZE))
+#elif (FLASH_MAIN_MEMORY == 1)
+#define SECTOR_PTR(sector)		(mSectorArray[(sector)])
+#else
+#define SECTOR_PTR(sector)		(mSectorPtrs[(sector)])
+#endif
+#define HEADER_FIELD_PTR(sector, field)	\
+	(SECTOR_PTR(sector) + offsetof(flashHeader_t, field))
+
+// number of segments in a sector
+#define SEGMENTS_PER_SECTOR		(SECTOR_SIZE / FLASH_SEGMENT_SIZE)
+
+// number of entries in each record of the index checkpoint
+#define CHECKPOINT_RECORD_ENTRIES	(MAX_VARIABLE_SIZE / sizeof(flashCheckpointEntry_t))
+
+// most bytes the index checkpoint takes
+#define CHECKPOINT_BYTES	\
+	(((CHECKPOINT_ENTRIES + CHECKPOINT_RECORD_ENTRIES - 1) / CHECKPOINT_RECORD_ENTRIES) * \
+	 RECORD_SIZE(CHECKPOINT_RECORD_ENTRIES * sizeof(flashCheckpointEntry_t)))
+
+// bytes in a sector for records, after the header and checkpoint
+#define SECTOR_ROOM				(SECTOR_SIZE - sizeof(flashHeader_t) - CHECKPOINT_BYTES)
+
+// most bytes of current records flash will hold.  The reserved sector can't
+// hold any.  As long as the others have room to spare for the biggest record,
+// garbage collection can always make room for another one.
+#define CAPACITY				((NUM_SECTORS - 1) * (SECTOR_ROOM - MAX_RECORD_SIZE))
+
+// maximum number of variables supported (if each is only one byte)
+#define MAX_VARIABLES			(CAPACITY / RECORD_SIZE(1))
+
+// Find where an ID's search starts in the lookup table.
+#define LOOKUP_HASH(id)	(((id) ^ ((id) >> 8)) & (LOOKUP_TABLE_SIZE - 1))
+
+// Make sure the lookup table is a power of 2 with at least one unused entry.
+typedef char lookupTableSizeCheck_t[
+	(((LOOKUP_TABLE_SIZE & (LOOKUP_TABLE_SIZE - 1)) == 0) &&
+	 (LOOKUP_TABLE_SIZE > MAX_VARIABLES)) ? 1 : -1];
+
+// Make sure sectors are whole segments and fit the lookup table's types, and
+// that a variable's size can't look blank.
+typedef char sectorSizeCheck_t[
+	(((SECTOR_SIZE % FLASH_SEGMENT_SIZE) == 0) && (SECTOR_SIZE <= 0xFFFF) &&
+	 (MAX_VARIABLE_SIZE < DATA_SIZE_BLANK) &&
+	 (NUM_SECTORS >= 2) && (NUM_SECTORS <= 0xFF)) ? 1 : -1];
+
+// Make sure the sectors are exactly info segments C and D, when they're used.
+#if (FLASH_MAIN_MEMORY == 0) && !defined(__linux__)
+typedef char infoMemoryCheck_t[
+	((NUM_SECTORS == 2) && (SECTOR_SIZE == 128) && (FLASH_SEGMENT_SIZE == 128)) ? 1 : -1];
+#endif
+
+// Make sure flash is written in whole words, and the header keeps records
+// lined up with them.
+typedef char writeSizeCheck_t[
+	(((MIN_WRITE_SIZE == 1) || (MIN_WRITE_SIZE == 2) || (MIN_WRITE_SIZE == 4)) &&
+	 ((sizeof(flashHeader_t) % MIN_WRITE_SIZE) == 0) &&
+	 ((FLASH_WRITE_BLOCK % 4) == 0) && (FLASH_WRITE_BLOCK > 0)) ? 1 : -1];
+
+// Make sure a transaction holds a record, and fits in a sector with its
+// commit record.
+typedef char transactionSizeCheck_t[
+	((TRANSACTION_SIZE >= MAX_RECORD_SIZE) &&
+	 ((TRANSACTION_SIZE + RECORD_SIZE(0)) <= SECTOR_ROOM)) ? 1 : -1];
+
+// Make sure a checkpoint record holds an entry, and the checkpoint leaves room
+// for data.
+typedef char checkpointSizeCheck_t[
+	((CHECKPOINT_RECORD_ENTRIES > 0) &&
+	 (SECTOR_SIZE > (sizeof(flashHeader_t) + CHECKPOINT_BYTES + MAX_RECORD_SIZE))) ? 1 : -1];
 
 /******************************************************************************
  *	Local variables
  *****************************************************************************/
 
 // Allocate memory for non-volatile memory so it isn't used by the linker
-// for something else.  The location is specified.
-#pragma DATA_SECTION(sectorArray1, ".infoC")
-static uint8_t sectorArray1[SECTOR_SIZE];
-#pragma DATA_SECTION(sectorArray2, ".infoD")
-static uint8_t sectorArray2[SECTOR_SIZE];
+// for something else.  In main flash, the linker command file must define
+// the ".flashManager" section:  NUM_SECTORS * SECTOR_SIZE bytes, starting on
+// a FLASH_SEGMENT_SIZE boundary, with nothing else in its segments (best
+// practice:  put it at the end of main flash).  Otherwise, the locations are
+// the info segments.
+#ifndef __linux__
+#if (FLASH_MAIN_MEMORY == 1)
+#pragma DATA_SECTION(mSectorArray, ".flashManager")
+static uint8_t mSectorArray[NUM_SECTORS][SECTOR_SIZE];
+#else
+#pragma DATA_SECTION(mSectorC, ".infoC")
+static uint8_t mSectorC[SECTOR_SIZE];
+#pragma DATA_SECTION(mSectorD, ".infoD")
+static uint8_t mSectorD[SECTOR_SIZE];
+
+// the sectors, in order
+static uint8_t * const mSectorPtrs[NUM_SECTORS] = { mSectorC, mSectorD };
+#endif
+#endif
 
-// define sectors
-static flashSector_t *sectorPtr1 = sectorArray1;
-static flashSector_t *sectorPtr2 = sectorArray2;
+// what we know about each sector
+static flashSectorInfo_t mSectors[NUM_SECTORS];
 
-// the variable lookup table
-static flashTableEntry_t mLookupTable[MAX_VARIABLES];
+// the variable lookup table (a hash table, searched by ID)
+static flashTableEntry_t mLookupTable[LOOKUP_TABLE_SIZE];
 
 // number of entries in the lookup table
 static uint16_t mNumVariables;
 
-// the next free offset in the valid sector
-static uint32_t validFreeOffset;
+// bytes used by current records, in all sectors
+static uint32_t mLiveBytes;
+
+// bytes mLiveBytes will grow by when the cache is flushed (always 0 without
+// a cache).  Sets that were accepted into the cache have to fit, too.
+static uint32_t mCachedGrowth = 0;
+
+// sector new records are written to
+static uint8_t mHeadSector;
+
+// number of erased sectors
+static uint8_t mNumFreeSectors;
+
+// sequence number of the newest sector
+static uint32_t mSequence;
+
+// records waiting for the transaction to be committed
+static uint8_t mTransaction[TRANSACTION_SIZE];
+
+// number of bytes in mTransaction
+static uint16_t mTransactionLength;
+
+// is a transaction in progress?
+static bool mInTransaction = false;
 
-// pointer to valid sector
-static flashSector_t *validSectorPtr;
+// totals for the statistics
+static flashTotals_t mTotals;
+
+// sector being garbage collected (NUM_SECTORS when there isn't one)
+static uint8_t mVictim = NUM_SECTORS;
+
+// next lookup table entry to copy from mVictim, or LOOKUP_TABLE_SIZE plus
+// the number of segments erased so far
+static uint16_t mVictimStep;
+
+#if (FLASH_CACHE_SIZE > 0)
+// variables cached in RAM
+static flashCacheEntry_t mCache[FLASH_CACHE_SIZE];
+
+// number of entries in mCache
+static uint8_t mNumCached;
+
+// sets of cached variables since the cache was flushed
+static uint16_t mCacheSets;
+
+// calls to FlashManCacheTask since the cache was flushed
+static uint16_t mCacheTicks;
+#endif
 
 /******************************************************************************
  *	Local Functions
  *****************************************************************************/
 
 /**
- * @brief	Erases a sector
- * @param	sectorPtr - pointer to flash sector to act upon
- * @returns	true for success; false otherwise	
+ * @brief	Write bytes to flash, and check that they were written.
+ * @remarks	Uses the widest writes the address allows:  block writes of
+ *			32-bit words where it's aligned, and 16-bit words or bytes to
+ *			get there.  The data can be anywhere in RAM; it's copied into an
+ *			aligned buffer for word writes.
+ * @param	dataPtr - data to write
+ * @param	flashPtr - where to write it
+ * @param	count - number of bytes to write
+ * @returns	true for success; false otherwise
+ */
+static bool WriteFlash(uint8_t *dataPtr, uint8_t *flashPtr, uint16_t count)
+{
+	uint32_t words[FLASH_WRITE_BLOCK / 4];	// aligned copy of the data
+	uint16_t halfWord;					// aligned copy of the data
+	uint16_t bytes;						// bytes written in one go
+	uint16_t i;							// counter
+	bool result = true;					// an optimistic return value :)
+
+	mTotals.flashBytes += count;
+
+	while ((result == true) && (count > 0))
+	{
+		// Block-write whole words, up to the end of the block.
+		if ((((uintptr_t)flashPtr % 4) == 0) && (count >= 4))
+		{
+			bytes = FLASH_WRITE_BLOCK - ((uintptr_t)flashPtr % FLASH_WRITE_BLOCK);
+			if (bytes > count)
+			{
+				bytes = count & ~3;
+			}
+
+			for (i = 0; i < bytes; i++)
+			{
+				((uint8_t *)words)[i] = dataPtr[i];
+			}
+
+			FlashMemWrite32(words, (uint32_t *)flashPtr, bytes / 4);
+
+			// Verify the data was written correctly.
+			for (i = 0; i < (bytes / 4); i++)
+			{
+				if (((volatile uint32_t *)flashPtr)[i] != words[i])
+				{
+					result = false;
+				}
+			}
+		}
+		else if ((((uintptr_t)flashPtr % 2) == 0) && (count >= 2))
+		{
+			bytes = 2;
+			((uint8_t *)&halfWord)[0] = dataPtr[0];
+			((uint8_t *)&halfWord)[1] = dataPtr[1];
+
+			FlashMemWrite16(&halfWord, (uint16_t *)flashPtr, 1);
+			result = (*(volatile uint16_t *)flashPtr == halfWord);
+		}
+		else
+		{
+			bytes = 1;
+			FlashMemWrite8(dataPtr, flashPtr, 1);
+			result = (*(volatile uint8_t *)flashPtr == *dataPtr);
+		}
+
+		dataPtr += bytes;
+		flashPtr += bytes;
+		count -= bytes;
+	}
+
+	return result;
+}
+
+/**
+ * @brief	Erase one segment of a sector.
+ * @remarks	The header's segment should go last, so if we're reset partway
+ *			through, the header isn't blank yet and FlashManInit erases the
+ *			sector again.
+ * @param	sector - sector to act upon
+ * @param	segment - segment in the sector (0 holds the header)
  */
-static bool EraseSector(flashSector_t *sectorPtr)
+static void EraseSegment(uint8_t sector, uint16_t segment)
 {
-	bool result;	// return value
+	FlashMemSegmentErase(SECTOR_PTR(sector) + ((uint32_t)segment * FLASH_SEGMENT_SIZE));
+}
 
-	// Erase the sector.
-	FlashSegmentErase(sectorPtr);
+/**
+ * @brief	Finish erasing a sector, and record the erase in the sector's
+ *			header.
+ * @remarks	The sector's erase count (in mSectors) must be up to date.
+ * @param	sector - sector whose segments have all been erased
+ * @returns	true for success; false otherwise
+ */
+static bool FinishErase(uint8_t sector)
+{
+	flashSectorInfo_t *info = &mSectors[sector];
+	bool result;						// return value
 
 	// Check that it was erased.
-	result = FlashEraseCheck(sectorPtr, SECTOR_SIZE);
+	result = FlashMemEraseCheck(SECTOR_PTR(sector), SECTOR_SIZE);
+
+	// Save the new erase count right away, so a reset doesn't lose it.
+	info->eraseCount++;
+	if (result == true)
+	{
+		result = WriteFlash((uint8_t *)&info->eraseCount,
+			HEADER_FIELD_PTR(sector, eraseCount), sizeof(info->eraseCount));
+	}
+
+	if (result == true)
+	{
+		info->state = SECTOR_STATE_FREE;
+		info->freeOffset = sizeof(flashHeader_t);
+		info->liveBytes = 0;
+		mNumFreeSectors++;
+	}
+	else
+	{
+		info->state = SECTOR_STATE_BAD;
+	}
 
 	return result;
 }
 
+/**
+ * @brief	Erases a sector, and records the erase in the sector's header.
+ * @remarks	The sector's erase count (in mSectors) must be up to date.
+ * @param	sector - sector to act upon
+ * @returns	true for success; false otherwise
+ */
+static bool EraseSector(uint8_t sector)
+{
+	uint16_t segment;					// segment to erase
+
+	// Erase each segment in the sector, the header's last.
+	for (segment = SEGMENTS_PER_SECTOR; segment > 0; segment--)
+	{
+		EraseSegment(sector, segment - 1);
+	}
+
+	return FinishErase(sector);
+}
+
+/**
+ * @brief	Find the next record in a sector.
+ * @remarks	A record that was being written when power was lost can have a
+ *			nonsense size.  Nothing after it can be trusted (we wouldn't know
+ *			where the next record starts), so it's treated like the end of
+ *			the sector.
+ * @param	sectorPtr - pointer to flash sector to act upon
+ * @param	offset - offset of a record; returns the offset of the next one
+ * @returns	the next record; NULL at a blank record or the end of the sector
+ */
+static flashRecord_t *GetNextRecord(flashSector_t *sectorPtr, uint32_t *offset)
+{
+	flashRecord_t *varRec = (flashRecord_t *)(sectorPtr + *offset);
+	flashRecord_t *nextRec = NULL;		// return value
+
+	// Stop if this record is corrupted or runs past the end of the sector.
+	if ((varRec->size <= MAX_VARIABLE_SIZE) &&
+		((*offset + RECORD_SIZE(varRec->size)) <= SECTOR_SIZE))
+	{
+		*offset += RECORD_SIZE(varRec->size);
+
+		// Stop if there's no room for another record.
+		if ((*offset + RECORD_SIZE(0)) <= SECTOR_SIZE)
+		{
+			nextRec = (flashRecord_t *)(sectorPtr + *offset);
+
+			// Stop at blank space.
+			if (nextRec->size == DATA_SIZE_BLANK)
+			{
+				nextRec = NULL;
+			}
+		}
+	}
+
+	return nextRec;
+}
+
 /**
  * @brief	Gets the offset of the next free location in a sector
  * @param	sectorPtr - pointer to flash sector to act upon
@@ -156,38 +674,87 @@ static bool EraseSector(flashSector_t *sectorPtr)
  */
 uint32_t GetNextFreeOffset(flashSector_t *sectorPtr)
 {
-	flashData_t *varRec = (flashData_t *)(sectorPtr + sizeof(flashHeader_t));
+	flashRecord_t *varRec = (flashRecord_t *)(sectorPtr + sizeof(flashHeader_t));
+	uint32_t offset = sizeof(flashHeader_t);
 
 	// Loop through variable records.
-	while (varRec->flag != DATA_FLAG_BLANK)
+	if (varRec->size != DATA_SIZE_BLANK)
 	{
-		varRec++;
+		do
+		{
+			varRec = GetNextRecord(sectorPtr, &offset);
+		} while (varRec != NULL);
 
-		// If we reach the end of sector then we are finished.
-		if ((uint8_t *)varRec >= (sectorPtr + SECTOR_SIZE))
+		// If we didn't stop at blank space, the sector is full.
+		if (((offset + RECORD_SIZE(0)) > SECTOR_SIZE) ||
+			(((flashRecord_t *)(sectorPtr + offset))->size != DATA_SIZE_BLANK))
 		{
-			return SECTOR_SIZE;
+			offset = SECTOR_SIZE;
 		}
 	}
 
-	return (uint32_t)((uint8_t *)varRec - sectorPtr);
+	return offset;
+}
+
+#ifdef FLASH_USE_CHECKSUM
+/**
+ * @brief	Calculate a record's checksum.
+ * @remarks	It covers the SIZE, ID and DATA.  They're added a piece at a
+ *			time, so only the record's own data is read (not the padding up
+ *			to MAX_VARIABLE_SIZE).
+ * @param	varRec - record to check (its size must be valid)
+ * @returns	the checksum the record should have
+ */
+static flashCheck_t CalculateChecksum(const flashRecord_t *varRec)
+{
+	const uint8_t *data = RECORD_DATA(varRec);	// variable's data
+#if (FLASH_CHECK == FLASH_CHECK_CRC32)
+	uint32_t crc;						// return value
+
+	crc = Crc32Update(CRC32_START, &varRec->size, sizeof(varRec->size) + sizeof(varRec->id));
+	crc = Crc32Update(crc, data, varRec->size);
+
+	return crc;
+#elif (FLASH_CHECK == FLASH_CHECK_CRC16)
+	uint16_t crc;						// return value
+
+	crc = Crc16Update(CRC16_START, &varRec->size, sizeof(varRec->size) + sizeof(varRec->id));
+	crc = Crc16Update(crc, data, varRec->size);
+
+	return crc;
+#else
+	uint8_t checksum;					// return value
+	uint16_t i;							// counter
+
+	// It's a 2's complement of the SIZE, ID and DATA.
+	checksum = varRec->size;
+	checksum += varRec->id & 0xFF;
+	checksum += (varRec->id >> 8) & 0xFF;
+	for (i = 0; i < varRec->size; i++)
+	{
+		checksum += data[i];
+	}
+
+	return 0x100 - checksum;
+#endif
 }
+#endif
 
 /**
  * @brief	Check if a variable record is valid or not.
  * @param	varRec - variable record to check
  * @returns	true if variable is valid; false otherwise
  */
-static bool IsVariableRecordValid(flashData_t *varRec)
+static bool IsVariableRecordValid(flashRecord_t *varRec)
 {
 	bool result = true;					// an optimistic return value :)
-#ifdef FLASH_USE_CHECKSUM
-	uint16_t i;							// counter
-	uint8_t checksum;					// 2's complement checksum of data
-#endif
 
 	// If the variable record has an invalid flag...
-	if (varRec->flag != DATA_FLAG_VALID)
+	if ((varRec->flag != DATA_FLAG_VALID) &&
+		(varRec->flag != DATA_FLAG_COPY) &&
+		(varRec->flag != DATA_FLAG_CHECKPOINT) &&
+		(varRec->flag != DATA_FLAG_TRANSACTION) &&
+		(varRec->flag != DATA_FLAG_COMMIT))
 	{
 		// The record is invalid.
 		result = false;
@@ -197,18 +764,8 @@ static bool IsVariableRecordValid(flashData_t *varRec)
 	// If the flag was fine, check the checksum.
 	if (result == true)
 	{
-		// Calculate the checksum.
-		// It's a 2's complement of the ID and DATA.
-		checksum = varRec->id & 0xFF;
-		checksum += (varRec->id >> 8) & 0xFF;
-		for (i = 0; i < MAX_VARIABLE_SIZE; i++)
-		{
-			checksum += varRec->data[i];
-		}
-		checksum = 0x100 - checksum;
-
 		// If the checksum is incorrect...
-		if (varRec->checksum != checksum)
+		if (varRec->checksum != CalculateChecksum(varRec))
 		{
 			// The record is invalid.
 			result = false;
@@ -220,239 +777,1114 @@ static bool IsVariableRecordValid(flashData_t *varRec)
 }
 
 /**
- * @brief	Construct the lookup table from the valid sector.
+ * @brief	Find a variable's entry in the lookup table.
+ * @remarks	The table is a hash table with linear probing:  the search starts
+ *			at an entry chosen from the ID, and moves to the next entry until
+ *			it finds the ID or an unused entry.  Since the table always has
+ *			unused entries, the search always ends.
+ * @param	id - variable to look for
+ * @returns	the variable's entry, or the unused entry where it would go
  */
-static void ConstructLookupTable(void)
+static flashTableEntry_t *FindTableEntry(uint16_t id)
 {
-	flashData_t *varRec = (flashData_t *)(validSectorPtr + sizeof(flashHeader_t));
-	uint16_t i;		// counter
-	bool found;			// flag to indicate we found a variable
+	uint16_t i = LOOKUP_HASH(id);		// index into the lookup table
 
-	// Reset the global variable indicating number of variables in memory.
-	mNumVariables = 0;
-
-	// Loop through variable records in the sector.
-	while (varRec->flag != DATA_FLAG_BLANK)
+	while ((mLookupTable[i].id != id) && (mLookupTable[i].id != LOOKUP_ID_EMPTY))
 	{
-		// Initialize a flag to say if a variable exists in the lookup table.
-		found = false;
-
-		// If variable record is valid then add it to the lookup table.
-		if (IsVariableRecordValid(varRec))
-		{
-			// Search for variable in lookup table. If already found then
-			// update existing entry with new offset.
-			for (i = 0; i < mNumVariables; i++)
-			{
-				// If the variable is already in the lookup table...
-				if (mLookupTable[i].id == varRec->id)
-				{
-					// Update existing entry with new offset.
-					mLookupTable[i].offset = (uint16_t)((uint8_t *)varRec - validSectorPtr);
-
-					// Set the flag saying the variable is in the lookup table.
-					found = true;
-
-					// ??
-					break;
-				}
-			}
-
-			// If variable is not already in lookup table then add it.
-			if (!found)
-			{
-				// Remember the variable ID.
-				mLookupTable[mNumVariables].id = varRec->id;
+		i = (i + 1) & (LOOKUP_TABLE_SIZE - 1);
+	}
 
-				// Remember where in the sector the variable is stored.
-				mLookupTable[mNumVariables].offset = (uint16_t)((uint8_t *)varRec - validSectorPtr);
+	return &mLookupTable[i];
+}
 
-				// Increment the number of stored variables.
-				mNumVariables++;
-			}
-		}
-	
-		// Move to next record in the sector.
-		varRec++;
+/**
+ * @brief	Point a lookup table entry at a variable's newest record.
+ * @remarks	The record it pointed to before (if any) is no longer current,
+ *			so its sector has that much less live data.
+ * @param	entry - the variable's entry (or the unused entry where it goes)
+ * @param	varRec - the variable's newest record
+ * @param	sector - sector holding the record
+ * @param	offset - offset of the record in the sector
+ */
+static void SetTableEntry(flashTableEntry_t *entry, flashRecord_t *varRec,
+	uint8_t sector, uint32_t offset)
+{
+	flashRecord_t *oldRec;				// record the entry pointed to before
 
-		// if reached end of sector then we are finished.
-		if ((uint8_t *)varRec >= (validSectorPtr + SECTOR_SIZE))
-		{
-			break;
-		}
+	// If the variable is new, add it.
+	if (entry->id == LOOKUP_ID_EMPTY)
+	{
+		entry->id = varRec->id;
+		mNumVariables++;
+	}
 
-		// if reached maximum number of variables then we are finished.
-		if (mNumVariables == MAX_VARIABLES)
-		{
-			break;
-		}
+	// Otherwise, its old record is obsolete.
+	else
+	{
+		oldRec = (flashRecord_t *)(SECTOR_PTR(entry->sector) + entry->offset);
+		mSectors[entry->sector].liveBytes -= RECORD_SIZE(oldRec->size);
+		mLiveBytes -= RECORD_SIZE(oldRec->size);
 	}
+
+	entry->sector = sector;
+	entry->offset = (uint16_t)offset;
+	mSectors[sector].liveBytes += RECORD_SIZE(varRec->size);
+	mLiveBytes += RECORD_SIZE(varRec->size);
 }
 
 /**
- * @brief	Write a variable record into a specific sector at a specific offset.
- * @param	varRec - variable record to store
- * @param	sectorPtr - sector to write to
- * @param	offset - offset in sector for variable record
- * @returns	true for success; false otherwise
+ * @brief	Add a record to the lookup table, replacing any older record for
+ *			the same variable.
+ * @remarks	If the variable is new and the table is full, it's left out.
+ * @param	varRec - record to add
+ * @param	sector - sector holding the record
+ * @param	offset - offset of the record in the sector
  */
-static bool SetVariableRecord(flashData_t *varRec, flashSector_t *sectorPtr, uint16_t offset)
+static void AddToLookupTable(flashRecord_t *varRec, uint8_t sector, uint32_t offset)
 {
-	uint16_t i;							// counter
-	bool result = true;					// an optimistic return value :)
+	flashTableEntry_t *entry;			// variable's entry in the lookup table
 
-	// Write the variable record to the sector.
-	FlashWrite8((uint8_t *)varRec, (sectorPtr + offset), sizeof(flashData_t));
+	// Find the variable's entry (or where it goes).
+	entry = FindTableEntry(varRec->id);
 
-	// Verify the data was written correctly.
-	for (i = 0; i < sizeof(flashData_t); i++)
+	if ((entry->id != LOOKUP_ID_EMPTY) || (mNumVariables < MAX_VARIABLES))
 	{
-		if ((sectorPtr + offset)[i] != ((uint8_t *)varRec)[i])
-		{
-			result = false;
-		}
+		SetTableEntry(entry, varRec, sector, offset);
 	}
-
-  return result;
 }
 
 /**
- * @brief	Update the flags for a sector.
- * @param	sectorPtr - pointer to sector
- * @param	flags - new flags to write
- * @returns	true for success; false otherwise
+ * @brief	Add a committed transaction's records to the lookup table.
+ * @remarks	The records are only added if every one of them is valid, so a
+ *			transaction is all or nothing.
+ * @param	sector - sector holding the transaction
+ * @param	start - offset of the transaction's first record
+ * @param	end - offset of its commit record
  */
-static bool SetSectorFlags(flashSector_t *sectorPtr, uint32_t flags)
+static void ApplyTransaction(uint8_t sector, uint32_t start, uint32_t end)
 {
-	uint32_t i;							// counter
-	flashHeader_t secRec;
-	bool result = true;					// an optimistic return value :)
-
-	// Configure sector record.
-	secRec.flag1[0] = (flags >> 16) & 0xFF;
-	secRec.flag2[0] = (flags >> 8) & 0xFF;
-	secRec.flag3[0] = flags & 0xFF;
+	flashRecord_t *varRec;				// record being checked
+	uint32_t offset = start;			// offset of varRec
+	bool complete = true;				// are all the records valid?
 
-	// Write to sector.
-	FlashWrite8((uint8_t *)&secRec, sectorPtr, sizeof(flashHeader_t));
-
-	// Verify the data was written correctly.
-	for (i = 0; i < sizeof(secRec); i++)
+	// Check the records.
+	while ((complete == true) && (offset < end))
 	{
-		if (sectorPtr[i] != ((uint8_t *)(&secRec))[i])
+		varRec = (flashRecord_t *)(SECTOR_PTR(sector) + offset);
+
+		if ((varRec->size > MAX_VARIABLE_SIZE) ||
+			((offset + RECORD_SIZE(varRec->size)) > end) ||
+			(varRec->flag != DATA_FLAG_TRANSACTION) ||
+			(IsVariableRecordValid(varRec) != true))
 		{
-			result = false;
+			complete = false;
+		}
+		else
+		{
+			offset += RECORD_SIZE(varRec->size);
 		}
 	}
 
-	return result;
+	// Add them.
+	offset = start;
+	while ((complete == true) && (offset < end))
+	{
+		varRec = (flashRecord_t *)(SECTOR_PTR(sector) + offset);
+		AddToLookupTable(varRec, sector, offset);
+		offset += RECORD_SIZE(varRec->size);
+	}
 }
 
 /**
- * @brief	Move data from one sector to another, removing old entries.
- * @param	srcSectorPtr - pointer of source sector
- * @param	dstSectorPtr - pointer to destination sector
- * @returns	true for success; false for error
+ * @brief	Empty the lookup table.
  */
-static bool SwapSectors(flashSector_t *srcSectorPtr, flashSector_t *dstSectorPtr)
+static void ClearLookupTable(void)
 {
 	uint16_t i;							// counter
-	flashData_t *tempDataPtr;			// data to put into destination sector
-	uint16_t tempOffset;				// address where we'll put the data
-	bool status = true;					// an optimistic return value :)
 
-	// Erase the sector if necessary.
-	if (dstSectorPtr[0] != 0xFF)
+	// Reset the global variables indicating what's in memory.
+	mNumVariables = 0;
+	mLiveBytes = 0;
+
+	// Mark every entry in the lookup table as unused.
+	for (i = 0; i < LOOKUP_TABLE_SIZE; i++)
 	{
-		status = EraseSector(dstSectorPtr);
+		mLookupTable[i].id = LOOKUP_ID_EMPTY;
 	}
 
-	// Mark the destination sector as being initialized.
-	if (status == true)
+	for (i = 0; i < NUM_SECTORS; i++)
 	{
-		status = SetSectorFlags(dstSectorPtr, HEADER_FLAG_INIT);
+		mSectors[i].liveBytes = 0;
 	}
+}
 
-	if (status == true)
+/**
+ * @brief	Add a sector's records to the lookup table, replacing older
+ *			records for the same variables.
+ * @param	sector - sector to read
+ * @param	varRec - first record to add (NULL if there aren't any)
+ * @param	offset - offset of varRec
+ */
+static void ScanRecords(uint8_t sector, flashRecord_t *varRec, uint32_t offset)
+{
+	while (varRec != NULL)
 	{
-		// Find the address where we want the first flashData structure.
-		// The first data structure goes after the status flags structure.
-		tempOffset = sizeof(flashHeader_t);
-
-		// Copy variables to destination sector.
-		for (i = 0; i < mNumVariables; i++)
+		// If variable record is valid then add it to the lookup table.
+		// Transaction records are added when their commit record is found.
+		// (A transaction that lost power before it was committed doesn't
+		// have one.)
+		if (IsVariableRecordValid(varRec))
 		{
-			tempDataPtr = (flashData_t *)(srcSectorPtr + mLookupTable[i].offset);
-
-			status = SetVariableRecord(tempDataPtr, dstSectorPtr, tempOffset);
-
-			// Stop if something goes wrong.
-			if (status != true)
+			if ((varRec->flag == DATA_FLAG_VALID) || (varRec->flag == DATA_FLAG_COPY))
 			{
-				break;
+				AddToLookupTable(varRec, sector, offset);
+			}
+			else if ((varRec->flag == DATA_FLAG_COMMIT) &&
+					 (varRec->id <= (offset - sizeof(flashHeader_t))))
+			{
+				ApplyTransaction(sector, offset - varRec->id, offset);
 			}
-
-			// Find the address of the next flashData structure.
-			tempOffset += sizeof(flashData_t);
 		}
-	}
 
-	// We're finished with the source sector.  Mark it as invalid.
-	if (status == true)
-	{
-		status = SetSectorFlags(srcSectorPtr, HEADER_FLAG_INVALID);
+		// Move to next record in the sector.
+		varRec = GetNextRecord(SECTOR_PTR(sector), &offset);
+	}
+}
+
+/**
+ * @brief	Construct the lookup table from the sectors that hold records.
+ * @remarks	Sectors are read from oldest to newest, so newer records replace
+ *			older ones.
+ */
+static void ConstructLookupTable(void)
+{
+	uint8_t order[NUM_SECTORS];			// sectors with records, oldest first
+	uint8_t numUsed = 0;				// number of sectors in order[]
+	flashRecord_t *varRec;				// first record in a sector
+	uint16_t i;							// counter
+	uint8_t j;							// counter
+
+	ClearLookupTable();
+
+	// Sort the sectors that hold records by sequence number.  There aren't
+	// many sectors, so an insertion sort is fine.
+	for (i = 0; i < NUM_SECTORS; i++)
+	{
+		if (mSectors[i].state == SECTOR_STATE_USED)
+		{
+			for (j = numUsed; (j > 0) && (mSectors[order[j - 1]].sequence > mSectors[i].sequence); j--)
+			{
+				order[j] = order[j - 1];
+			}
+			order[j] = (uint8_t)i;
+			numUsed++;
+		}
+	}
+
+	// Loop through variable records in each sector.
+	for (j = 0; j < numUsed; j++)
+	{
+		varRec = (flashRecord_t *)(SECTOR_PTR(order[j]) + sizeof(flashHeader_t));
+
+		if (varRec->size == DATA_SIZE_BLANK)
+		{
+			varRec = NULL;
+		}
+
+		ScanRecords(order[j], varRec, sizeof(flashHeader_t));
+	}
+}
+
+#if (CHECKPOINT_ENTRIES > 0)
+/**
+ * @brief	Add an entry from the index checkpoint to the lookup table.
+ * @param	entry - checkpoint entry
+ * @returns	true for success; false if the entry doesn't point to the
+ *			variable's record
+ */
+static bool AddCheckpointEntry(flashCheckpointEntry_t *entry)
+{
+	flashRecord_t *varRec;				// record the entry points to
+	bool status = true;					// an optimistic return value :)
+
+	// Nothing before the head can point into it.
+	if ((entry->sector >= NUM_SECTORS) || (entry->sector == mHeadSector))
+	{
+		status = false;
+	}
+
+	// If the sector has been garbage collected since, its records were
+	// copied to the head, and they're added when the head is read.
+	else if (mSectors[entry->sector].state == SECTOR_STATE_USED)
+	{
+		varRec = (flashRecord_t *)(SECTOR_PTR(entry->sector) + entry->offset);
+
+		if ((entry->offset < sizeof(flashHeader_t)) ||
+			((entry->offset + RECORD_SIZE(0)) > SECTOR_SIZE) ||
+			(varRec->size > MAX_VARIABLE_SIZE) ||
+			((entry->offset + RECORD_SIZE(varRec->size)) > SECTOR_SIZE) ||
+			(varRec->id != entry->id) ||
+			(varRec->flag == DATA_FLAG_COMMIT) ||
+			(varRec->flag == DATA_FLAG_CHECKPOINT) ||
+			(IsVariableRecordValid(varRec) != true))
+		{
+			status = false;
+		}
+		else
+		{
+			AddToLookupTable(varRec, entry->sector, entry->offset);
+		}
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Construct the lookup table from the head sector's index
+ *			checkpoint, and the records written to the head after it.
+ * @remarks	This is the same as reading every sector, but it only has to
+ *			check the current records in the older sectors.
+ * @returns	true for success; false if there's no complete checkpoint
+ */
+static bool LoadCheckpoint(void)
+{
+	flashRecord_t *varRec;				// record being read
+	flashCheckpointEntry_t *entries;	// entries in varRec
+	uint32_t offset = sizeof(flashHeader_t);	// offset of varRec
+	uint16_t numEntries = 0;			// entries read so far
+	uint16_t expected = 0;				// entries in the checkpoint
+	uint16_t i;							// counter
+	bool done = false;					// has the whole checkpoint been read?
+	bool status = (mSequence != 0);		// return value
+
+	ClearLookupTable();
+
+	varRec = (flashRecord_t *)(SECTOR_PTR(mHeadSector) + offset);
+	if (varRec->size == DATA_SIZE_BLANK)
+	{
+		varRec = NULL;
+	}
+	else
+	{
+		expected = varRec->id;
+	}
+
+	// Read the checkpoint.  Every record of it has to be there.
+	while ((status == true) && (done == false))
+	{
+		if ((varRec == NULL) ||
+			(varRec->flag != DATA_FLAG_CHECKPOINT) ||
+			(varRec->id != expected) ||
+			(varRec->size > MAX_VARIABLE_SIZE) ||
+			((varRec->size % sizeof(flashCheckpointEntry_t)) != 0) ||
+			(IsVariableRecordValid(varRec) != true))
+		{
+			status = false;
+		}
+		else
+		{
+			entries = (flashCheckpointEntry_t *)RECORD_DATA(varRec);
+			for (i = 0; (status == true) && (i < (varRec->size / sizeof(flashCheckpointEntry_t))); i++)
+			{
+				status = AddCheckpointEntry(&entries[i]);
+			}
+
+			numEntries += varRec->size / sizeof(flashCheckpointEntry_t);
+			done = (numEntries >= expected);
+			varRec = GetNextRecord(SECTOR_PTR(mHeadSector), &offset);
+		}
+	}
+
+	if ((status == true) && (numEntries == expected))
+	{
+		ScanRecords(mHeadSector, varRec, offset);
+	}
+	else
+	{
+		status = false;
+	}
+
+	return status;
+}
+#endif
+
+/**
+ * @brief	Update the flags for a sector.
+ * @param	sector - sector to act upon
+ * @param	flags - new flags to write
+ * @returns	true for success; false otherwise
+ */
+static bool SetSectorFlags(uint8_t sector, uint16_t flags)
+{
+	flashHeader_t *secRec = (flashHeader_t *)SECTOR_PTR(sector);
+	uint8_t flag[MIN_WRITE_SIZE];		// a flag, padded to MIN_WRITE_SIZE
+	uint16_t i;							// counter
+	bool status = true;					// an optimistic return value :)
+
+	for (i = 1; i < MIN_WRITE_SIZE; i++)
+	{
+		flag[i] = 0xFF;
+	}
+
+	// Write each flag that changes, by itself, so no piece of flash is
+	// written twice.
+	flag[0] = (flags >> 8) & 0xFF;
+	if (secRec->flag1[0] != flag[0])
+	{
+		status = WriteFlash(flag, secRec->flag1, MIN_WRITE_SIZE);
+	}
+
+	flag[0] = flags & 0xFF;
+	if ((status == true) && (secRec->flag2[0] != flag[0]))
+	{
+		status = WriteFlash(flag, secRec->flag2, MIN_WRITE_SIZE);
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Read the flags for a sector.
+ * @param	sector - sector to act upon
+ * @returns	the sector's flags
+ */
+static uint16_t GetSectorFlags(uint8_t sector)
+{
+	volatile flashHeader_t *secRec = (flashHeader_t *)SECTOR_PTR(sector);
+
+	return ((uint16_t)(secRec->flag1[0]) << 8) | secRec->flag2[0];
+}
+
+/**
+ * @brief	Make an erased sector the head, so records are written to it.
+ * @remarks	Picks the erased sector that has been erased the fewest times.
+ * @returns	true for success; false if there's no erased sector, or error
+ */
+static bool OpenHeadSector(void)
+{
+	uint8_t sector = NUM_SECTORS;		// sector to open
+#ifdef FLASH_SAVE_STATS
+	flashTotals_t totals;				// totals to save in the header
+#endif
+	uint8_t i;							// counter
+	bool status = true;					// an optimistic return value :)
+
+	// Find the least-worn erased sector.
+	for (i = 0; i < NUM_SECTORS; i++)
+	{
+		if ((mSectors[i].state == SECTOR_STATE_FREE) &&
+			((sector == NUM_SECTORS) || (mSectors[i].eraseCount < mSectors[sector].eraseCount)))
+		{
+			sector = i;
+		}
+	}
+
+	if (sector == NUM_SECTORS)
+	{
+		status = false;
+	}
+
+	// Brand new flash doesn't have an erase count yet.
+	else if (((flashHeader_t *)SECTOR_PTR(sector))->eraseCount == HEADER_FIELD_BLANK)
+	{
+		status = WriteFlash((uint8_t *)&mSectors[sector].eraseCount,
+			HEADER_FIELD_PTR(sector, eraseCount), sizeof(uint32_t));
+	}
+
+	// Give it the next sequence number, so it's read after the others.
+	if (status == true)
+	{
+		mSectors[sector].sequence = mSequence + 1;
+		status = WriteFlash((uint8_t *)&mSectors[sector].sequence,
+			HEADER_FIELD_PTR(sector, sequence), sizeof(uint32_t));
+	}
+
+#ifdef FLASH_SAVE_STATS
+	// Save the totals so far, including the bytes of the totals themselves.
+	// (WriteFlash adds to mTotals, so write a copy.)
+	if (status == true)
+	{
+		totals = mTotals;
+		totals.flashBytes += sizeof(totals);
+		status = WriteFlash((uint8_t *)&totals, HEADER_FIELD_PTR(sector, totals), sizeof(totals));
+	}
+#endif
+
+	if (status == true)
+	{
+		status = SetSectorFlags(sector, HEADER_FLAG_VALID);
 	}
 
-	// From now on we'll use the destination sector.  Mark it as valid.
 	if (status == true)
 	{
-		status = SetSectorFlags(dstSectorPtr, HEADER_FLAG_VALID);
+		mSequence++;
+		mSectors[sector].state = SECTOR_STATE_USED;
+		mNumFreeSectors--;
+		mHeadSector = sector;
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Assemble a record in RAM.
+ * @param	varRec - where to put the record (RECORD_SIZE(size) bytes)
+ * @param	flag - record's flag
+ * @param	id - variable's ID
+ * @param	value - variable's data
+ * @param	size - size of data [bytes]
+ */
+static void BuildRecord(flashRecord_t *varRec, uint8_t flag, uint16_t id,
+	uint8_t *value, uint16_t size)
+{
+	uint8_t *data = RECORD_DATA(varRec);	// data in the record
+	uint16_t i;							// counter
+
+	varRec->flag = flag;
+#if (MIN_WRITE_SIZE > 1)
+	for (i = 0; i < (MIN_WRITE_SIZE - 1); i++)
+	{
+		varRec->flagPadding[i] = 0xFF;
+	}
+#endif
+	varRec->size = (uint8_t)size;
+	varRec->id = id;
+
+	for (i = 0; i < size; i++)
+	{
+		data[i] = value[i];
+	}
+
+#ifdef FLASH_USE_CHECKSUM
+	varRec->checksum = CalculateChecksum(varRec);
+#endif
+
+	// Leave padding erased, so it isn't programmed.
+	for (i = sizeof(flashRecord_t) + size; i < RECORD_SIZE(size); i++)
+	{
+		((uint8_t *)varRec)[i] = 0xFF;
+	}
+}
+
+/**
+ * @brief	Write a record to the end of the head sector.
+ * @remarks	The caller must make sure there's room for it.
+ * @param	varRec - variable record to store
+ * @param	flag - flag to give the stored record
+ * @returns	true for success; false otherwise
+ */
+static bool WriteRecord(flashRecord_t *varRec, uint8_t flag)
+{
+	flashSectorInfo_t *head = &mSectors[mHeadSector];
+	uint8_t *flashPtr = SECTOR_PTR(mHeadSector) + head->freeOffset;
+	uint16_t size = RECORD_SIZE(varRec->size);	// bytes to write
+	uint32_t flagWord = 0xFFFFFFFF;		// the flag, padded to MIN_WRITE_SIZE
+	bool status;						// return value
+
+	// Write everything but the flag, and then the flag.  If we lose power
+	// partway through, the record isn't marked valid.
+	status = WriteFlash((uint8_t *)varRec + MIN_WRITE_SIZE, flashPtr + MIN_WRITE_SIZE,
+		size - MIN_WRITE_SIZE);
+	if (status == true)
+	{
+		((uint8_t *)&flagWord)[0] = flag;
+		status = WriteFlash((uint8_t *)&flagWord, flashPtr, MIN_WRITE_SIZE);
+	}
+
+	if (status == true)
+	{
+		head->freeOffset += size;
+
+		if (flag == DATA_FLAG_COPY)
+		{
+			mTotals.copies++;
+		}
+		else if ((flag != DATA_FLAG_COMMIT) && (flag != DATA_FLAG_CHECKPOINT))
+		{
+			mTotals.sets++;
+			mTotals.dataBytes += varRec->size;
+		}
+	}
+	else
+	{
+		// Don't write over a failed record.  Use a new sector next time.
+		head->freeOffset = SECTOR_SIZE;
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Write a record to the end of the head sector, and point the
+ *			lookup table at it.
+ * @remarks	The caller must make sure there's room for it.
+ * @param	varRec - variable record to store
+ * @param	flag - DATA_FLAG_VALID, or DATA_FLAG_COPY for garbage collection
+ * @param	entry - the variable's entry in the lookup table (or the unused
+ *			entry where it goes)
+ * @returns	true for success; false otherwise
+ */
+static bool AppendRecord(flashRecord_t *varRec, uint8_t flag, flashTableEntry_t *entry)
+{
+	uint32_t offset = mSectors[mHeadSector].freeOffset;	// where it goes
+	bool status;						// return value
+
+	status = WriteRecord(varRec, flag);
+
+	if (status == true)
+	{
+		SetTableEntry(entry, varRec, mHeadSector, offset);
+	}
+
+	return status;
+}
+
+#if (CHECKPOINT_ENTRIES > 0)
+/**
+ * @brief	Write an index checkpoint to the start of the head sector.
+ * @remarks	It's left out if there are more than CHECKPOINT_ENTRIES
+ *			variables.  There's always at least one record, even with no
+ *			variables.
+ * @returns	true for success; false otherwise
+ */
+static bool WriteCheckpoint(void)
+{
+	union								// record to be stored in flash
+	{
+		flashRecord_t header;
+		uint8_t bytes[RECORD_SIZE(CHECKPOINT_RECORD_ENTRIES * sizeof(flashCheckpointEntry_t))];
+	} cpRecord;
+	flashCheckpointEntry_t entries[CHECKPOINT_RECORD_ENTRIES];	// entries for cpRecord
+	uint16_t numEntries = 0;			// number of entries in entries[]
+	uint16_t numWritten = 0;			// entries written so far
+	uint16_t i;							// counter
+	bool status = true;					// an optimistic return value :)
+
+	if (mNumVariables <= CHECKPOINT_ENTRIES)
+	{
+		for (i = 0; (status == true) && (i < LOOKUP_TABLE_SIZE); i++)
+		{
+			if (mLookupTable[i].id != LOOKUP_ID_EMPTY)
+			{
+				entries[numEntries].id = mLookupTable[i].id;
+				entries[numEntries].offset = mLookupTable[i].offset;
+				entries[numEntries].sector = mLookupTable[i].sector;
+				numEntries++;
+			}
+
+			// Write a record when it's full, and at the end.
+			if ((numEntries == CHECKPOINT_RECORD_ENTRIES) ||
+				((i == (LOOKUP_TABLE_SIZE - 1)) && ((numEntries > 0) || (numWritten == 0))))
+			{
+				BuildRecord(&cpRecord.header, DATA_FLAG_CHECKPOINT, mNumVariables,
+					(uint8_t *)entries, numEntries * sizeof(flashCheckpointEntry_t));
+				status = WriteRecord(&cpRecord.header, DATA_FLAG_CHECKPOINT);
+				numWritten += numEntries;
+				numEntries = 0;
+			}
+		}
+	}
+
+	return status;
+}
+#endif
+
+/**
+ * @brief	Pick a sector to garbage collect.
+ * @remarks	Usually picks the sector with the least current data, since
+ *			that's the least work.  If a sector has been erased much less
+ *			than the others, it's probably holding variables that never
+ *			change, so it's picked instead to spread out the wear.  Until
+ *			the collection is finished, room is kept in the head for the
+ *			sector's current records (see HeadRoom).
+ * @returns	true for success; false if nothing fits in the head
+ */
+static bool StartCollection(void)
+{
+	uint8_t victim = NUM_SECTORS;		// sector to erase
+	uint8_t coldest = NUM_SECTORS;		// least-worn sector with data
+	uint32_t maxEraseCount = 0;			// erase count of most-worn sector
+	uint32_t room;						// free bytes in the head sector
+	uint16_t i;							// counter
+	bool status = true;					// an optimistic return value :)
+
+	room = SECTOR_SIZE - mSectors[mHeadSector].freeOffset;
+
+	for (i = 0; i < NUM_SECTORS; i++)
+	{
+		if (mSectors[i].eraseCount > maxEraseCount)
+		{
+			maxEraseCount = mSectors[i].eraseCount;
+		}
+
+		// Only sectors with records (other than the head) can be collected.
+		if ((mSectors[i].state != SECTOR_STATE_USED) || (i == mHeadSector))
+		{
+			continue;
+		}
+
+		if ((victim == NUM_SECTORS) || (mSectors[i].liveBytes < mSectors[victim].liveBytes))
+		{
+			victim = (uint8_t)i;
+		}
+
+		if ((coldest == NUM_SECTORS) || (mSectors[i].eraseCount < mSectors[coldest].eraseCount))
+		{
+			coldest = (uint8_t)i;
+		}
+	}
+
+	// Level the wear, if it's uneven and the data fits (leaving room for
+	// the record that's waiting to be written).
+	if ((coldest != NUM_SECTORS) &&
+		((maxEraseCount - mSectors[coldest].eraseCount) > WEAR_LEVEL_THRESHOLD) &&
+		((mSectors[coldest].liveBytes + MAX_RECORD_SIZE) <= room))
+	{
+		victim = coldest;
+	}
+
+	// If even the emptiest sector doesn't fit in the head, flash is full.
+	if ((victim == NUM_SECTORS) || (mSectors[victim].liveBytes > room))
+	{
+		status = false;
+	}
+	else
+	{
+		mVictim = victim;
+		mVictimStep = 0;
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Do one step of the garbage collection that's under way:  copy a
+ *			few of the victim's current records to the head, or erase one
+ *			of its segments.
+ * @returns	true for success; false for error
+ */
+static bool CollectionStep(void)
+{
+	uint16_t copies = 0;				// records copied in this step
+	uint16_t segment;					// segment to erase
+	bool status = true;					// an optimistic return value :)
+
+	// The head may have been given up on after a failed write.
+	if ((SECTOR_SIZE - mSectors[mHeadSector].freeOffset) < mSectors[mVictim].liveBytes)
+	{
+		status = false;
+	}
+
+	// Copy some of the victim's current records to the head sector.  Any
+	// that were set since the collection started are already elsewhere.
+	while ((status == true) && (mVictimStep < LOOKUP_TABLE_SIZE) &&
+		(copies < FLASH_GC_STEP_RECORDS))
+	{
+		if ((mLookupTable[mVictimStep].id != LOOKUP_ID_EMPTY) &&
+			(mLookupTable[mVictimStep].sector == mVictim))
+		{
+			status = AppendRecord((flashRecord_t *)(SECTOR_PTR(mVictim) + mLookupTable[mVictimStep].offset),
+				DATA_FLAG_COPY, &mLookupTable[mVictimStep]);
+			copies++;
+		}
+		mVictimStep++;
+	}
+
+	if ((status == true) && (copies == 0))
+	{
+		segment = mVictimStep - LOOKUP_TABLE_SIZE;
+
+		// We're finished with the victim.  Mark it as invalid, so its
+		// records are ignored if we're reset before it's erased.
+		if (segment == 0)
+		{
+			status = SetSectorFlags(mVictim, HEADER_FLAG_INVALID);
+		}
+
+		// Erase the victim (so we can use it in the future), a segment at a
+		// time with the header's last.
+		if (status == true)
+		{
+			EraseSegment(mVictim, SEGMENTS_PER_SECTOR - segment - 1);
+			mVictimStep++;
+
+			if ((segment + 1) == SEGMENTS_PER_SECTOR)
+			{
+				status = FinishErase(mVictim);
+				if (status == true)
+				{
+					mTotals.collections++;
+				}
+				mVictim = NUM_SECTORS;
+			}
+		}
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Finish collecting garbage:  copy the rest of a sector's current
+ *			records to the head, and erase it.
+ * @remarks	Starts a collection if there isn't one under way.
+ * @returns	true for success; false if nothing fits in the head, or error
+ */
+static bool CollectGarbage(void)
+{
+	bool status = true;					// an optimistic return value :)
+
+	if (mVictim == NUM_SECTORS)
+	{
+		status = StartCollection();
+	}
+
+	while ((status == true) && (mVictim != NUM_SECTORS))
+	{
+		status = CollectionStep();
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Get the room left in the head sector for new records.
+ * @remarks	Doesn't count room that's needed for the current records of a
+ *			sector being garbage collected, plus room for two copies that
+ *			are cut off by resets (one by the collection task, and one while
+ *			a set finishes the collection after the reboot).
+ * @returns	free bytes
+ */
+static uint32_t HeadRoom(void)
+{
+	uint32_t room;						// return value
+	uint32_t needed;					// room needed to finish collecting
+
+	room = SECTOR_SIZE - mSectors[mHeadSector].freeOffset;
+	if (mVictim != NUM_SECTORS)
+	{
+		needed = mSectors[mVictim].liveBytes + (2 * MAX_RECORD_SIZE);
+		room = (room > needed) ? (room - needed) : 0;
+	}
+
+	return room;
+}
+
+/**
+ * @brief	Make sure the head sector has room for a record, and that an
+ *			erased sector is kept in reserve.
+ * @remarks	Opens new head sectors and collects garbage as needed.  With
+ *			FLASH_GC_INCREMENTAL, garbage collection is only started here,
+ *			and only finished if the head fills up first.
+ * @param	size - size of the record [bytes]
+ * @returns	true for success; false if flash is full, or error
+ */
+static bool MakeRoom(uint32_t size)
+{
+	uint16_t attempts = 0;				// steps taken so far
+	bool done = false;					// is there room?
+	bool status = true;					// an optimistic return value :)
+
+	while ((status == true) && (done == false))
+	{
+		// Each step either erases a sector or fills one up.  If we keep going
+		// around, every sector is full of current data.
+		if (attempts++ >= (3 * NUM_SECTORS))
+		{
+			status = false;
+		}
+
+		// The reserve sector is needed to copy data out of other sectors.
+		else if ((mNumFreeSectors == 0) && (mVictim == NUM_SECTORS))
+		{
+			status = StartCollection();
+		}
+		else if ((mNumFreeSectors == 0) &&
+			((FLASH_GC_INCREMENTAL == 0) || (HeadRoom() < size)))
+		{
+			status = CollectGarbage();
+		}
+
+		// Move the head to an erased sector.
+		else if (HeadRoom() < size)
+		{
+			status = OpenHeadSector();
+
+#if (CHECKPOINT_ENTRIES > 0)
+			if (status == true)
+			{
+				status = WriteCheckpoint();
+			}
+#endif
+		}
+		else
+		{
+			done = true;
+		}
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Get a variable's newest record.
+ * @param	variableId - which variable to look for
+ * @returns	the record if found; NULL otherwise
+ */
+static flashRecord_t *GetVariableRecord(uint16_t variableId)
+{
+	flashTableEntry_t *entry;			// variable's entry in the lookup table
+	flashRecord_t *varRec = NULL;		// pessimistic return value :(
+
+	entry = FindTableEntry(variableId);
+
+	// Find the record.
+	if (entry->id == variableId)
+	{
+		varRec = (flashRecord_t *)(SECTOR_PTR(entry->sector) + entry->offset);
+	}
+
+	return varRec;
+}
+
+/**
+ * @brief	Store a variable's value in flash, unless flash already has it.
+ * @param	id - variable to act upon
+ * @param	value - data to store in variable
+ * @param	size - size of data [bytes] (already checked)
+ * @returns	true for success; false if there's no room, or error
+ */
+static bool StoreVariable(uint16_t id, uint8_t *value, uint16_t size)
+{
+	union								// record to be stored in flash
+	{
+		flashRecord_t header;			// record's header...
+		uint8_t bytes[MAX_RECORD_SIZE];	// ...followed by data and padding
+	} newRecord;
+	flashRecord_t *oldRec;				// variable's current record
+	uint8_t *oldData;					// data in oldRec
+	uint32_t oldSize = 0;				// size of current record [bytes]
+	bool preexisting = false;			// is the value already in flash?
+	uint16_t i;							// counter
+	bool status = true;					// optimistic return value :)
+
+	// If the variable already exists...
+	oldRec = GetVariableRecord(id);
+	if (oldRec != NULL)
+	{
+		oldSize = RECORD_SIZE(oldRec->size);
+		oldData = RECORD_DATA(oldRec);
+
+		// If it's a different size, it's a different value.
+		preexisting = (oldRec->size == size);
+
+		// Compare current value with new value.
+		for (i = 0; (preexisting == true) && (i < size); i++)
+		{
+			// If new value is different from the old value then we haven't
+			// succeeded yet.  If the two values are the same, then we're done.
+			if (value[i] != oldData[i])
+			{
+				preexisting = false;
+			}
+		}
+	}
+
+	// New variables, and variables that grow, have to fit in CAPACITY.
+	// (Otherwise garbage collection might not be able to make room.)
+	if ((preexisting == false) && (RECORD_SIZE(size) > oldSize) &&
+		((mLiveBytes + mCachedGrowth + RECORD_SIZE(size) - oldSize) > CAPACITY))
+	{
+		status = false;
+	}
+
+	// Do nothing if we've already suceeded (new data is already in memory).
+	// If the data is not in memory (preexisting = false) then store it.
+	if ((status == true) && (preexisting == false))
+	{
+		// Make room for the record (this may collect garbage).
+		status = MakeRoom(RECORD_SIZE(size));
+
+		if (status == true)
+		{
+			// Assemble variable record.
+			BuildRecord(&newRecord.header, DATA_FLAG_VALID, id, value, size);
+
+			// Store record in the head sector, and point the lookup table
+			// at it.  Only this entry changed, so there's no need to
+			// rebuild the table.
+			status = AppendRecord(&newRecord.header, DATA_FLAG_VALID, FindTableEntry(id));
+		}
+	}
+
+	return status;
+}
+
+#if (FLASH_CACHE_SIZE > 0)
+/**
+ * @brief	Find a variable in the cache.
+ * @param	id - variable to look for
+ * @returns	the variable's cache entry; NULL if it isn't cached
+ */
+static flashCacheEntry_t *FindCacheEntry(uint16_t id)
+{
+	flashCacheEntry_t *entry = NULL;	// return value
+	uint8_t i;							// counter
+
+	for (i = 0; (entry == NULL) && (i < mNumCached); i++)
+	{
+		if (mCache[i].id == id)
+		{
+			entry = &mCache[i];
+		}
+	}
+
+	return entry;
+}
+
+/**
+ * @brief	Load a cached variable's value from flash.
+ * @param	entry - variable's cache entry
+ */
+static void LoadCacheEntry(flashCacheEntry_t *entry)
+{
+	flashRecord_t *varRec;				// variable's record in flash
+	uint16_t i;							// counter
+
+	varRec = GetVariableRecord(entry->id);
+
+	// A clean entry won't add anything when the cache is flushed.
+	mCachedGrowth -= entry->growth;
+	entry->growth = 0;
+
+	entry->stored = (varRec != NULL);
+	entry->dirty = false;
+	entry->size = 0;
+
+	if (varRec != NULL)
+	{
+		entry->size = varRec->size;
+		for (i = 0; i < varRec->size; i++)
+		{
+			entry->data[i] = RECORD_DATA(varRec)[i];
+		}
+	}
+}
+
+/**
+ * @brief	Set the value of a cached variable.
+ * @remarks	Only RAM changes, until the cache is flushed.
+ * @param	entry - variable's cache entry
+ * @param	value - data to store in variable
+ * @param	size - size of data [bytes] (already checked)
+ * @returns	true for success; false if it won't fit in flash, or error
+ */
+static bool SetCachedVariable(flashCacheEntry_t *entry, uint8_t *value, uint16_t size)
+{
+	flashRecord_t *oldRec;				// variable's record in flash
+	uint32_t oldSize = 0;				// size of that record [bytes]
+	uint16_t growth = 0;				// bytes flushing the new value will add
+	bool same;							// is the value the same?
+	uint16_t i;							// counter
+	bool status = true;					// optimistic return value :)
+
+	same = (entry->stored == true) && (entry->size == size);
+	for (i = 0; (same == true) && (i < size); i++)
+	{
+		same = (entry->data[i] == value[i]);
 	}
 
-	// Erase the source sector (so we can use it in the future).
-	if (status == true)
+	// Make sure it'll fit when it's flushed, along with the other cached
+	// variables that haven't been flushed yet.
+	oldRec = GetVariableRecord(entry->id);
+	if (oldRec != NULL)
 	{
-		status = EraseSector(srcSectorPtr);
+		oldSize = RECORD_SIZE(oldRec->size);
 	}
-
-	if (status == true)
+	if (RECORD_SIZE(size) > oldSize)
 	{
-		// Update the global variable that points to the sector we're using.
-		validSectorPtr = dstSectorPtr;
-
-		// Get next free location in the sector we're using.
-		validFreeOffset = GetNextFreeOffset(validSectorPtr);
+		growth = (uint16_t)(RECORD_SIZE(size) - oldSize);
+	}
+	if ((same == false) && (growth > entry->growth) &&
+		((mLiveBytes + mCachedGrowth - entry->growth + growth) > CAPACITY))
+	{
+		status = false;
+	}
 
-		// Regenerate lookup table for the new sector.
-		ConstructLookupTable();
+	if ((status == true) && (same == false))
+	{
+		for (i = 0; i < size; i++)
+		{
+			entry->data[i] = value[i];
+		}
+		entry->size = (uint8_t)size;
+		entry->stored = true;
+		entry->dirty = true;
+		mCachedGrowth = mCachedGrowth - entry->growth + growth;
+		entry->growth = growth;
+
+		// Flush every so many sets.
+		mCacheSets++;
+		if ((FLASH_CACHE_FLUSH_SETS > 0) && (mCacheSets >= FLASH_CACHE_FLUSH_SETS))
+		{
+			status = FlashManFlush();
+		}
 	}
 
 	return status;
 }
+#endif
 
+#ifdef FLASH_SAVE_STATS
 /**
- * @brief	Get the offset of a variable into the valid sector
- * @param	variableId - which variable to look for
- * @param	offset - the offset found (if valid)
- * @returns	offset or INVALID_VAR_OFFSET if not found
+ * @brief	Load the statistics' totals from flash.
+ * @remarks	Starts from the totals saved when the head sector was opened,
+ *			and adds the records written to it since then.
  */
-static bool GetVariableOffset(uint16_t variableId, uint32_t *offset)
+static void LoadTotals(void)
 {
-	uint16_t i;				// counter
-	bool status = false;	// pessimistic return value :(
+	volatile flashHeader_t *secRec = (flashHeader_t *)SECTOR_PTR(mHeadSector);
+	flashRecord_t *varRec;				// record being counted
+	uint32_t offset = sizeof(flashHeader_t);	// offset of varRec
+
+	mTotals = secRec->totals;
+
+	// Sectors opened before the totals were saved don't have any.
+	if (mTotals.sets == HEADER_FIELD_BLANK)
+	{
+		mTotals.sets = 0;
+		mTotals.copies = 0;
+		mTotals.collections = 0;
+		mTotals.dataBytes = 0;
+		mTotals.flashBytes = 0;
+	}
+
+	varRec = (flashRecord_t *)(SECTOR_PTR(mHeadSector) + offset);
+	if (varRec->size == DATA_SIZE_BLANK)
+	{
+		varRec = NULL;
+	}
 
-	for (i = 0; i < mNumVariables; i++)
+	while (varRec != NULL)
 	{
-		// Find the offset.
-		if (mLookupTable[i].id == variableId)
+		if (IsVariableRecordValid(varRec))
 		{
-			*offset = mLookupTable[i].offset;
-			status = true;
+			if (varRec->flag == DATA_FLAG_COPY)
+			{
+				mTotals.copies++;
+			}
+			else if ((varRec->flag != DATA_FLAG_COMMIT) && (varRec->flag != DATA_FLAG_CHECKPOINT))
+			{
+				mTotals.sets++;
+				mTotals.dataBytes += varRec->size;
+			}
 		}
+
+		varRec = GetNextRecord(SECTOR_PTR(mHeadSector), &offset);
 	}
 
-  return status;
+	mTotals.flashBytes += mSectors[mHeadSector].freeOffset - sizeof(flashHeader_t);
 }
+#endif
 
 /**************************************************************************
 Public functions
@@ -460,237 +1892,175 @@ Public functions
 
 /**
  * @brief	Initialize access to non-volatile memory.
- * @remarks	Identifies which sector is the valid one and completes any
- * 			partially completed operations that may have been taking place
- * 			before the last reset
+ * @remarks	Finds the sectors that hold records and completes any partially
+ * 			completed operations that may have been taking place before the
+ * 			last reset
  * @returns	true for success; false otherwise
  */
 bool FlashManInit(void)
 {
-	volatile flashHeader_t *mSec1Rec = (flashHeader_t *)(sectorPtr1);
-	volatile flashHeader_t *mSec2Rec = (flashHeader_t *)(sectorPtr2);
-	uint32_t sector1Flag;
-	uint32_t sector2Flag;
+	volatile flashHeader_t *secRec;		// header of sector being checked
+	uint32_t maxEraseCount = 0;			// erase count of most-worn sector
+	uint16_t flags;						// sector's flags
+	uint8_t i;							// counter
 	bool status = true;					// an optimistic flag :)
 
-	// Compile sector flags into single values.
-	sector1Flag = ((uint32_t)(mSec1Rec->flag1[0]) << 16) | ((uint32_t)(mSec1Rec->flag2[0]) << 8) | mSec1Rec->flag3[0];
-	sector2Flag = ((uint32_t)(mSec2Rec->flag1[0]) << 16) | ((uint32_t)(mSec2Rec->flag2[0]) << 8) | mSec2Rec->flag3[0];
-
-	// If sector 1 has invalid flags then erase it and reset the flag.
-	if ((sector1Flag != HEADER_FLAG_EMPTY)	&&
-		(sector1Flag != HEADER_FLAG_INIT)	&&
-		(sector1Flag != HEADER_FLAG_VALID)	&&
-		(sector1Flag != HEADER_FLAG_INVALID))
-	{
-		// TODO:  Should I check the return value from this?
-		EraseSector(sectorPtr1);
-		sector1Flag = HEADER_FLAG_EMPTY;
-	}
-
-	// If sector 2 has invalid flags then erase it and reset the flag.
-	if ((sector2Flag != HEADER_FLAG_EMPTY)	&&
-		(sector2Flag != HEADER_FLAG_INIT)	&&
-		(sector2Flag != HEADER_FLAG_VALID)	&&
-		(sector2Flag != HEADER_FLAG_INVALID))
-	{
-		// TODO:  Should I check the return value from this?
-		EraseSector(sectorPtr2);
-		sector2Flag = HEADER_FLAG_EMPTY;
-	}
-
-	// What happens next depends on status of both sectors:
-	switch (sector1Flag)
-	{
-	case HEADER_FLAG_EMPTY:
-		switch (sector2Flag)
-		{
-		// Sector 1 empty, sector 2 empty.
-		case HEADER_FLAG_EMPTY:
-			// Set sector 1 as valid.
-			status = SetSectorFlags(sectorPtr1, HEADER_FLAG_VALID);
-			// Use sector 1.
-			validSectorPtr = sectorPtr1;
-			validFreeOffset = sizeof(flashHeader_t);
-			break;
-
-		// Sector 1 empty, sector 2 initializing.
-		case HEADER_FLAG_INIT:
-			// Set sector 2 as valid.
-			status = SetSectorFlags(sectorPtr2, HEADER_FLAG_VALID);
-			// Use sector 2.
-			validSectorPtr = sectorPtr2;
-			validFreeOffset = sizeof(flashHeader_t);
-			break;
-
-		// Sector 1 empty, sector 2 valid.
-		case HEADER_FLAG_VALID:
-			// Use sector 2.
-			validSectorPtr = sectorPtr2;
-			validFreeOffset = GetNextFreeOffset(sectorPtr2);
-			break;
-
-		// Sector 1 empty, sector 2 invalid.
-		case HEADER_FLAG_INVALID:
-			// Swap sectors 2 -> 1.
-			status = SwapSectors(sectorPtr2, sectorPtr1);
-			// Use sector 1.
-			validSectorPtr = sectorPtr1;
-			validFreeOffset = GetNextFreeOffset(sectorPtr1);
-			break;
-		}
-		break;
-
-	case HEADER_FLAG_INIT:
-		switch (sector2Flag)
-		{
-		// Sector 1 initializing, sector 2 empty.
-		case HEADER_FLAG_EMPTY:
-			// Set sector 1 as valid.
-			status = SetSectorFlags(sectorPtr1, HEADER_FLAG_VALID);
-			// Use sector 1.
-			validSectorPtr = sectorPtr1;
-			validFreeOffset = sizeof(flashHeader_t);
-			break;
-
-		// Sector 1 initializing, sector 2 initializing.
-		case HEADER_FLAG_INIT:
-			// Erase sector 2.
-			status = EraseSector(sectorPtr2);
-			// Set sector 1 as valid.
-			if (status == true)
-				status = SetSectorFlags(sectorPtr1, HEADER_FLAG_VALID);
-			// Use sector 1.
-			validSectorPtr = sectorPtr1;
-			validFreeOffset = sizeof(flashHeader_t);
-			break;
-
-		// Sector 1 initializing, sector 2 valid.
-		case HEADER_FLAG_VALID:
-			// Erase sector 1.
-			status = EraseSector(sectorPtr1);
-			// Swap sectors 2 -> 1.
-			if (status == true)
-				status = SwapSectors(sectorPtr2, sectorPtr1);
-			// Use sector 1.
-			validSectorPtr = sectorPtr1;
-			validFreeOffset = GetNextFreeOffset(sectorPtr1);
-			break;
-
-		// Sector 1 initializing, sector 2 invalid.
-		case HEADER_FLAG_INVALID:
-			// Erase sector 2.
-			status = EraseSector(sectorPtr2);
-			// Set sector 1 as valid.
-			if (status == true)
-				status = SetSectorFlags(sectorPtr1, HEADER_FLAG_VALID);
-			// Use sector 1.
-			validSectorPtr = sectorPtr1;
-			validFreeOffset = sizeof(flashHeader_t);
-			break;
-		}
-		break;
-
-	case HEADER_FLAG_VALID:
-		switch (sector2Flag)
-		{
-		// Sector 1 valid, sector 2 empty.
-		case HEADER_FLAG_EMPTY:
-			// Use sector 1.
-			validSectorPtr = sectorPtr1;
-			validFreeOffset = GetNextFreeOffset(sectorPtr1);
-			break;
-
-		// Sector 1 valid, sector 2 initializing.
-		case HEADER_FLAG_INIT:
-			// Erase sector 2.
-			status = EraseSector(sectorPtr2);
-			// Swap sectors 1 -> 2.
-			if (status == true)
-				status = SwapSectors(sectorPtr1, sectorPtr2);
-			// Use sector 2.
-			validSectorPtr = sectorPtr2;
-			validFreeOffset = GetNextFreeOffset(sectorPtr2);
-			break;
-
-		// Sector 1 valid, sector 2 valid.
-		case HEADER_FLAG_VALID:
-			// Erase sector 2.
-			status = EraseSector(sectorPtr2);
-			// Use sector 1.
-			validSectorPtr = sectorPtr1;
-			validFreeOffset = GetNextFreeOffset(sectorPtr1);
-			break;
-
-		// Sector 1 valid, sector 2 invalid.
-		case HEADER_FLAG_INVALID:
-			// Erase sector 2.
-			status = EraseSector(sectorPtr2);
-			// Use sector 1.
-			validSectorPtr = sectorPtr1;
-			validFreeOffset = GetNextFreeOffset(sectorPtr1);
-			break;
-		}
-		break;
-
-	case HEADER_FLAG_INVALID:
-		switch (sector2Flag)
-		{
-		// Sector 1 invalid, sector 2 empty.
-		case HEADER_FLAG_EMPTY:
-			// Swap sectors 1 -> 2.
-			status = SwapSectors(sectorPtr1, sectorPtr2);
-			// Use sector 2.
-			validSectorPtr = sectorPtr2;
-			validFreeOffset = GetNextFreeOffset(sectorPtr2);
-			break;
-
-		// Sector 1 invalid, sector 2 initializing.
-		case HEADER_FLAG_INIT:
-			// Erase sector 1.
-			status = EraseSector(sectorPtr1);
-			// Set sector 2 as valid.
-			if (status == true)
-				SetSectorFlags(sectorPtr2, HEADER_FLAG_VALID);
-			// Use sector 2.
-			validSectorPtr = sectorPtr2;
-			validFreeOffset = sizeof(flashHeader_t);
-			break;
-
-		// Sector 1 invalid, sector 2 valid.
-		case HEADER_FLAG_VALID:
-			// Erase sector 1.
-			status = EraseSector(sectorPtr1);
-			// Use sector 2.
-			validSectorPtr = sectorPtr2;
-			validFreeOffset = GetNextFreeOffset(sectorPtr2);
-			break;
-
-		// Sector 1 invalid, sector 2 invalid.
-		case HEADER_FLAG_INVALID:
-			// Both sectors invalid so erase both.
-			status = EraseSector(sectorPtr1);
-			if (status == true)
-				status = EraseSector(sectorPtr2);
-			// Set sector 1 as valid.
-			if (status == true)
-				status = SetSectorFlags(sectorPtr1, HEADER_FLAG_VALID);
-			// Use sector 1.
-			validSectorPtr = sectorPtr1;
-			validFreeOffset = sizeof(flashHeader_t);
-			break;
+	mNumFreeSectors = 0;
+	mSequence = 0;
+	mVictim = NUM_SECTORS;
+	mTotals.sets = 0;
+	mTotals.copies = 0;
+	mTotals.collections = 0;
+	mTotals.dataBytes = 0;
+	mTotals.flashBytes = 0;
+#if (FLASH_CACHE_SIZE > 0)
+	mNumCached = 0;
+	mCacheSets = 0;
+	mCacheTicks = 0;
+#endif
+	mCachedGrowth = 0;
+
+	// Read the erase counts.  Brand new flash, and sectors that lost power
+	// right after being erased, don't have one; assume the worst for those.
+	for (i = 0; i < NUM_SECTORS; i++)
+	{
+		secRec = (flashHeader_t *)SECTOR_PTR(i);
+		mSectors[i].eraseCount = secRec->eraseCount;
+		if ((mSectors[i].eraseCount != HEADER_FIELD_BLANK) && (mSectors[i].eraseCount > maxEraseCount))
+		{
+			maxEraseCount = mSectors[i].eraseCount;
+		}
+	}
+
+	for (i = 0; i < NUM_SECTORS; i++)
+	{
+		secRec = (flashHeader_t *)SECTOR_PTR(i);
+		flags = GetSectorFlags(i);
+
+		if (mSectors[i].eraseCount == HEADER_FIELD_BLANK)
+		{
+			mSectors[i].eraseCount = maxEraseCount;
+		}
+
+		// Sectors with records.
+		if ((flags == HEADER_FLAG_VALID) && (secRec->sequence != HEADER_FIELD_BLANK))
+		{
+			mSectors[i].state = SECTOR_STATE_USED;
+			mSectors[i].sequence = secRec->sequence;
+			mSectors[i].freeOffset = GetNextFreeOffset(SECTOR_PTR(i));
+
+			if (mSectors[i].sequence >= mSequence)
+			{
+				mSequence = mSectors[i].sequence;
+				mHeadSector = i;
+			}
+		}
+
+		// Erased sectors.  (Opening a sector writes its sequence number
+		// first, so one that lost power while being opened has one.)
+		else if ((flags == HEADER_FLAG_EMPTY) &&
+				 (secRec->sequence == HEADER_FIELD_BLANK) &&
+				 (((flashRecord_t *)(SECTOR_PTR(i) + sizeof(flashHeader_t)))->size == DATA_SIZE_BLANK))
+		{
+			mSectors[i].state = SECTOR_STATE_FREE;
+			mSectors[i].freeOffset = sizeof(flashHeader_t);
+			mSectors[i].liveBytes = 0;
+			mNumFreeSectors++;
+		}
+
+		// Sectors that were copied elsewhere, were being opened, or have
+		// corrupted flags.  Erase them.
+		else
+		{
+			if (EraseSector(i) != true)
+			{
+				status = false;
+			}
+		}
+	}
+
+	// Generate lookup table.  Start from the head's index checkpoint if it
+	// has one; otherwise read every sector.
+#if (CHECKPOINT_ENTRIES > 0)
+	if (LoadCheckpoint() != true)
+#endif
+	{
+		ConstructLookupTable();
+	}
+
+#ifdef FLASH_SAVE_STATS
+	if (mSequence != 0)
+	{
+		LoadTotals();
+	}
+#endif
+
+	// If no sector has records, start one.
+	if (mSequence == 0)
+	{
+		if (OpenHeadSector() != true)
+		{
+			status = false;
+		}
+	}
+
+	// If we lost power before garbage collection finished, finish it.
+	if (MakeRoom(0) != true)
+	{
+		status = false;
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Get a variable's value, without copying it.
+ * @remarks	Flash is memory-mapped, so this points right at the variable's
+ *			record (or at its cache entry, for cached variables).  The
+ *			pointer is only good until flash is written again:  any set,
+ *			commit, flush or FlashManCollectTask can collect garbage and
+ *			erase the record.  Don't write through it.
+ * @param	id - variable to act upon
+ * @param	value - returns a pointer to the variable's data
+ * @param	size - returns the size of the variable's data [bytes]
+ * @returns	true for success; false if the variable hasn't been stored
+ */
+bool FlashManGetVariableRef(uint16_t id, const uint8_t **value, uint16_t *size)
+{
+	flashRecord_t *varRec;				// variable's record in flash
+	bool status = true;					// optimistic return value :)
+#if (FLASH_CACHE_SIZE > 0)
+	flashCacheEntry_t *entry = FindCacheEntry(id);	// variable's cache entry
+
+	// Cached variables are read from RAM.
+	if (entry != NULL)
+	{
+		status = entry->stored;
+		*value = entry->data;
+		*size = entry->size;
+	}
+	else
+#endif
+	{
+		varRec = GetVariableRecord(id);
+		if (varRec == NULL)
+		{
+			status = false;
+		}
+		else
+		{
+			*value = RECORD_DATA(varRec);
+			*size = varRec->size;
 		}
-		break;
 	}
-  
-	// generate lookup table
-	ConstructLookupTable();
 
 	return status;
 }
 
 /**
  * @brief	Get the value of a variable.
+ * @remarks	If the variable was stored with fewer bytes than requested, the
+ *			rest of the value is filled with zeros.
  * @param	id - variable to act upon
  * @param	value - data fetched from variable
  * @param	size - size of variable [bytes]
@@ -698,33 +2068,24 @@ bool FlashManInit(void)
  */
 bool FlashManGetVariable(uint16_t id, uint8_t *value, uint16_t size)
 {
-	uint32_t offset;					// address of data to read from flash
-	flashData_t *data;					// data copied from flash
+	const uint8_t *data;				// variable's data
+	uint16_t dataSize;					// size of variable's data [bytes]
 	uint16_t i;							// counter
-	bool status = true;					// optimistic return value :)
-
-	// Check for valid size.
-	if (size > MAX_VARIABLE_SIZE)
-	{
-		status = false;
-	}
+	bool status;						// return value
 
-	// Find offset for variable.
-	if (status == true)
-	{
-		status = GetVariableOffset(id, &offset);
-	}
+	// Check for valid size, and find the data.
+	status = (size <= MAX_VARIABLE_SIZE) && FlashManGetVariableRef(id, &data, &dataSize);
 
 	// Continue if we had success.
 	if (status == true)
 	{
-		// Get variable record.
-		data = (flashData_t *)(validSectorPtr + offset);
-
 		// Copy data.
 		for (i = 0; i < size; i++)
 		{
-			value[i] = data->data[i];
+			if (i < dataSize)
+				value[i] = data[i];
+			else
+				value[i] = 0x00;
 		}
 	}
 
@@ -740,106 +2101,296 @@ bool FlashManGetVariable(uint16_t id, uint8_t *value, uint16_t size)
  */
 bool FlashManSetVariable(uint16_t id, uint8_t *value, uint16_t size)
 {
-	uint16_t i;							// counter
-	flashData_t flashData;				// structure to be stored in flash
-	uint8_t oldData[MAX_VARIABLE_SIZE];	// previous value of the data
-	bool preexisting;					// is the variable already in flash?
 	bool status = true;					// optimistic return value :)
+#if (FLASH_CACHE_SIZE > 0)
+	flashCacheEntry_t *entry = FindCacheEntry(id);	// variable's cache entry
+#endif
 
-	// Check for valid size.
-	if (size > MAX_VARIABLE_SIZE)
+	// Check for valid size and ID.
+	if ((size == 0) || (size > MAX_VARIABLE_SIZE) || (id == LOOKUP_ID_EMPTY))
 	{
 		status = false;
 	}
 
-	// Get current value for this variable, if one exists.
+	// In a transaction, keep the record in RAM until it's committed.
+	else if (mInTransaction == true)
+	{
+		if ((mTransactionLength + RECORD_SIZE(size)) > TRANSACTION_SIZE)
+		{
+			status = false;
+		}
+		else
+		{
+			BuildRecord((flashRecord_t *)&mTransaction[mTransactionLength],
+				DATA_FLAG_TRANSACTION, id, value, size);
+			mTransactionLength += RECORD_SIZE(size);
+		}
+	}
+
+#if (FLASH_CACHE_SIZE > 0)
+	// Cached variables are written to flash when the cache is flushed.
+	else if (entry != NULL)
+	{
+		status = SetCachedVariable(entry, value, size);
+	}
+#endif
+
 	else
 	{
-		preexisting = FlashManGetVariable(id, oldData, size);
+		status = StoreVariable(id, value, size);
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Start a transaction.
+ * @remarks	Until the transaction is committed, FlashManSetVariable only
+ *			remembers the new values (up to TRANSACTION_SIZE bytes of
+ *			records), and FlashManGetVariable still returns the old ones.
+ * @returns	true for success; false if a transaction is already in progress
+ */
+bool FlashManBeginTransaction(void)
+{
+	bool status = !mInTransaction;		// return value
+
+	// Don't throw away the values of a transaction that's already started.
+	if (status == true)
+	{
+		mInTransaction = true;
+		mTransactionLength = 0;
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Store all of a transaction's new values at once.
+ * @remarks	The records are written to one sector, followed by a commit
+ *			record.  If power is lost before the commit record is written,
+ *			none of the new values are used.  The transaction ends either
+ *			way.
+ * @returns	true for success; false if there's no room, or error
+ */
+bool FlashManCommitTransaction(void)
+{
+	union								// commit record
+	{
+		flashRecord_t header;
+		uint8_t bytes[RECORD_SIZE(0)];
+	} commitRecord;
+	flashRecord_t *varRec;				// record being committed
+	flashRecord_t *laterRec;			// record after varRec
+	flashRecord_t *oldRec;				// variable's current record
+	int32_t growth = 0;					// change in current data [bytes]
+#if (FLASH_CACHE_SIZE > 0)
+	flashCacheEntry_t *entry;			// a variable's cache entry
+#endif
+	uint32_t bytes;						// bytes to write
+	uint32_t start;						// where the records go in the head
+	uint16_t i;							// offset of varRec
+	uint16_t j;							// offset of laterRec
+	bool status = mInTransaction;		// return value
+
+	// Work out how much the current data will grow.  (Only the last record
+	// for each variable counts.)
+	for (i = 0; i < mTransactionLength; i += RECORD_SIZE(varRec->size))
+	{
+		varRec = (flashRecord_t *)&mTransaction[i];
 
-		// If the variable already exists...
-		if (preexisting == true)
+		for (j = i + RECORD_SIZE(varRec->size); j < mTransactionLength; j += RECORD_SIZE(laterRec->size))
 		{
-			// Compare current value with new value.
-			for (i = 0; i < size; i++)
+			laterRec = (flashRecord_t *)&mTransaction[j];
+			if (laterRec->id == varRec->id)
 			{
-				// If new value is different from the old value then we haven't
-				// succeeded yet.  If the two values are the same, then we're done.
-				if (value[i] != oldData[i])
-				{
-					preexisting = false;
-					break;
-				}
+				break;
 			}
 		}
 
-		// Do nothing if we've already suceeded (new data is already in memory).
-		// If the data is not in memory (preexisting = false) then store it.
-		if (preexisting == false)
+		if (j >= mTransactionLength)
 		{
-			// If sector is full...
-			if (validFreeOffset >= SECTOR_SIZE)
+			growth += RECORD_SIZE(varRec->size);
+			oldRec = GetVariableRecord(varRec->id);
+			if (oldRec != NULL)
 			{
-				// Swap sectors.
-				if (validSectorPtr == sectorPtr1)
-				{
-					status = SwapSectors(sectorPtr1, sectorPtr2);
-				}
-				else if (validSectorPtr == sectorPtr2)
-				{
-					status = SwapSectors(sectorPtr2, sectorPtr1);
-				}
-
-				// If no space in new sector then no room for more variables.
-				if ((status == true) && (validFreeOffset >= SECTOR_SIZE))
-				{
-					status = false;
-				}
+				growth -= RECORD_SIZE(oldRec->size);
 			}
 
-			if (status == true)
+#if (FLASH_CACHE_SIZE > 0)
+			// The transaction replaces a cached value that hasn't been
+			// flushed, so that won't add anything.
+			entry = FindCacheEntry(varRec->id);
+			if (entry != NULL)
 			{
-				// Assemble variable record.
-				flashData.flag = DATA_FLAG_VALID;
-				flashData.id = id;
+				growth -= entry->growth;
+			}
+#endif
+		}
+	}
+
+	// The data has to fit in CAPACITY, and garbage collection has to be sure
+	// to make room for a write this size.
+	bytes = mTransactionLength + RECORD_SIZE(0);
+	if ((status == true) && (mTransactionLength > 0) &&
+		((((int32_t)(mLiveBytes + mCachedGrowth) + growth) > (int32_t)CAPACITY) ||
+		 ((HeadRoom() < bytes) &&
+		  (mLiveBytes > ((NUM_SECTORS - 1) * (SECTOR_ROOM - bytes))))))
+	{
+		status = false;
+	}
+
+	if ((status == true) && (mTransactionLength > 0))
+	{
+		status = MakeRoom(bytes);
+		start = mSectors[mHeadSector].freeOffset;
+
+		// Write the records.
+		for (i = 0; (status == true) && (i < mTransactionLength); i += RECORD_SIZE(varRec->size))
+		{
+			varRec = (flashRecord_t *)&mTransaction[i];
+			status = WriteRecord(varRec, DATA_FLAG_TRANSACTION);
+		}
 
-	#ifdef FLASH_USE_CHECKSUM
-				flashData.checksum = id & 0xFF;
-				flashData.checksum += (id >> 8) & 0xFF;
-	#endif
+		// Commit them.
+		if (status == true)
+		{
+			BuildRecord(&commitRecord.header, DATA_FLAG_COMMIT, mTransactionLength, NULL, 0);
+			status = WriteRecord(&commitRecord.header, DATA_FLAG_COMMIT);
+		}
+
+		if (status == true)
+		{
+			ApplyTransaction(mHeadSector, start, start + mTransactionLength);
 
-				for (i = 0; i < MAX_VARIABLE_SIZE; i++)
+#if (FLASH_CACHE_SIZE > 0)
+			// The transaction's values are newer than the cached ones.
+			for (i = 0; i < mTransactionLength; i += RECORD_SIZE(varRec->size))
+			{
+				varRec = (flashRecord_t *)&mTransaction[i];
+				if (FindCacheEntry(varRec->id) != NULL)
 				{
-					if (i < size)
-						flashData.data[i] = value[i];
-					else
-						flashData.data[i] = 0x00;
-	#ifdef FLASH_USE_CHECKSUM
-					flashData.checksum += flashData.data[i];
-	#endif
+					LoadCacheEntry(FindCacheEntry(varRec->id));
 				}
-	#ifdef FLASH_USE_CHECKSUM
-				flashData.checksum = 0x100 - flashData.checksum;
-	#endif
+			}
+#endif
+		}
+	}
 
-				// Store record in sector.
-				status = SetVariableRecord(&flashData, validSectorPtr, validFreeOffset);
+	mInTransaction = false;
 
-				if (status == true)
-				{
-					// Get offset of next free location.
-					validFreeOffset += sizeof(flashData_t);
+	return status;
+}
 
-					// Add new variable record to lookup table.
-					ConstructLookupTable();
-				}
+/**
+ * @brief	End a transaction without storing its new values.
+ */
+void FlashManAbortTransaction(void)
+{
+	mInTransaction = false;
+}
+
+/**
+ * @brief	Cache a variable in RAM.
+ * @remarks	For variables that change often (like run-hour counters).  Its
+ *			value is read from RAM, and sets only change RAM until the
+ *			cache is flushed:  every FLASH_CACHE_FLUSH_SETS sets of cached
+ *			variables, every FLASH_CACHE_FLUSH_TICKS calls to
+ *			FlashManCacheTask, or when FlashManFlush is called.  Sets that
+ *			haven't been flushed are lost if power is, so call FlashManFlush
+ *			before powering down.  FlashManInit empties the cache.
+ * @param	id - variable to cache
+ * @returns	true for success; false if the cache is full
+ */
+bool FlashManCacheVariable(uint16_t id)
+{
+	bool status = false;				// pessimistic return value :(
+
+#if (FLASH_CACHE_SIZE > 0)
+	if (FindCacheEntry(id) != NULL)
+	{
+		status = true;
+	}
+	else if ((mNumCached < FLASH_CACHE_SIZE) && (id != LOOKUP_ID_EMPTY))
+	{
+		mCache[mNumCached].id = id;
+		mCache[mNumCached].growth = 0;
+		LoadCacheEntry(&mCache[mNumCached]);
+		mNumCached++;
+		status = true;
+	}
+#else
+	(void)id;
+#endif
+
+	return status;
+}
+
+/**
+ * @brief	Write the cached variables that have changed to flash.
+ * @returns	true for success; false if any couldn't be written
+ */
+bool FlashManFlush(void)
+{
+	bool status = true;					// an optimistic return value :)
+#if (FLASH_CACHE_SIZE > 0)
+	uint8_t i;							// counter
+
+	for (i = 0; i < mNumCached; i++)
+	{
+		if (mCache[i].dirty == true)
+		{
+			// StoreVariable counts its own growth.
+			mCachedGrowth -= mCache[i].growth;
+			if (StoreVariable(mCache[i].id, mCache[i].data, mCache[i].size) == true)
+			{
+				mCache[i].dirty = false;
+				mCache[i].growth = 0;
+			}
+			else
+			{
+				mCachedGrowth += mCache[i].growth;
+				status = false;
 			}
 		}
 	}
 
+	mCacheSets = 0;
+	mCacheTicks = 0;
+#endif
+
 	return status;
 }
 
+/**
+ * @brief	Flush the cache every FLASH_CACHE_FLUSH_TICKS calls.
+ * @remarks	Call this periodically (e.g. once a second).
+ */
+void FlashManCacheTask(void)
+{
+#if (FLASH_CACHE_SIZE > 0)
+	mCacheTicks++;
+	if ((FLASH_CACHE_FLUSH_TICKS > 0) && (mCacheTicks >= FLASH_CACHE_FLUSH_TICKS))
+	{
+		FlashManFlush();
+	}
+#endif
+}
+
+/**
+ * @brief	Do a step of garbage collection, if one is under way.
+ * @remarks	With FLASH_GC_INCREMENTAL, call this often (e.g. from the main
+ *			loop, or a low-priority task), so sets don't have to finish
+ *			collections themselves.  Each call copies up to
+ *			FLASH_GC_STEP_RECORDS records, or erases one segment.
+ */
+void FlashManCollectTask(void)
+{
+	if (mVictim != NUM_SECTORS)
+	{
+		CollectionStep();
+	}
+}
+
 /**
  * @brief	Get the number of variables Flash will hold.
  * @returns	max number of variables that can be stored by Flash.
@@ -848,3 +2399,75 @@ uint32_t FlashManGetMaxVariables(void)
 {
 	return MAX_VARIABLES;
 }
+
+/**
+ * @brief	Get statistics on how hard the flash has been worked.
+ * @remarks	With the flash's rated endurance (e.g. 100,000 erases for
+ *			MSP430), maxEraseCount and how fast it grows predict how long
+ *			the flash will last.  The erase counts are always exact.  After
+ *			a reset, collections (and their header writes) since the head
+ *			sector was opened aren't counted.
+ * @param	stats - returns the statistics
+ */
+void FlashManGetStats(flashManStats_t *stats)
+{
+	uint8_t i;							// counter
+
+	stats->sets = mTotals.sets;
+	stats->copies = mTotals.copies;
+	stats->collections = mTotals.collections;
+	stats->dataBytes = mTotals.dataBytes;
+	stats->flashBytes = mTotals.flashBytes;
+	stats->erases = 0;
+	stats->minEraseCount = mSectors[0].eraseCount;
+	stats->maxEraseCount = mSectors[0].eraseCount;
+
+	for (i = 0; i < NUM_SECTORS; i++)
+	{
+		stats->erases += mSectors[i].eraseCount;
+		if (mSectors[i].eraseCount < stats->minEraseCount)
+		{
+			stats->minEraseCount = mSectors[i].eraseCount;
+		}
+		if (mSectors[i].eraseCount > stats->maxEraseCount)
+		{
+			stats->maxEraseCount = mSectors[i].eraseCount;
+		}
+	}
+
+	// bytes written to flash for each byte of data, x100
+	stats->writeAmplification = 0;
+	if (mTotals.dataBytes > 0)
+	{
+		stats->writeAmplification = (uint32_t)(((uint64_t)mTotals.flashBytes * 100) / mTotals.dataBytes);
+	}
+
+	stats->liveBytes = mLiveBytes;
+	stats->freeBytes = CAPACITY - mLiveBytes;
+}
+
+/**
+ * @brief	Get the number of times a sector has been erased.
+ * @param	sector - sector number (0 to FlashManGetNumSectors() - 1)
+ * @returns	the sector's erase count; 0 if there's no such sector
+ */
+uint32_t FlashManGetEraseCount(uint8_t sector)
+{
+	uint32_t count = 0;					// return value
+
+	if (sector < NUM_SECTORS)
+	{
+		count = mSectors[sector].eraseCount;
+	}
+
+	return count;
+}
+
+/**
+ * @brief	Get the number of sectors Flash is spread over.
+ * @returns	number of sectors
+ */
+uint8_t FlashManGetNumSectors(void)
+{
+	return NUM_SECTORS;
+}
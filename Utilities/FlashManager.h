@@ -1,15 +1,30 @@
 /******************************************************************************
  * @file	FlashManager.h
  * @author	Adam Johnson
- * @remarks	Contains functions for EEPROM emulation using two pages of
- *			Flash memory.  Based on code from NXP's app note AN11008,
- *			titled "Flash based non-volatile storage."  Originally
- *			developed for MSP430.
+ * @remarks	Contains functions for EEPROM emulation using sectors of Flash
+ *			memory.  Based on code from NXP's app note AN11008, titled
+ *			"Flash based non-volatile storage."  Originally developed for
+ *			MSP430.
  *****************************************************************************/
 
 #ifndef MEM_MANAGER_H
 #define MEM_MANAGER_H
 
+typedef struct							// how hard the flash has been worked
+{
+	uint32_t sets;						// records written for the application
+	uint32_t copies;					// records copied by garbage collection
+	uint32_t collections;				// sectors garbage collected ("swaps")
+	uint32_t erases;					// sector erases, in all sectors
+	uint32_t minEraseCount;				// erases of the least-worn sector
+	uint32_t maxEraseCount;				// erases of the most-worn sector
+	uint32_t dataBytes;					// bytes of data the application set
+	uint32_t flashBytes;				// bytes written to flash
+	uint32_t writeAmplification;		// flashBytes per dataByte, x100
+	uint32_t liveBytes;					// bytes used by current records
+	uint32_t freeBytes;					// bytes left for more records
+} flashManStats_t;
+
 // Initialize access to non-volatile memory.
 bool FlashManInit(void);
 
@@ -19,7 +34,43 @@ bool FlashManSetVariable(uint16_t id, uint8_t *value, uint16_t size);
 // Get the value of a variable.
 bool FlashManGetVariable(uint16_t id, uint8_t *value, uint16_t size);
 
+// Get a pointer to a variable's value, without copying it.  It's only good
+// until flash is written again.
+bool FlashManGetVariableRef(uint16_t id, const uint8_t **value, uint16_t *size);
+
+// Start a transaction:  the sets that follow are stored together on commit.
+bool FlashManBeginTransaction(void);
+
+// Store all of a transaction's sets at once (or none, if power is lost).
+bool FlashManCommitTransaction(void);
+
+// End a transaction without storing its sets.
+void FlashManAbortTransaction(void);
+
+// Cache a frequently-set variable in RAM, so flash is written less often.
+bool FlashManCacheVariable(uint16_t id);
+
+// Write the cached variables that have changed to flash (e.g. before
+// powering down).
+bool FlashManFlush(void);
+
+// Call periodically to flush the cache every FLASH_CACHE_FLUSH_TICKS calls.
+void FlashManCacheTask(void);
+
+// Call often to do garbage collection a step at a time (see
+// FLASH_GC_INCREMENTAL).
+void FlashManCollectTask(void);
+
 // Get the number of variables Flash will hold.
 uint32_t FlashManGetMaxVariables(void);
 
+// Get statistics on how hard the flash has been worked.
+void FlashManGetStats(flashManStats_t *stats);
+
+// Get the number of times a sector has been erased.
+uint32_t FlashManGetEraseCount(uint8_t sector);
+
+// Get the number of sectors Flash is spread over.
+uint8_t FlashManGetNumSectors(void);
+
 #endif
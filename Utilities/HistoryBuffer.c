@@ -0,0 +1,272 @@
+/******************************************************************************
+ *
+ *	Filename:		HistoryBuffer.c
+ *
+ *	Author:			Adam Johnson
+ *
+ *	Description:	This module keeps a history of timestamped readings, for
+ *					trend displays and diagnostics.  It's a circular buffer of
+ *					records, where each record is a timestamp and one or more
+ *					values.  Records must be added in time order; when the
+ *					buffer is full, the oldest record is overwritten.
+ *
+ *					Timestamps are allowed to roll over (a millisecond counter
+ *					does every 49 days).  All comparisons are made relative to
+ *					the oldest record, so this works as long as the buffer
+ *					never spans more than half the range of a uint32_t.
+ *
+ *	Terms of Use:	MIT License
+ *
+ *****************************************************************************/
+
+#include <stdint.h>						// universal data types
+#include <stddef.h>						// defines "NULL"
+#include "HistoryBuffer.h"				// header for this module
+
+/******************************************************************************
+ *
+ *	Function:		GetIndex
+ *
+ *	Description:	Convert a position in the history (0 = oldest record) to
+ *					an index in the buffer's array.
+ *
+ *****************************************************************************/
+
+static uint16_t GetIndex(histBuff_t *buffer, uint16_t position)
+{
+	uint32_t index;						// return value
+
+	// Count from the read position, wrapping around the array if needed.
+	index = (uint32_t)buffer->readPos + position;
+	if (index >= HISTORY_SIZE)
+	{
+		index -= HISTORY_SIZE;
+	}
+
+	return (uint16_t)index;
+}
+
+/******************************************************************************
+ *
+ *	Function:		HistInit
+ *
+ *	Description:	Erase a buffer's contents, or set up a new buffer.
+ *
+ *****************************************************************************/
+
+void HistInit(histBuff_t *buffer)
+{
+	buffer->length = 0;		// Set number of records to zero.
+	buffer->readPos = 0;	// Set read position to first index in array.
+	buffer->writePos = 0;	// Set write position to first index in array.
+}
+
+/******************************************************************************
+ *
+ *	Function:		HistAdd
+ *
+ *	Description:	Pushes a new record to a buffer.  If the buffer is full,
+ *					the oldest record is thrown away to make room.
+ *
+ *	Parameters:		buffer - buffer to act upon
+ *					time - timestamp of the reading
+ *					values - array of HISTORY_NUM_VALUES readings
+ *
+ *	Return value:	0 for success; else the timestamp is older than the newest
+ *					record in the buffer, and the record wasn't added
+ *
+ *****************************************************************************/
+
+uint8_t HistAdd(histBuff_t *buffer, uint32_t time, float *values)
+{
+	histRecord_t *newest;				// newest record in the buffer
+	uint16_t i;							// counter
+	uint8_t error = 0;					// an optimistic return value :)
+
+	// Records must arrive in time order, or we can't search them.
+	if (buffer->length > 0)
+	{
+		newest = HistFetch(buffer, buffer->length - 1);
+		if ((int32_t)(time - newest->time) < 0)
+		{
+			error = 1;
+		}
+	}
+
+	if (error == 0)
+	{
+		// Add the new record.
+		buffer->record[buffer->writePos].time = time;
+		for (i = 0; i < HISTORY_NUM_VALUES; i++)
+		{
+			buffer->record[buffer->writePos].value[i] = values[i];
+		}
+
+		// Mark the buffer's new tail...
+		buffer->writePos++;
+
+		// ...wrap around the array if needed.
+		if (buffer->writePos >= HISTORY_SIZE)
+		{
+			buffer->writePos = 0;
+		}
+
+		// If the buffer was full, we just overwrote the oldest record...
+		if (buffer->length >= HISTORY_SIZE)
+		{
+			// ...so the oldest record is now the next one.
+			buffer->readPos = buffer->writePos;
+		}
+
+		// Otherwise, increment the buffer's length.
+		else
+		{
+			buffer->length++;
+		}
+	}
+
+	return error;
+}
+
+/******************************************************************************
+ *
+ *	Function:		HistGetLength
+ *
+ *	Description:	Count records in a buffer.
+ *
+ *****************************************************************************/
+
+uint16_t HistGetLength(histBuff_t *buffer)
+{
+	return buffer->length;
+}
+
+/******************************************************************************
+ *
+ *	Function:		HistFetch
+ *
+ *	Description:	View a record in a buffer, but don't remove it.  Position 0
+ *					is the oldest record.
+ *
+ *	Return value:	pointer to the record; NULL if position is past the end
+ *
+ *****************************************************************************/
+
+histRecord_t *HistFetch(histBuff_t *buffer, uint16_t position)
+{
+	histRecord_t *record = NULL;		// return value
+
+	if (position < buffer->length)
+	{
+		record = &buffer->record[GetIndex(buffer, position)];
+	}
+
+	return record;
+}
+
+/******************************************************************************
+ *
+ *	Function:		HistFindTime
+ *
+ *	Description:	Find the first record taken at or after a time.  This is a
+ *					binary search over positions, so the wrap in the array
+ *					doesn't matter.
+ *
+ *	Return value:	position of the record; equals the buffer's length if all
+ *					records are older than the time
+ *
+ *****************************************************************************/
+
+uint16_t HistFindTime(histBuff_t *buffer, uint32_t time)
+{
+	uint32_t oldestTime;				// timestamp of the oldest record
+	uint32_t target;					// time to find, relative to oldest
+	uint16_t low = 0;					// lowest position that might match
+	uint16_t high = buffer->length;		// one past highest position to check
+	uint16_t middle;					// position being checked
+
+	if (buffer->length > 0)
+	{
+		// Measure time from the oldest record, so rollover doesn't matter.
+		oldestTime = buffer->record[buffer->readPos].time;
+
+		// If the time is before the oldest record, the oldest record is it.
+		if ((int32_t)(time - oldestTime) <= 0)
+		{
+			high = 0;
+		}
+
+		target = time - oldestTime;
+
+		// Narrow the range until only the answer is left.
+		while (low < high)
+		{
+			middle = low + ((high - low) / 2);
+
+			if ((buffer->record[GetIndex(buffer, middle)].time - oldestTime) < target)
+			{
+				low = middle + 1;
+			}
+			else
+			{
+				high = middle;
+			}
+		}
+	}
+
+	return low;
+}
+
+/******************************************************************************
+ *
+ *	Function:		HistRangeInit
+ *
+ *	Description:	Start walking through the records taken between two times
+ *					(inclusive), oldest first.
+ *
+ *	Parameters:		buffer - buffer to walk
+ *					iter - walk to set up
+ *					startTime - earliest timestamp to visit
+ *					endTime - latest timestamp to visit
+ *
+ *****************************************************************************/
+
+void HistRangeInit(histBuff_t *buffer, histIter_t *iter,
+	uint32_t startTime, uint32_t endTime)
+{
+	iter->buffer = buffer;
+	iter->position = HistFindTime(buffer, startTime);
+	iter->endTime = endTime;
+}
+
+/******************************************************************************
+ *
+ *	Function:		HistRangeNext
+ *
+ *	Description:	Get the next record in a walk through a time range.
+ *
+ *	Parameters:		iter - walk to act upon
+ *					record - pointer to the record (valid until the next
+ *						HistAdd)
+ *
+ *	Return value:	0 for success; else there are no more records in range
+ *
+ *****************************************************************************/
+
+uint8_t HistRangeNext(histIter_t *iter, histRecord_t **record)
+{
+	histRecord_t *next;					// record at the walk's position
+	uint8_t error = 1;					// a pessimistic return value :(
+
+	next = HistFetch(iter->buffer, iter->position);
+
+	// Stop at the end of the buffer, or at the end of the time range.
+	if ((next != NULL) && ((int32_t)(iter->endTime - next->time) >= 0))
+	{
+		*record = next;
+		iter->position++;
+		error = 0;
+	}
+
+	return error;
+}
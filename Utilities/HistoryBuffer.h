@@ -0,0 +1,60 @@
+/******************************************************************************
+ *
+ *	Filename:		HistoryBuffer.h
+ *
+ *	Author:			Adam Johnson
+ *
+ *	Description:	This module keeps a history of timestamped readings, for
+ *					trend displays and diagnostics.  It's a circular buffer of
+ *					records, where each record is a timestamp and one or more
+ *					values.  Records must be added in time order; when the
+ *					buffer is full, the oldest record is overwritten.
+ *
+ *					Because the records are sorted by time, finding the first
+ *					record at or after a time is a binary search, so asking
+ *					for "the last 10 minutes" doesn't get slower as the
+ *					history grows.
+ *
+ *	Terms of Use:	MIT License
+ *
+ *****************************************************************************/
+
+#ifndef HISTORYBUFFER_H
+#define	HISTORYBUFFER_H
+
+#define HISTORY_SIZE		64			// maximum number of records per buffer
+										// Must fit in a uint16_t.
+#define HISTORY_NUM_VALUES	1			// number of values in each record
+
+typedef struct							// a reading and when it was taken
+{
+	uint32_t time;						// timestamp (e.g. from TimerGetMS)
+	float value[HISTORY_NUM_VALUES];	// the reading(s)
+} histRecord_t;
+
+typedef struct
+{
+	histRecord_t record[HISTORY_SIZE];	// array holding records in the buffer
+	uint16_t readPos;					// index in array where oldest record is
+	uint16_t length;					// number of records in the buffer
+	uint16_t writePos;					// index in array where new record goes
+} histBuff_t;
+
+typedef struct							// walks the records in a time range
+{
+	histBuff_t *buffer;					// buffer being walked
+	uint16_t position;					// next position to visit (0 = oldest)
+	uint32_t endTime;					// last timestamp to visit
+} histIter_t;
+
+void     HistInit(histBuff_t *buffer);								// Init/erase a buffer.
+uint8_t  HistAdd(histBuff_t *buffer, uint32_t time, float *values);	// Push newest record.
+uint16_t HistGetLength(histBuff_t *buffer);							// Get number of records.
+histRecord_t *HistFetch(histBuff_t *buffer, uint16_t position);		// Peek at a record.
+uint16_t HistFindTime(histBuff_t *buffer, uint32_t time);			// Search by time.
+void     HistRangeInit(histBuff_t *buffer, histIter_t *iter,
+			uint32_t startTime, uint32_t endTime);					// Start a walk.
+uint8_t  HistRangeNext(histIter_t *iter, histRecord_t **record);	// Step a walk.
+
+#endif	/* HISTORYBUFFER_H */
+
@@ -0,0 +1,542 @@
+/******************************************************************************
+ * @file	MeasurementStore.c
+ * @author	Adam Johnson
+ * @remarks	Saved measurements, kept in FRAM.
+ *
+ *			The readings are a circular log of fixed-size slots, like
+ *			PersistentLog:  two metadata records say which slot holds the
+ *			oldest reading, how many slots are in use, and the oldest
+ *			reading's number.  Readings are numbered in the order they were
+ *			saved, so a reading's slot is found from its number with a
+ *			subtraction, however many readings there are.
+ *
+ *			Erasing a reading clears its flag.  Erased readings at the start
+ *			of the log are dropped from it; others stay until they get to the
+ *			start, and are skipped when browsing.
+ *
+ *			Readings are read from FRAM a page (MEAS_PAGE_SIZE readings) at
+ *			a time, and the last page is kept in RAM, so browsing up and
+ *			down mostly doesn't read FRAM at all.
+ *****************************************************************************/
+
+#include <stdint.h>						// standard-size types
+#include <stdbool.h>					// defines "bool" type
+#include <stddef.h>						// defines "size_t", "offsetof"
+#include "MB85RS64.h"					// FRAM driver
+#include "Crc.h"						// CRC-16
+#include "MeasurementStore.h"			// header for this module
+
+/******************************************************************************
+ *	Local Settings, Typedefs
+ *****************************************************************************/
+
+// This struct is a reading, as stored in FRAM.
+typedef struct __attribute__((__packed__))
+{
+	uint32_t timestamp;					// when it was measured
+	float value;						// what was measured
+	uint8_t unit;						// units of value
+	uint8_t flag;						// MEAS_FLAG_xxx
+} measRecord_t;
+
+// This struct describes where the readings are.  It's stored in FRAM.
+typedef struct __attribute__((__packed__))
+{
+	uint32_t sequence;					// incremented on each update
+	uint32_t firstNumber;				// number of the reading in readPos
+	uint16_t readPos;					// slot holding the oldest reading
+	uint16_t length;					// number of slots in use
+	uint16_t crc;						// CRC-16 of the above
+} measMeta_t;
+
+// This flag marks a slot holding a reading.
+#define MEAS_FLAG_VALID			0xA5
+
+// This flag marks a slot whose reading was erased.
+#define MEAS_FLAG_ERASED		0x00
+
+// number of metadata records
+#define NUM_META				2
+
+// number of pages of slots
+#define NUM_PAGES				(MEAS_NUM_SLOTS / MEAS_PAGE_SIZE)
+
+// This page number means no page is in RAM.
+#define NO_PAGE					0xFFFF
+
+// address of each metadata record
+#define META_ADDR(n)			(MEAS_BASE_ADDR + ((n) * sizeof(measMeta_t)))
+
+// address of each slot
+#define SLOT_ADDR(n)			(MEAS_BASE_ADDR + (NUM_META * sizeof(measMeta_t)) + \
+									((uint32_t)(n) * sizeof(measRecord_t)))
+
+// Make sure slots are whole pages, and fit the metadata's types.
+typedef char measSlotsCheck_t[
+	(((MEAS_NUM_SLOTS % MEAS_PAGE_SIZE) == 0) && (MEAS_NUM_SLOTS > 1) &&
+	 (MEAS_NUM_SLOTS < 0xFFFF)) ? 1 : -1];
+
+/******************************************************************************
+ *	Local variables
+ *****************************************************************************/
+
+static measMeta_t mMeta;				// copy of the newest metadata
+static uint8_t mMetaIndex;				// which record holds the newest metadata
+
+static measRecord_t mPage[MEAS_PAGE_SIZE];	// readings in the page in RAM
+static uint16_t mPageNumber = NO_PAGE;	// which page is in RAM
+
+/******************************************************************************
+ *	Local Functions
+ *****************************************************************************/
+
+/**
+ * @brief	Calculate the CRC of a metadata record.
+ * @param	meta - metadata to act upon
+ * @returns	CRC-16 of everything but the CRC itself
+ */
+static uint16_t CalcCrc(measMeta_t *meta)
+{
+	return Crc16Update(CRC16_START, (uint8_t *)meta, offsetof(measMeta_t, crc));
+}
+
+/**
+ * @brief	Check if a metadata record describes a possible store.
+ * @param	meta - metadata to check
+ * @returns	true if valid; false otherwise
+ */
+static bool IsMetaValid(measMeta_t *meta)
+{
+	bool result = true;					// an optimistic return value :)
+
+	if (meta->crc != CalcCrc(meta))
+	{
+		result = false;
+	}
+	else if ((meta->readPos >= MEAS_NUM_SLOTS) || (meta->length >= MEAS_NUM_SLOTS))
+	{
+		result = false;
+	}
+
+	return result;
+}
+
+/**
+ * @brief	Store new metadata in the record not holding the newest metadata.
+ * @param	readPos - slot holding the oldest reading
+ * @param	length - number of slots in use
+ * @param	firstNumber - number of the oldest reading
+ * @returns	true for success; false otherwise
+ */
+static bool WriteMeta(uint16_t readPos, uint16_t length, uint32_t firstNumber)
+{
+	measMeta_t newMeta;					// metadata to store
+	measMeta_t check;					// metadata read back
+	uint8_t newIndex;					// record to store it in
+	bool result = true;					// an optimistic return value :)
+
+	// Assemble the new metadata.
+	newMeta.sequence = mMeta.sequence + 1;
+	newMeta.firstNumber = firstNumber;
+	newMeta.readPos = readPos;
+	newMeta.length = length;
+	newMeta.crc = CalcCrc(&newMeta);
+
+	// Write it over the older record.
+	newIndex = (mMetaIndex + 1) % NUM_META;
+	FramWriteEnable(true);
+	FramWrite(META_ADDR(newIndex), (uint8_t *)&newMeta, sizeof(measMeta_t));
+
+	// Verify the data was written correctly.
+	FramRead(META_ADDR(newIndex), (uint8_t *)&check, sizeof(measMeta_t));
+	if ((check.sequence != newMeta.sequence) ||
+		(check.firstNumber != newMeta.firstNumber) ||
+		(check.readPos != newMeta.readPos) ||
+		(check.length != newMeta.length) ||
+		(check.crc != newMeta.crc))
+	{
+		result = false;
+	}
+
+	// From now on, this is the newest metadata.
+	if (result == true)
+	{
+		mMeta = newMeta;
+		mMetaIndex = newIndex;
+	}
+
+	return result;
+}
+
+/**
+ * @brief	Convert a position in the log (0 = oldest) to a slot.
+ * @param	position - position to convert
+ * @returns	slot number
+ */
+static uint16_t GetSlot(uint16_t position)
+{
+	uint32_t slot;						// return value
+
+	slot = (uint32_t)mMeta.readPos + position;
+	if (slot >= MEAS_NUM_SLOTS)
+	{
+		slot -= MEAS_NUM_SLOTS;
+	}
+
+	return (uint16_t)slot;
+}
+
+/**
+ * @brief	Get a reading, reading its page from FRAM if it isn't in RAM.
+ * @param	position - position of the reading (0 = oldest)
+ * @returns	the reading, in RAM
+ */
+static measRecord_t *GetRecord(uint16_t position)
+{
+	uint16_t slot = GetSlot(position);	// slot holding the reading
+
+	if ((slot / MEAS_PAGE_SIZE) != mPageNumber)
+	{
+		mPageNumber = slot / MEAS_PAGE_SIZE;
+		FramRead(SLOT_ADDR(mPageNumber * MEAS_PAGE_SIZE), (uint8_t *)mPage, sizeof(mPage));
+	}
+
+	return &mPage[slot % MEAS_PAGE_SIZE];
+}
+
+/**
+ * @brief	Check if a position in the log holds a reading that isn't erased.
+ * @param	position - position to check (0 = oldest)
+ * @returns	true if it does; false otherwise
+ */
+static bool IsLive(uint16_t position)
+{
+	return GetRecord(position)->flag == MEAS_FLAG_VALID;
+}
+
+/**
+ * @brief	Find a reading's position in the log.
+ * @param	number - reading number
+ * @returns	position; mMeta.length if the number isn't in the log
+ */
+static uint16_t GetPosition(uint32_t number)
+{
+	uint32_t position;					// return value
+
+	position = number - mMeta.firstNumber;
+	if ((number < mMeta.firstNumber) || (position >= mMeta.length))
+	{
+		position = mMeta.length;
+	}
+
+	return (uint16_t)position;
+}
+
+/**
+ * @brief	Find the first reading at or after a position that isn't erased,
+ *			wrapping around to the oldest reading.
+ * @remarks	The oldest reading is never erased (see DropErased), so this
+ *			stops there at the latest.
+ * @param	position - where to start looking
+ * @returns	position of the reading (the log mustn't be empty)
+ */
+static uint16_t FindLiveUp(uint16_t position)
+{
+	if (position >= mMeta.length)
+	{
+		position = 0;
+	}
+
+	while (IsLive(position) == false)
+	{
+		position++;
+		if (position >= mMeta.length)
+		{
+			position = 0;
+		}
+	}
+
+	return position;
+}
+
+/**
+ * @brief	Drop erased readings from the start of the log.
+ * @remarks	Keeps the oldest reading live, so browsing always finds one.
+ * @returns	true for success; false otherwise
+ */
+static bool DropErased(void)
+{
+	uint16_t count = 0;					// erased readings at the start
+	bool status = true;					// an optimistic return value :)
+
+	while ((count < mMeta.length) && (IsLive(count) == false))
+	{
+		count++;
+	}
+
+	if (count > 0)
+	{
+		status = WriteMeta(GetSlot(count), mMeta.length - count, mMeta.firstNumber + count);
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Write to a slot's reading, in FRAM and in the page in RAM.
+ * @param	slot - slot to act upon
+ * @param	offset - offset of the bytes in the reading
+ * @param	data - bytes to write
+ * @param	count - number of bytes to write
+ */
+static void WriteSlot(uint16_t slot, size_t offset, const uint8_t *data, size_t count)
+{
+	size_t i;							// counter
+
+	FramWriteEnable(true);
+	FramWrite(SLOT_ADDR(slot) + offset, data, count);
+
+	if ((slot / MEAS_PAGE_SIZE) == mPageNumber)
+	{
+		for (i = 0; i < count; i++)
+		{
+			((uint8_t *)&mPage[slot % MEAS_PAGE_SIZE])[offset + i] = data[i];
+		}
+	}
+}
+
+/******************************************************************************
+ *	Public functions
+ *****************************************************************************/
+
+/**
+ * @brief	Find the saved readings after a reset (or start a new store).
+ * @remarks	Call FramSetAddressSize (or FramImageOpen on Linux) first.
+ * @returns	true for success; false otherwise
+ */
+bool MeasInit(void)
+{
+	measMeta_t meta[NUM_META];			// metadata records from FRAM
+	bool valid[NUM_META];				// which records are valid
+	uint8_t i;							// counter
+	bool status = true;					// an optimistic return value :)
+
+	mPageNumber = NO_PAGE;
+
+	// Read both metadata records.
+	for (i = 0; i < NUM_META; i++)
+	{
+		FramRead(META_ADDR(i), (uint8_t *)&meta[i], sizeof(measMeta_t));
+		valid[i] = IsMetaValid(&meta[i]);
+	}
+
+	// Use the newest valid record.  (Compare sequence numbers so that
+	// rollover doesn't matter.)
+	if (valid[0] && valid[1])
+	{
+		mMetaIndex = ((int32_t)(meta[1].sequence - meta[0].sequence) > 0) ? 1 : 0;
+		mMeta = meta[mMetaIndex];
+	}
+	else if (valid[0] || valid[1])
+	{
+		mMetaIndex = valid[0] ? 0 : 1;
+		mMeta = meta[mMetaIndex];
+	}
+
+	// If neither is valid, there's no store.  Start a new one.
+	else
+	{
+		mMeta.sequence = 0;
+		mMetaIndex = 0;
+		status = WriteMeta(0, 0, 0);
+	}
+
+	// If power was lost right after the oldest reading was erased, finish
+	// dropping it.
+	if (status == true)
+	{
+		status = DropErased();
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Save a reading, and give it the next number.
+ * @remarks	A power cut before this returns loses only this reading.
+ * @param	reading - reading to save (its number is filled in)
+ * @returns	true for success; false if the store is full, or error
+ */
+bool MeasSave(measReading_t *reading)
+{
+	measRecord_t record;				// reading, as stored
+	uint16_t readPos = mMeta.readPos;	// slot holding the oldest reading
+	uint16_t length = mMeta.length;		// number of slots in use
+	uint32_t firstNumber = mMeta.firstNumber;	// number of the oldest reading
+	bool status = true;					// an optimistic return value :)
+
+	// If the store is full, the oldest reading goes away (or we fail).
+	if (length >= (MEAS_NUM_SLOTS - 1))
+	{
+		if (MEAS_OVERWRITE_OLDEST != 0)
+		{
+			readPos = GetSlot(1);
+			firstNumber++;
+			length--;
+		}
+		else
+		{
+			status = false;
+		}
+	}
+
+	if (status == true)
+	{
+		// Write the reading into the free slot after the newest reading.
+		// The log doesn't include this slot, so nothing is lost if power
+		// fails now.
+		record.timestamp = reading->timestamp;
+		record.value = reading->value;
+		record.unit = reading->unit;
+		record.flag = MEAS_FLAG_VALID;
+		WriteSlot(GetSlot(mMeta.length), 0, (uint8_t *)&record, sizeof(record));
+
+		// Make the reading part of the log.
+		reading->number = firstNumber + length;
+		status = WriteMeta(readPos, length + 1, firstNumber);
+	}
+
+	// If the oldest reading was thrown away, the next one may be erased.
+	if (status == true)
+	{
+		status = DropErased();
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Fetch a reading, or the next one after it.
+ * @remarks	If there isn't a reading at or after number, fetches the first
+ *			one.
+ * @param	number - number of the reading to fetch
+ * @param	reading - returns the reading (and its number)
+ * @returns	true for success; false if there are no readings
+ */
+bool MeasFetch(uint32_t number, measReading_t *reading)
+{
+	measRecord_t *record;				// reading, as stored
+	uint16_t position;					// position of the reading
+	bool status = false;				// a pessimistic return value :(
+
+	if (mMeta.length > 0)
+	{
+		// Numbers before the oldest reading start at the oldest reading.
+		if (number < mMeta.firstNumber)
+		{
+			number = mMeta.firstNumber;
+		}
+
+		position = FindLiveUp(GetPosition(number));
+		record = GetRecord(position);
+
+		reading->number = mMeta.firstNumber + position;
+		reading->timestamp = record->timestamp;
+		reading->value = record->value;
+		reading->unit = record->unit;
+		status = true;
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Get the number of the next reading.
+ * @remarks	Wraps around from the last reading to the first.
+ * @param	number - number of the current reading
+ * @returns	number of the next reading; MEAS_NONE if there are none
+ */
+uint32_t MeasUp(uint32_t number)
+{
+	uint32_t nextNumber = MEAS_NONE;	// return value
+
+	if (mMeta.length > 0)
+	{
+		// Numbers before the oldest reading go up to the oldest reading.
+		if ((number + 1) < mMeta.firstNumber)
+		{
+			number = mMeta.firstNumber - 1;
+		}
+
+		nextNumber = mMeta.firstNumber + FindLiveUp(GetPosition(number + 1));
+	}
+
+	return nextNumber;
+}
+
+/**
+ * @brief	Get the number of the previous reading.
+ * @remarks	Wraps around from the first reading to the last.
+ * @param	number - number of the current reading
+ * @returns	number of the previous reading; MEAS_NONE if there are none
+ */
+uint32_t MeasDown(uint32_t number)
+{
+	uint16_t position;					// position being checked
+	uint32_t nextNumber = MEAS_NONE;	// return value
+
+	if (mMeta.length > 0)
+	{
+		// Start at the reading before number, or the last reading if that
+		// isn't in the log.
+		if ((number <= mMeta.firstNumber) ||
+			((number - mMeta.firstNumber) > mMeta.length))
+		{
+			position = mMeta.length - 1;
+		}
+		else
+		{
+			position = (uint16_t)(number - mMeta.firstNumber - 1);
+		}
+
+		// Skip erased readings.  The oldest reading isn't one.
+		while (IsLive(position) == false)
+		{
+			position--;
+		}
+
+		nextNumber = mMeta.firstNumber + position;
+	}
+
+	return nextNumber;
+}
+
+/**
+ * @brief	Erase one reading.
+ * @param	number - number of the reading to erase
+ * @returns	true for success; false if there's no such reading, or error
+ */
+bool MeasErase(uint32_t number)
+{
+	uint16_t position;					// position of the reading
+	uint8_t flag = MEAS_FLAG_ERASED;	// new flag for the reading
+	bool status = false;				// a pessimistic return value :(
+
+	position = GetPosition(number);
+	if ((position < mMeta.length) && (IsLive(position) == true))
+	{
+		WriteSlot(GetSlot(position), offsetof(measRecord_t, flag), &flag, sizeof(flag));
+		status = DropErased();
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Erase all readings, and start numbering them from 0 again.
+ * @returns	true for success; false otherwise
+ */
+bool MeasEraseAll(void)
+{
+	return WriteMeta(0, 0, 0);
+}
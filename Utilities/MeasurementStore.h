@@ -0,0 +1,83 @@
+/******************************************************************************
+ * @file	MeasurementStore.h
+ * @author	Adam Johnson
+ * @remarks	Saved measurements (value, units and time), kept in FRAM.  Each
+ *			reading gets a number when it's saved, and can be fetched,
+ *			browsed up and down, and erased by number, like the readings in
+ *			MemoryFunctions.c, but there can be thousands of them.  RAM use
+ *			doesn't depend on how many there are.  Uses the MB85RS64 FRAM
+ *			driver (or its Linux stand-in).
+ *****************************************************************************/
+
+#ifndef MEASUREMENT_STORE_H
+#define MEASUREMENT_STORE_H
+
+/******************************************************************************
+ *	Configuration Settings
+ *	(Settings with #ifndef can be changed from the compiler's command line.)
+ *****************************************************************************/
+
+// address in FRAM where the store starts (after PersistentLog's entries)
+#ifndef MEAS_BASE_ADDR
+#define MEAS_BASE_ADDR			0x1100
+#endif
+
+// number of reading slots.  The default fits in the rest of an MB85RS64
+// (8 KB).  A bigger FRAM (e.g. an MB85RS2MT, 256 KB, with 3-byte addresses)
+// holds thousands.  It must be a multiple of MEAS_PAGE_SIZE.
+#ifndef MEAS_NUM_SLOTS
+#define MEAS_NUM_SLOTS			352
+#endif
+
+// number of readings read from FRAM at once, and kept in RAM for browsing
+#ifndef MEAS_PAGE_SIZE
+#define MEAS_PAGE_SIZE			16
+#endif
+
+// Set this to 1 to throw away the oldest reading when the store is full.
+// With 0, MeasSave fails instead.
+#ifndef MEAS_OVERWRITE_OLDEST
+#define MEAS_OVERWRITE_OLDEST	0
+#endif
+
+/******************************************************************************
+ *	Constants, Typedefs
+ *****************************************************************************/
+
+// This number means "no reading".
+#define MEAS_NONE				0xFFFFFFFF
+
+typedef struct							// a saved measurement
+{
+	uint32_t number;					// reading number (given by MeasSave)
+	uint32_t timestamp;					// when it was measured
+	float value;						// what was measured
+	uint8_t unit;						// units of value (up to the application)
+} measReading_t;
+
+/******************************************************************************
+ *	Public functions
+ *****************************************************************************/
+
+// Find the saved readings after a reset (or start a new store).
+bool MeasInit(void);
+
+// Save a reading, and give it the next number.
+bool MeasSave(measReading_t *reading);
+
+// Fetch a reading, or the next one after it (wrapping around to the first).
+bool MeasFetch(uint32_t number, measReading_t *reading);
+
+// Get the number of the next reading (wrapping around to the first).
+uint32_t MeasUp(uint32_t number);
+
+// Get the number of the previous reading (wrapping around to the last).
+uint32_t MeasDown(uint32_t number);
+
+// Erase one reading.
+bool MeasErase(uint32_t number);
+
+// Erase all readings, and start numbering them from 0 again.
+bool MeasEraseAll(void);
+
+#endif
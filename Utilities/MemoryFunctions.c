@@ -7,6 +7,9 @@
  * To search for a value by ID, search for the desired index, and then read the
  * memory value with the same offset.
  * In this way, values can be added, deleted, and read arbitrarily.
+ * The indexes are also kept in RAM, with a list of the full slots sorted by
+ * index, so browsing only reads the value itself from EEPROM.  The RAM copy
+ * is read from EEPROM once (MemInit), and kept up to date on save and erase.
  *****************************************************************************/
 
 #define NUM_MEMORY				40		// number of stored readings allowed
@@ -16,48 +19,99 @@
 #define MEM_ADDR				42		// 160 bytes - array of floats (4 bytes each)*
 #define MEM_INDEX_ADDR			202		// 40 bytes - uint8 - index of each reading
 
-float MemFetch(uint16_t index)
+#define MEM_INDEX_EMPTY			0xFF	// index of an empty slot
+
+// RAM copy of the indexes
+static uint8_t mSlotIndex[NUM_MEMORY];	// index of each slot (or MEM_INDEX_EMPTY)
+static uint8_t mSorted[NUM_MEMORY];		// full slots, in order of their index
+static uint8_t mNumSorted = 0;			// number of full slots
+static bool mIndexLoaded = false;		// has the RAM copy been read?
+
+/**
+ * @brief	Read the indexes from EEPROM into RAM, and sort the full slots.
+ * @remarks	Call at startup.  (The functions below call it the first time
+ *			if it hasn't been.)
+ */
+void MemInit(void)
 {
-	float value;						// value fetched from EEPROM
-	uint8_t addr;						// address counter
-	volatile uint8_t i;					// index of value in memory
-	uint8_t foundIndex = 0xFF;			// desired index or the next higher one
-	uint8_t foundAddr;					// data value corresponding to foundIndex
-	uint8_t lowestIndex = 0xFF;			// lowest valid index in memory
-	uint8_t lowestAddr;					// data value corresponding to lowestIndex
-
-	// Find either the desired index or the first full location after that.
+	uint8_t addr;						// slot being read
+	uint8_t i;							// position in the sorted list
+	uint8_t index;						// index of the slot
+
+	mNumSorted = 0;
+
 	for (addr = 0; addr < NUM_MEMORY; addr++)
 	{
-		i = EEPROMreadByte(MEM_INDEX_ADDR + addr);
+		index = EEPROMreadByte(MEM_INDEX_ADDR + addr);
+		mSlotIndex[addr] = index;
 
-		// Find either the desired index or the next highest one.
-		if ((index <= i) && (i < foundIndex))
+		// Insert full slots into the sorted list.
+		if (index != MEM_INDEX_EMPTY)
 		{
-			foundIndex = i;
-			foundAddr = addr;
+			for (i = mNumSorted; (i > 0) && (mSlotIndex[mSorted[i - 1]] > index); i--)
+			{
+				mSorted[i] = mSorted[i - 1];
+			}
+			mSorted[i] = addr;
+			mNumSorted++;
 		}
+	}
+
+	mIndexLoaded = true;
+}
+
+/**
+ * @brief	Find where an index is, or would go, in the sorted list.
+ * @param	index - index to look for
+ * @returns	position of the first full slot with an index >= index
+ *			(mNumSorted if there isn't one)
+ */
+static uint8_t FindSorted(uint16_t index)
+{
+	uint8_t low = 0;					// first position that might be it
+	uint8_t high;						// last position that might be it, + 1
+	uint8_t middle;						// position being checked
+
+	if (mIndexLoaded == false)
+	{
+		MemInit();
+	}
 
-		// Also find the lowest index overall.
-		if (i < lowestIndex)
+	// binary search
+	high = mNumSorted;
+	while (low < high)
+	{
+		middle = (low + high) / 2;
+		if (mSlotIndex[mSorted[middle]] < index)
 		{
-			lowestIndex = i;
-			lowestAddr = addr;
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
 		}
 	}
 
-	// If there was nothing at or above the desired index, use lowest index.
-	// If the lowest index is invalid, memory is empty.
-	if (foundIndex == 0xFF)
+	return low;
+}
+
+float MemFetch(uint16_t index)
+{
+	float value;						// value fetched from EEPROM
+	uint8_t position;					// position in the sorted list
+
+	// Find either the desired index or the next higher one.  If there's
+	// nothing at or above the desired index, use the lowest index.
+	position = FindSorted(index);
+	if (position == mNumSorted)
 	{
-		foundIndex = lowestIndex;
-		foundAddr = lowestAddr;
+		position = 0;
 	}
 
-	if (foundIndex != 0xFF)
+	if (mNumSorted > 0)
 	{
 		// Fetch the memory value.
-		value = EEPROMreadFloat(MEM_ADDR + (4 * foundAddr));
+		value = EEPROMreadFloat(MEM_ADDR + (4 * mSorted[position]));
 	}
 	else
 	{
@@ -70,46 +124,23 @@ float MemFetch(uint16_t index)
 
 uint8_t AppMemUp(uint8_t currentIndex)
 {
-	uint8_t addr;						// address counter
-	volatile uint8_t index;				// index of value in memory
-	uint8_t foundIndex = 0xFF;			// greatest index <= desired index
-	uint8_t lowestIndex = 0xFF;			// greatest index overall
-	uint8_t nextIndex;					// return value
+	uint8_t position;					// position in the sorted list
+	uint8_t nextIndex = MEM_INDEX_EMPTY;	// return value
 
 	// Find either:
 	//	(1) the desired index (memoryIndex + 1), or
 	//	(2) the lowest index that's higher than the desired index, or
 	//	(3) the lowest index overall.
-
-	// Search through the saved readings.
-	for (addr = 0; addr < NUM_MEMORY; addr++)
+	position = FindSorted(currentIndex + 1);
+	if (position == mNumSorted)
 	{
-		// Fetch the index.
-		index = EEPROMreadByte(MEM_INDEX_ADDR + addr);
-
-		// (1) and (2) can be done in a single if statement:
-		// Look for the lowest index between 0xFF and the desired index.
-		if (((currentIndex + 1) <= index) && (index < foundIndex))
-		{
-			foundIndex = index;
-		}
-
-		// Look for (3) the lowest index overall.
-		if (index > lowestIndex)
-		{
-			lowestIndex = index;
-		}
+		position = 0;
 	}
 
-	// If there was nothing at or above the desired index, use lowest index.
-	// If the lowest index is invalid, memory is empty.
-	if (foundIndex != 0xFF)
-	{
-		nextIndex = foundIndex;
-	}
-	else
+	// If memory is empty, the index is invalid.
+	if (mNumSorted > 0)
 	{
-		nextIndex = lowestIndex;
+		nextIndex = mSlotIndex[mSorted[position]];
 	}
 
 	return nextIndex;
@@ -117,46 +148,24 @@ uint8_t AppMemUp(uint8_t currentIndex)
 
 uint8_t AppMemDown(uint8_t currentIndex)
 {
-	uint8_t addr;						// address counter
-	volatile int8_t index;				// index of value in memory
-	int8_t foundIndex = -1;				// greatest index <= desired index
-	int8_t highestIndex = -1;			// greatest index overall
-	uint8_t nextIndex;					// return value
+	uint8_t position;					// position in the sorted list
+	uint8_t nextIndex = MEM_INDEX_EMPTY;	// return value
 
 	// Find either:
 	//	(1) the desired index (memoryIndex - 1), or
 	//	(2) the highest index that's lower than the desired index, or
 	//	(3) the highest index overall.
-
-	// Search through the saved readings.
-	for (addr = 0; addr < NUM_MEMORY; addr++)
+	// The one before the first index >= currentIndex is (1) or (2).
+	position = FindSorted(currentIndex);
+	if (position == 0)
 	{
-		// Fetch the index.
-		index = (int8)EEPROMreadByte(MEM_INDEX_ADDR + addr);
-
-		// (1) and (2) can be done in a single if statement:
-		// Look for the highest index between 0 and the desired index.
-		if ((foundIndex < index) && (index <= (currentIndex - 1)))
-		{
-			foundIndex = index;
-		}
-
-		// Look for (3) the highest index overall.
-		if (index > highestIndex)
-		{
-			highestIndex = index;
-		}
+		position = mNumSorted;
 	}
 
-	// If there was nothing at or below the desired index, use greatest index.
-	// If the greatest index is invalid, memory is empty.
-	if (foundIndex != -1)
+	// If memory is empty, the index is invalid.
+	if (mNumSorted > 0)
 	{
-		nextIndex = foundIndex;
-	}
-	else
-	{
-		nextIndex = highestIndex;
+		nextIndex = mSlotIndex[mSorted[position - 1]];
 	}
 
 	return nextIndex;
@@ -166,32 +175,32 @@ uint8_t AppSaveMem(void)
 {
 	mErr_t error;						// error code from manometer
 	uint8_t addr;
-	volatile uint8_t index;
-	uint8_t emptyAddr = 0xFF;				// empty spot for new reading
-	int8 newIndex = -1;					// index of new reading
+	uint8_t emptyAddr = 0xFF;			// empty spot for new reading
+	uint8_t newIndex = 0;				// index of new reading
 	float value;						// value to be saved
-	volatile uint8_t numSaved = 0;		// number of saved readings
 
-	for (addr = 0; addr < NUM_MEMORY; addr++)
+	if (mIndexLoaded == false)
 	{
-		index = EEPROMreadByte(MEM_INDEX_ADDR + addr);
+		MemInit();
+	}
 
-		// Find the first empty slot in EEPROM.
-		if ((emptyAddr == 0xFF) && (index == 0xFF))	// 0xFF means "I'm empty."
+	// Find the first empty slot.
+	for (addr = 0; (addr < NUM_MEMORY) && (emptyAddr == 0xFF); addr++)
+	{
+		if (mSlotIndex[addr] == MEM_INDEX_EMPTY)
 		{
 			emptyAddr = addr;
 		}
+	}
 
-		// Find the highest index.  This is the number of stored readings.
-		// Casting index to signed integer makes 0xFF (empty) = -1.
-		if ((int8)index >= newIndex)
-		{
-			newIndex = index + 1;
-		}
+	// The new reading goes after the highest index.
+	if (mNumSorted > 0)
+	{
+		newIndex = mSlotIndex[mSorted[mNumSorted - 1]] + 1;
 	}
 
-	// If memory is full...
-	if (emptyAddr > NUM_MEMORY)
+	// If memory is full (or the indexes have run out)...
+	if ((emptyAddr >= NUM_MEMORY) || (newIndex == MEM_INDEX_EMPTY))
 	{
 		DisplayAlphaString("ERR", 3);	// ...tell the user.
 		DisplayMainString("FULL", 4);
@@ -212,13 +221,14 @@ uint8_t AppSaveMem(void)
 			// Save the reading.
 			EEPROMwriteFloat(MEM_ADDR + (4 * emptyAddr), value);
 
-			// Save the reading's index.
+			// Save the reading's index.  It's the highest, so it goes at
+			// the end of the sorted list.
 			EEPROMwriteByte(MEM_INDEX_ADDR + emptyAddr, newIndex);
+			mSlotIndex[emptyAddr] = newIndex;
+			mSorted[mNumSorted++] = emptyAddr;
 
 			// Update the count of saved readings.
-			numSaved = EEPROMreadByte(MEM_SAVED_ADDR);
-			EEPROMwriteByte(MEM_SAVED_ADDR, ++numSaved);
-//			EEPROMwriteByte(MEM_SAVED_ADDR, newIndex);
+			EEPROMwriteByte(MEM_SAVED_ADDR, mNumSorted);
 		}
 
 		// If there was an error (overflow, underflow, sensor error), let
@@ -237,8 +247,12 @@ uint8_t AppSaveMem(void)
 uint8_t AppEraseMem(void)
 {
 	uint8_t addr;						// counter
-	volatile uint16_t index;			// index of value in memory
-	volatile uint16_t numSaved = 0;	// highest index saved in memory
+	uint8_t position;					// position in the sorted list
+
+	if (mIndexLoaded == false)
+	{
+		MemInit();
+	}
 
 	// Erase all saved readings.
 	if (g_setting == SETTING_ALL)
@@ -250,8 +264,10 @@ uint8_t AppEraseMem(void)
 		for (addr = 0; addr < NUM_MEMORY; addr++)
 		{
 			// Write 0xFF for "empty".
-			EEPROMwriteByte(MEM_INDEX_ADDR + addr, 0xFF);
+			EEPROMwriteByte(MEM_INDEX_ADDR + addr, MEM_INDEX_EMPTY);
+			mSlotIndex[addr] = MEM_INDEX_EMPTY;
 		}
+		mNumSorted = 0;
 
 		// Clear the count of saved readings.
 		EEPROMwriteWord(MEM_SAVED_ADDR, 0);
@@ -261,30 +277,26 @@ uint8_t AppEraseMem(void)
 	else if (g_setting == SETTING_ONE_YES)
 	{
 		// Search for desired memory index.
-		for (addr = 0; addr < NUM_MEMORY; addr++)
+		position = FindSorted(g_memoryIndex);
+		if ((position < mNumSorted) && (mSlotIndex[mSorted[position]] == g_memoryIndex))
 		{
-			index = EEPROMreadByte(MEM_INDEX_ADDR + addr);
-			if (index == g_memoryIndex)
-			{
-				// Change to 0xFF for "empty".
-				index = 0xFF;
+			// Change to 0xFF for "empty", and save to EEPROM.
+			addr = mSorted[position];
+			EEPROMwriteByte(MEM_INDEX_ADDR + addr, MEM_INDEX_EMPTY);
+			mSlotIndex[addr] = MEM_INDEX_EMPTY;
 
-				// Save to EEPROM.
-				EEPROMwriteByte(MEM_INDEX_ADDR + addr, index);
-
-				// Decrement the memory index.
-				g_memoryIndex--;
-			}
-
-			// Find the (new) number of saved readings.
-			if ((int8)index >= 0)
+			// Take it out of the sorted list.
+			for (mNumSorted--; position < mNumSorted; position++)
 			{
-				numSaved++;
+				mSorted[position] = mSorted[position + 1];
 			}
+
+			// Decrement the memory index.
+			g_memoryIndex--;
 		}
 
 		// Update the number of saved readings.
-		EEPROMwriteByte(MEM_SAVED_ADDR, numSaved);
+		EEPROMwriteByte(MEM_SAVED_ADDR, mNumSorted);
 	}
 
 	return ST_MEM_VIEW;	// Go to the "view" state.
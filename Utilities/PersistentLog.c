@@ -0,0 +1,300 @@
+/******************************************************************************
+ * @file	PersistentLog.c
+ * @author	Adam Johnson
+ * @remarks	A circular log of fixed-size entries kept in FRAM, so events and
+ *			samples survive a reset.
+ *
+ *			The log's position (which slot holds the oldest entry, and how
+ *			many entries there are) is kept in two metadata records.  Each
+ *			update goes to the record not holding the newest metadata, along
+ *			with a sequence number and checksum.  If power is lost while one
+ *			is being written, the other still describes a complete log, so
+ *			recovery is just reading both records and keeping the newer
+ *			valid one.  Nothing else needs to be scanned.
+ *
+ *			An append writes the entry into the free slot after the newest
+ *			entry, then writes one metadata record.  Until the metadata is
+ *			written, the new entry isn't part of the log, so a power cut
+ *			while writing it loses only that entry.
+ *****************************************************************************/
+
+#include <stdint.h>						// standard-size types
+#include <stdbool.h>					// defines "bool" type
+#include <stddef.h>						// defines "size_t", "NULL"
+#include "MB85RS64.h"					// FRAM driver
+#include "PersistentLog.h"				// header for this module
+
+/******************************************************************************
+ *	Local Settings, Typedefs
+ *****************************************************************************/
+
+// This struct describes where the log is.  It's stored in FRAM.
+typedef struct __attribute__((__packed__))
+{
+	uint32_t sequence;					// incremented on each update
+	uint16_t readPos;					// slot holding the oldest entry
+	uint16_t length;					// number of entries in the log
+	uint8_t checksum;					// 2's complement checksum of the above
+} plogMeta_t;
+
+// number of metadata records
+#define NUM_META				2
+
+// address of each metadata record
+#define META_ADDR(n)			(PLOG_BASE_ADDR + ((n) * sizeof(plogMeta_t)))
+
+// address of each entry slot
+#define SLOT_ADDR(n)			(PLOG_BASE_ADDR + (NUM_META * sizeof(plogMeta_t)) + \
+									((uint32_t)(n) * PLOG_ENTRY_SIZE))
+
+/******************************************************************************
+ *	Local variables
+ *****************************************************************************/
+
+static plogMeta_t mMeta;				// copy of the newest metadata
+static uint8_t mMetaIndex;				// which record holds the newest metadata
+
+/******************************************************************************
+ *	Local Functions
+ *****************************************************************************/
+
+/**
+ * @brief	Calculate the checksum of a metadata record.
+ * @param	meta - metadata to act upon
+ * @returns	2's complement checksum of everything but the checksum itself
+ */
+static uint8_t CalcChecksum(plogMeta_t *meta)
+{
+	uint8_t *bytePtr = (uint8_t *)meta;	// metadata, as bytes
+	uint8_t checksum = 0;				// return value
+	size_t i;							// counter
+
+	for (i = 0; i < offsetof(plogMeta_t, checksum); i++)
+	{
+		checksum += bytePtr[i];
+	}
+
+	return (uint8_t)(0x100 - checksum);
+}
+
+/**
+ * @brief	Check if a metadata record describes a possible log.
+ * @param	meta - metadata to check
+ * @returns	true if valid; false otherwise
+ */
+static bool IsMetaValid(plogMeta_t *meta)
+{
+	bool result = true;					// an optimistic return value :)
+
+	if (meta->checksum != CalcChecksum(meta))
+	{
+		result = false;
+	}
+	else if ((meta->readPos >= PLOG_NUM_SLOTS) || (meta->length >= PLOG_NUM_SLOTS))
+	{
+		result = false;
+	}
+
+	return result;
+}
+
+/**
+ * @brief	Store new metadata in the record not holding the newest metadata.
+ * @param	readPos - slot holding the oldest entry
+ * @param	length - number of entries
+ * @returns	true for success; false otherwise
+ */
+static bool WriteMeta(uint16_t readPos, uint16_t length)
+{
+	plogMeta_t newMeta;					// metadata to store
+	plogMeta_t check;					// metadata read back
+	uint8_t newIndex;					// record to store it in
+	bool result = true;					// an optimistic return value :)
+
+	// Assemble the new metadata.
+	newMeta.sequence = mMeta.sequence + 1;
+	newMeta.readPos = readPos;
+	newMeta.length = length;
+	newMeta.checksum = CalcChecksum(&newMeta);
+
+	// Write it over the older record.
+	newIndex = (mMetaIndex + 1) % NUM_META;
+	FramWriteEnable(true);
+	FramWrite(META_ADDR(newIndex), (uint8_t *)&newMeta, sizeof(plogMeta_t));
+
+	// Verify the data was written correctly.
+	FramRead(META_ADDR(newIndex), (uint8_t *)&check, sizeof(plogMeta_t));
+	if ((check.sequence != newMeta.sequence) ||
+		(check.readPos != newMeta.readPos) ||
+		(check.length != newMeta.length) ||
+		(check.checksum != newMeta.checksum))
+	{
+		result = false;
+	}
+
+	// From now on, this is the newest metadata.
+	if (result == true)
+	{
+		mMeta = newMeta;
+		mMetaIndex = newIndex;
+	}
+
+	return result;
+}
+
+/**
+ * @brief	Convert a position in the log (0 = oldest) to a slot.
+ * @param	position - position to convert
+ * @returns	slot number
+ */
+static uint16_t GetSlot(uint16_t position)
+{
+	uint32_t slot;						// return value
+
+	slot = (uint32_t)mMeta.readPos + position;
+	if (slot >= PLOG_NUM_SLOTS)
+	{
+		slot -= PLOG_NUM_SLOTS;
+	}
+
+	return (uint16_t)slot;
+}
+
+/******************************************************************************
+ *	Public functions
+ *****************************************************************************/
+
+/**
+ * @brief	Find the log and recover it after a reset (or start a new log).
+ * @remarks	Call FramSetAddressSize (or FramImageOpen on Linux) first.
+ * @returns	true for success; false otherwise
+ */
+bool PLogInit(void)
+{
+	plogMeta_t meta[NUM_META];			// metadata records from FRAM
+	bool valid[NUM_META];				// which records are valid
+	uint8_t i;							// counter
+	bool status = true;					// an optimistic return value :)
+
+	// Read both metadata records.
+	for (i = 0; i < NUM_META; i++)
+	{
+		FramRead(META_ADDR(i), (uint8_t *)&meta[i], sizeof(plogMeta_t));
+		valid[i] = IsMetaValid(&meta[i]);
+	}
+
+	// Use the newest valid record.  (Compare sequence numbers so that
+	// rollover doesn't matter.)
+	if (valid[0] && valid[1])
+	{
+		mMetaIndex = ((int32_t)(meta[1].sequence - meta[0].sequence) > 0) ? 1 : 0;
+		mMeta = meta[mMetaIndex];
+	}
+	else if (valid[0] || valid[1])
+	{
+		mMetaIndex = valid[0] ? 0 : 1;
+		mMeta = meta[mMetaIndex];
+	}
+
+	// If neither is valid, there's no log.  Start a new one.
+	else
+	{
+		mMeta.sequence = 0;
+		mMetaIndex = 0;
+		status = WriteMeta(0, 0);
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Add an entry to the log, discarding the oldest if the log is full.
+ * @param	entry - PLOG_ENTRY_SIZE bytes to store
+ * @returns	true for success; false otherwise
+ */
+bool PLogAppend(const uint8_t *entry)
+{
+	uint16_t readPos = mMeta.readPos;	// slot holding the oldest entry
+	uint16_t length = mMeta.length;		// number of entries
+
+	// Write the entry into the free slot after the newest entry.  The log
+	// doesn't include this slot, so nothing is lost if power fails now.
+	FramWriteEnable(true);
+	FramWrite(SLOT_ADDR(GetSlot(length)), entry, PLOG_ENTRY_SIZE);
+
+	// If the log is full, the oldest entry goes away...
+	if (length >= (PLOG_NUM_SLOTS - 1))
+	{
+		readPos = GetSlot(1);
+	}
+
+	// ...otherwise the log gets longer.
+	else
+	{
+		length++;
+	}
+
+	// Make the entry part of the log.
+	return WriteMeta(readPos, length);
+}
+
+/**
+ * @brief	Read an entry without removing it.
+ * @param	position - which entry to read (0 = oldest)
+ * @param	entry - PLOG_ENTRY_SIZE bytes read from the log
+ * @returns	true for success; false if there's no such entry
+ */
+bool PLogRead(uint16_t position, uint8_t *entry)
+{
+	bool status = false;				// a pessimistic return value :(
+
+	if (position < mMeta.length)
+	{
+		FramRead(SLOT_ADDR(GetSlot(position)), entry, PLOG_ENTRY_SIZE);
+		status = true;
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Remove the oldest entry.
+ * @param	entry - PLOG_ENTRY_SIZE bytes read from the log (or NULL)
+ * @returns	true for success; false if the log is empty
+ */
+bool PLogRemove(uint8_t *entry)
+{
+	bool status = false;				// a pessimistic return value :(
+
+	if (mMeta.length > 0)
+	{
+		// Read the entry if the caller wants it.
+		if (entry != NULL)
+		{
+			FramRead(SLOT_ADDR(mMeta.readPos), entry, PLOG_ENTRY_SIZE);
+		}
+
+		// Drop it from the log.
+		status = WriteMeta(GetSlot(1), mMeta.length - 1);
+	}
+
+	return status;
+}
+
+/**
+ * @brief	Get the number of entries in the log.
+ * @returns	number of entries
+ */
+uint16_t PLogGetLength(void)
+{
+	return mMeta.length;
+}
+
+/**
+ * @brief	Throw away all entries.
+ * @returns	true for success; false otherwise
+ */
+bool PLogErase(void)
+{
+	return WriteMeta(0, 0);
+}
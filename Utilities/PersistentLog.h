@@ -0,0 +1,46 @@
+/******************************************************************************
+ * @file	PersistentLog.h
+ * @author	Adam Johnson
+ * @remarks	A circular log of fixed-size entries kept in FRAM, so events and
+ *			samples survive a reset.  Uses the MB85RS64 FRAM driver (or its
+ *			Linux stand-in, which keeps the FRAM's contents in a file).
+ *****************************************************************************/
+
+#ifndef PERSISTENT_LOG_H
+#define PERSISTENT_LOG_H
+
+/******************************************************************************
+ *	Configuration Settings
+ *****************************************************************************/
+
+// address in FRAM where the log starts
+#define PLOG_BASE_ADDR			0x0000
+
+// size of each log entry [bytes]
+#define PLOG_ENTRY_SIZE			16
+
+// number of entry slots; the log holds one fewer entry than this, because
+// the slot being written is never one the log says is in use
+#define PLOG_NUM_SLOTS			256
+
+/*****************************************************************************/
+
+// Find the log and recover it after a reset (or start a new log).
+bool PLogInit(void);
+
+// Add an entry to the log, discarding the oldest entry if the log is full.
+bool PLogAppend(const uint8_t *entry);
+
+// Read an entry without removing it (position 0 is the oldest entry).
+bool PLogRead(uint16_t position, uint8_t *entry);
+
+// Remove the oldest entry (entry may be NULL if it's not wanted).
+bool PLogRemove(uint8_t *entry);
+
+// Get the number of entries in the log.
+uint16_t PLogGetLength(void);
+
+// Throw away all entries.
+bool PLogErase(void);
+
+#endif
@@ -0,0 +1,282 @@
+/******************************************************************************
+ *
+ *	Filename:		PingPong.c
+ *
+ *	Author:			Adam Johnson
+ *
+ *	Description:	This module implements ping-pong (double) buffers for
+ *					streaming peripherals like ADCs and UARTs.  An interrupt
+ *					(or DMA) fills one half of the buffer while the
+ *					application processes the other half.
+ *
+ *					There are two ways to fill a buffer:
+ *					- An interrupt calls PingPongWrite for each sample or byte.
+ *					- A DMA channel fills PingPongGetFillPtr directly, and its
+ *					  "transfer complete" interrupt calls PingPongSwap, which
+ *					  returns where the next transfer should go.
+ *
+ *					There are two ways to find out a half is ready:
+ *					- The callback passed to PingPongInit (it runs in
+ *					  interrupt context, so keep it short).
+ *					- Polling PingPongGetReady from the main loop.
+ *					Either way, call PingPongRelease when finished with the
+ *					data, so that half can be filled again.
+ *
+ *					If a half fills before the application releases the other
+ *					one, new data is thrown away and the overrun flag is set.
+ *
+ *	Terms of Use:	MIT License
+ *
+ *****************************************************************************/
+
+#include <stdint.h>						// universal data types
+#include <stddef.h>						// defines "NULL"
+#include "PingPong.h"					// header for this module
+
+/******************************************************************************
+ *
+ *	Function:		HandOver
+ *
+ *	Description:	Give the half being filled to the application, and start
+ *					filling the other half.
+ *
+ *	Return value:	0 for success; else the application still has the other
+ *					half, so nothing changed
+ *
+ *****************************************************************************/
+
+static uint8_t HandOver(pingPong_t *pp)
+{
+	uint8_t *data;						// the half that's ready
+	uint8_t error = 0;					// an optimistic return value :)
+
+	// If the application isn't finished with the other half, we can't swap.
+	if (pp->readyFlag)
+	{
+		pp->overrunFlag = 1;
+		error = 1;
+	}
+
+	else
+	{
+		// The full half is now ready...
+		data = pp->half[pp->fillHalf];
+		pp->readyCount = pp->fillCount;
+		pp->readyFlag = 1;
+
+		// ...and we fill the other one.
+		pp->fillHalf ^= 1;
+		pp->fillCount = 0;
+
+		// Tell the application.
+		if (pp->Callback != NULL)
+		{
+			pp->Callback(data, pp->readyCount);
+		}
+	}
+
+	return error;
+}
+
+/******************************************************************************
+ *
+ *	Function:		PingPongInit
+ *
+ *	Description:	Set up a ping-pong buffer.
+ *
+ *	Parameters:		pp - buffer to act upon
+ *					memory - array of (2 * size) bytes for the two halves;
+ *						align it for the type of data being stored
+ *					size - size of each half [bytes]; make this a multiple of
+ *						the size of a sample
+ *					Callback - function to run when a half is ready (or NULL)
+ *
+ *****************************************************************************/
+
+void PingPongInit(pingPong_t *pp, uint8_t *memory, uint16_t size,
+	pingPongCallback_t Callback)
+{
+	pp->half[0] = memory;
+	pp->half[1] = memory + size;
+	pp->size = size;
+	pp->fillCount = 0;
+	pp->readyCount = 0;
+	pp->fillHalf = 0;
+	pp->readyFlag = 0;
+	pp->overrunFlag = 0;
+	pp->Callback = Callback;
+}
+
+/******************************************************************************
+ *
+ *	Function:		PingPongWrite
+ *
+ *	Description:	Add data (usually one sample) to the half being filled.
+ *					If that fills the half, the halves are swapped.  Call this
+ *					from the peripheral's interrupt.
+ *
+ *	Parameters:		pp - buffer to act upon
+ *					data - data to add
+ *					count - size of data [bytes]
+ *
+ *	Return value:	0 for success; else the data was lost (overrun)
+ *
+ *****************************************************************************/
+
+uint8_t PingPongWrite(pingPong_t *pp, const void *data, uint16_t count)
+{
+	const uint8_t *bytePtr = data;		// data, as bytes
+	uint8_t *fillPtr;					// where the data goes
+	uint8_t error = 0;					// an optimistic return value :)
+
+	// If the half is full (because we couldn't swap earlier), try again.
+	if ((pp->fillCount + count) > pp->size)
+	{
+		error = HandOver(pp);
+	}
+
+	if (error == 0)
+	{
+		// Copy the data.
+		fillPtr = pp->half[pp->fillHalf] + pp->fillCount;
+		pp->fillCount += count;
+		while (count > 0)
+		{
+			*fillPtr++ = *bytePtr++;
+			count--;
+		}
+
+		// If the half is full, swap.  (If we can't, we'll try again on the
+		// next write.  The data that's already here isn't lost.)
+		if (pp->fillCount >= pp->size)
+		{
+			HandOver(pp);
+		}
+	}
+
+	return error;
+}
+
+/******************************************************************************
+ *
+ *	Function:		PingPongGetFillPtr
+ *
+ *	Description:	Find where data should go, for DMA.
+ *
+ *	Return value:	pointer to the (empty) half being filled
+ *
+ *****************************************************************************/
+
+uint8_t *PingPongGetFillPtr(pingPong_t *pp)
+{
+	return pp->half[pp->fillHalf];
+}
+
+/******************************************************************************
+ *
+ *	Function:		PingPongSwap
+ *
+ *	Description:	Tell the buffer that DMA has filled the half being filled.
+ *					Call this from the DMA's "transfer complete" interrupt.
+ *
+ *	Parameters:		pp - buffer to act upon
+ *					count - number of bytes DMA put in the half
+ *
+ *	Return value:	where the next transfer should go; NULL on overrun (the
+ *					application still has the other half)
+ *
+ *****************************************************************************/
+
+uint8_t *PingPongSwap(pingPong_t *pp, uint16_t count)
+{
+	uint8_t *fillPtr = NULL;			// return value
+
+	pp->fillCount = count;
+
+	if (HandOver(pp) == 0)
+	{
+		fillPtr = pp->half[pp->fillHalf];
+	}
+
+	return fillPtr;
+}
+
+/******************************************************************************
+ *
+ *	Function:		PingPongFlush
+ *
+ *	Description:	Hand over the half being filled even if it isn't full
+ *					(e.g. when a UART's line goes idle, or before stopping).
+ *					Call this with the filling interrupt disabled, or from
+ *					that interrupt.  Does nothing if the half is empty, or if
+ *					the application still has the other half.
+ *
+ *****************************************************************************/
+
+void PingPongFlush(pingPong_t *pp)
+{
+	if (pp->fillCount > 0)
+	{
+		HandOver(pp);
+	}
+}
+
+/******************************************************************************
+ *
+ *	Function:		PingPongGetReady
+ *
+ *	Description:	Get the half that's ready to be processed, if there is one.
+ *
+ *	Parameters:		pp - buffer to act upon
+ *					count - number of bytes in the half
+ *
+ *	Return value:	pointer to the data; NULL if no half is ready
+ *
+ *****************************************************************************/
+
+uint8_t *PingPongGetReady(pingPong_t *pp, uint16_t *count)
+{
+	uint8_t *data = NULL;				// return value
+
+	if (pp->readyFlag)
+	{
+		data = pp->half[pp->fillHalf ^ 1];
+		*count = pp->readyCount;
+	}
+
+	return data;
+}
+
+/******************************************************************************
+ *
+ *	Function:		PingPongRelease
+ *
+ *	Description:	Tell the buffer the application is finished with the ready
+ *					half, so it can be filled again.
+ *
+ *****************************************************************************/
+
+void PingPongRelease(pingPong_t *pp)
+{
+	pp->readyFlag = 0;
+}
+
+/******************************************************************************
+ *
+ *	Function:		PingPongGetOverrun
+ *
+ *	Description:	Find out if data was lost since the last time this was
+ *					called.
+ *
+ *	Return value:	0 if no data was lost; else data was lost
+ *
+ *****************************************************************************/
+
+uint8_t PingPongGetOverrun(pingPong_t *pp)
+{
+	uint8_t overrun = pp->overrunFlag;	// return value
+
+	pp->overrunFlag = 0;
+
+	return overrun;
+}
@@ -0,0 +1,49 @@
+/******************************************************************************
+ *
+ *	Filename:		PingPong.h
+ *
+ *	Author:			Adam Johnson
+ *
+ *	Description:	This module implements ping-pong (double) buffers for
+ *					streaming peripherals like ADCs and UARTs.  An interrupt
+ *					(or DMA) fills one half of the buffer while the
+ *					application processes the other half.  When a half fills,
+ *					the halves swap, and a callback tells the application that
+ *					a half is ready.  Acquisition never has to stop while the
+ *					application is busy, as long as the application finishes
+ *					with a half before the other one fills.
+ *
+ *	Terms of Use:	MIT License
+ *
+ *****************************************************************************/
+
+#ifndef PINGPONG_H
+#define	PINGPONG_H
+
+// Runs (in interrupt context) when a half is ready to be processed.
+typedef void (*pingPongCallback_t)(uint8_t *data, uint16_t count);
+
+typedef struct
+{
+	uint8_t *half[2];					// the two halves of the buffer
+	uint16_t size;						// size of each half [bytes]
+	volatile uint16_t fillCount;		// bytes in the half being filled
+	volatile uint16_t readyCount;		// bytes in the half being processed
+	volatile uint8_t fillHalf;			// which half is being filled
+	volatile uint8_t readyFlag;			// is the other half being processed?
+	volatile uint8_t overrunFlag;		// was data lost?
+	pingPongCallback_t Callback;		// runs when a half is ready (or NULL)
+} pingPong_t;
+
+void     PingPongInit(pingPong_t *pp, uint8_t *memory, uint16_t size,
+			pingPongCallback_t Callback);							// Set up a buffer.
+uint8_t  PingPongWrite(pingPong_t *pp, const void *data, uint16_t count);	// ISR: add data.
+uint8_t *PingPongGetFillPtr(pingPong_t *pp);						// DMA: where to fill.
+uint8_t *PingPongSwap(pingPong_t *pp, uint16_t count);				// DMA: half is full.
+void     PingPongFlush(pingPong_t *pp);								// Hand over a partial half.
+uint8_t *PingPongGetReady(pingPong_t *pp, uint16_t *count);			// App: poll for data.
+void     PingPongRelease(pingPong_t *pp);							// App: done with data.
+uint8_t  PingPongGetOverrun(pingPong_t *pp);						// Check & clear overrun.
+
+#endif	/* PINGPONG_H */
+